@@ -28,9 +28,11 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/socket.h>
 #include <unistd.h>
 
 #include "ply-array.h"
+#include "ply-buffer.h"
 #include "ply-event-loop.h"
 #include "ply-list.h"
 #include "ply-logger.h"
@@ -43,17 +45,22 @@ struct _ply_boot_client
         ply_fd_watch_t                      *daemon_has_reply_watch;
         ply_list_t                          *requests_to_send;
         ply_list_t                          *requests_waiting_for_replies;
+        ply_buffer_t                        *reply_buffer;
         int                                  socket_fd;
+        int                                  protocol_version;
+        uint32_t                             next_request_id;
 
         ply_boot_client_disconnect_handler_t disconnect_handler;
         void                                *disconnect_handler_user_data;
 
         uint32_t                             is_connected : 1;
+        uint32_t                             is_negotiating : 1;
 };
 
 typedef struct
 {
         ply_boot_client_t                 *client;
+        uint32_t                           id;
         char                              *command;
         char                              *argument;
         ply_boot_client_response_handler_t handler;
@@ -63,6 +70,13 @@ typedef struct
 
 static void ply_boot_client_cancel_request (ply_boot_client_t         *client,
                                             ply_boot_client_request_t *request);
+static ply_boot_client_request_t *
+ply_boot_client_request_new (ply_boot_client_t                 *client,
+                             const char                        *request_command,
+                             const char                        *request_argument,
+                             ply_boot_client_response_handler_t handler,
+                             ply_boot_client_response_handler_t failed_handler,
+                             void                              *user_data);
 
 ply_boot_client_t *
 ply_boot_client_new (void)
@@ -74,6 +88,7 @@ ply_boot_client_new (void)
         client->daemon_has_reply_watch = NULL;
         client->requests_to_send = ply_list_new ();
         client->requests_waiting_for_replies = ply_list_new ();
+        client->reply_buffer = ply_buffer_new ();
         client->loop = NULL;
         client->is_connected = false;
         client->disconnect_handler = NULL;
@@ -161,10 +176,27 @@ ply_boot_client_free (ply_boot_client_t *client)
 
         ply_list_free (client->requests_to_send);
         ply_list_free (client->requests_waiting_for_replies);
+        ply_buffer_free (client->reply_buffer);
 
         free (client);
 }
 
+static void
+ply_boot_client_on_version_negotiated (ply_boot_client_t *client)
+{
+        ply_trace ("daemon speaks protocol version %d", PLY_BOOT_PROTOCOL_VERSION);
+        client->protocol_version = PLY_BOOT_PROTOCOL_VERSION;
+        client->is_negotiating = false;
+}
+
+static void
+ply_boot_client_on_version_negotiation_failed (ply_boot_client_t *client)
+{
+        ply_trace ("daemon only speaks protocol version 1");
+        client->protocol_version = 1;
+        client->is_negotiating = false;
+}
+
 bool
 ply_boot_client_connect (ply_boot_client_t                   *client,
                          ply_boot_client_disconnect_handler_t disconnect_handler,
@@ -196,6 +228,23 @@ ply_boot_client_connect (ply_boot_client_t                   *client,
         client->disconnect_handler_user_data = user_data;
 
         client->is_connected = true;
+        client->protocol_version = 1;
+        client->is_negotiating = false;
+        ply_buffer_clear (client->reply_buffer);
+
+        /* Ask for the newer protocol before anything else goes out.  Daemons
+         * that don't know about it will nak the request and we stay on
+         * version 1.
+         */
+        ply_list_append_data (client->requests_to_send,
+                              ply_boot_client_request_new (client,
+                                                           PLY_BOOT_PROTOCOL_REQUEST_TYPE_NEGOTIATE_VERSION,
+                                                           PLY_BOOT_PROTOCOL_VERSION_STRING,
+                                                           (ply_boot_client_response_handler_t)
+                                                           ply_boot_client_on_version_negotiated,
+                                                           (ply_boot_client_response_handler_t)
+                                                           ply_boot_client_on_version_negotiation_failed,
+                                                           client));
         return true;
 }
 
@@ -214,6 +263,7 @@ ply_boot_client_request_new (ply_boot_client_t                 *client,
 
         request = calloc (1, sizeof(ply_boot_client_request_t));
         request->client = client;
+        request->id = client->next_request_id++;
         request->command = strdup (request_command);
         if (request_argument != NULL)
                 request->argument = strdup (request_argument);
@@ -245,79 +295,65 @@ ply_boot_client_cancel_request (ply_boot_client_t         *client,
         ply_boot_client_request_free (request);
 }
 
-static void
-ply_boot_client_process_incoming_replies (ply_boot_client_t *client)
+static uint32_t
+get_uint32 (const char *bytes)
 {
-        ply_list_node_t *request_node;
-        ply_boot_client_request_t *request;
-        bool processed_reply;
-        uint8_t byte[2] = "";
-        uint32_t size;
-
-        assert (client != NULL);
+        const uint8_t *data = (const uint8_t *) bytes;
 
-        processed_reply = false;
-        if (ply_list_get_length (client->requests_waiting_for_replies) == 0) {
-                ply_error ("received unexpected response from boot status daemon");
-                return;
-        }
+        return (data[0] << 0) |
+               (data[1] << 8) |
+               (data[2] << 16) |
+               ((uint32_t) data[3] << 24);
+}
 
-        request_node = ply_list_get_first_node (client->requests_waiting_for_replies);
-        assert (request_node != NULL);
+static void
+append_uint32 (ply_buffer_t *buffer,
+               uint32_t      value)
+{
+        uint8_t bytes[4];
 
-        request = (ply_boot_client_request_t *) ply_list_node_get_data (request_node);
-        assert (request != NULL);
+        bytes[0] = (value >> 0) & 0xFF;
+        bytes[1] = (value >> 8) & 0xFF;
+        bytes[2] = (value >> 16) & 0xFF;
+        bytes[3] = (value >> 24) & 0xFF;
 
-        if (!ply_read (client->socket_fd, byte, sizeof(uint8_t)))
-                goto out;
+        ply_buffer_append_bytes (buffer, bytes, sizeof(bytes));
+}
 
-        if (memcmp (byte, PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK, sizeof(uint8_t)) == 0) {
+static bool
+ply_boot_client_handle_reply (ply_boot_client_t         *client,
+                              ply_boot_client_request_t *request,
+                              uint8_t                    response_type,
+                              const char                *data,
+                              uint32_t                   size)
+{
+        if (response_type == PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK[0]) {
                 if (request->handler != NULL)
                         request->handler (request->user_data, client);
-        } else if (memcmp (byte, PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ANSWER, sizeof(uint8_t)) == 0) {
+        } else if (response_type == PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ANSWER[0]) {
                 char *answer;
 
-                if (!ply_read_uint32 (client->socket_fd, &size))
-                        goto out;
-
                 answer = malloc ((size + 1) * sizeof(char));
-                if (size > 0) {
-                        if (!ply_read (client->socket_fd, answer, size)) {
-                                free (answer);
-                                goto out;
-                        }
-                }
+                if (size > 0)
+                        memcpy (answer, data, size);
 
                 answer[size] = '\0';
                 if (request->handler != NULL)
                         ((ply_boot_client_answer_handler_t) request->handler)(request->user_data, answer, client);
                 free (answer);
-        } else if (memcmp (byte, PLY_BOOT_PROTOCOL_RESPONSE_TYPE_MULTIPLE_ANSWERS, sizeof(uint8_t)) == 0) {
+        } else if (response_type == PLY_BOOT_PROTOCOL_RESPONSE_TYPE_MULTIPLE_ANSWERS[0]) {
                 ply_array_t *array;
                 char **answers;
-                char *answer;
-                char *p;
-                char *q;
-                uint8_t i;
-
-                array = NULL;
-                answers = NULL;
-
-                if (!ply_read_uint32 (client->socket_fd, &size))
-                        goto out;
-
-                assert (size > 0);
+                const char *p;
+                const char *q;
+                uint32_t i;
 
-                answer = malloc (size);
-
-                if (!ply_read (client->socket_fd, answer, size)) {
-                        free (answer);
-                        goto out;
-                }
+                if (size == 0)
+                        return false;
 
                 array = ply_array_new (PLY_ARRAY_ELEMENT_TYPE_POINTER);
 
-                p = answer;
+                p = data;
                 q = p;
                 for (i = 0; i < size; i++, q++) {
                         if (*q == '\0') {
@@ -325,7 +361,6 @@ ply_boot_client_process_incoming_replies (ply_boot_client_t *client)
                                 p = q + 1;
                         }
                 }
-                free (answer);
 
                 answers = (char **) ply_array_steal_pointer_elements (array);
                 ply_array_free (array);
@@ -334,30 +369,217 @@ ply_boot_client_process_incoming_replies (ply_boot_client_t *client)
                         ((ply_boot_client_multiple_answers_handler_t) request->handler)(request->user_data, (const char *const *) answers, client);
 
                 ply_free_string_array (answers);
-        } else if (memcmp (byte, PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NO_ANSWER, sizeof(uint8_t)) == 0) {
+        } else if (response_type == PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NO_ANSWER[0]) {
                 if (request->handler != NULL)
                         ((ply_boot_client_answer_handler_t) request->handler)(request->user_data, NULL, client);
         } else {
+                return false;
+        }
+
+        return true;
+}
+
+static void
+ply_boot_client_stop_watching_for_replies_if_idle (ply_boot_client_t *client)
+{
+        if (ply_list_get_length (client->requests_waiting_for_replies) == 0) {
+                if (client->daemon_has_reply_watch != NULL) {
+                        assert (client->loop != NULL);
+                        ply_event_loop_stop_watching_fd (client->loop,
+                                                         client->daemon_has_reply_watch);
+                        client->daemon_has_reply_watch = NULL;
+                }
+        }
+}
+
+static void ply_boot_client_process_pending_requests (ply_boot_client_t *client);
+
+static void
+ply_boot_client_watch_for_writability (ply_boot_client_t *client)
+{
+        if (client->daemon_can_take_request_watch != NULL || client->socket_fd < 0)
+                return;
+
+        client->daemon_can_take_request_watch =
+                ply_event_loop_watch_fd (client->loop, client->socket_fd,
+                                         PLY_EVENT_LOOP_FD_STATUS_CAN_TAKE_DATA,
+                                         (ply_event_handler_t)
+                                         ply_boot_client_process_pending_requests,
+                                         NULL, client);
+}
+
+static void
+ply_boot_client_process_incoming_version_1_reply (ply_boot_client_t *client)
+{
+        ply_list_node_t *request_node;
+        ply_boot_client_request_t *request;
+        bool processed_reply;
+        uint8_t byte[2] = "";
+        uint32_t size = 0;
+        char *data = NULL;
+
+        request_node = ply_list_get_first_node (client->requests_waiting_for_replies);
+        assert (request_node != NULL);
+
+        request = (ply_boot_client_request_t *) ply_list_node_get_data (request_node);
+        assert (request != NULL);
+
+        processed_reply = false;
+        if (!ply_read (client->socket_fd, byte, sizeof(uint8_t)))
                 goto out;
+
+        if (memcmp (byte, PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ANSWER, sizeof(uint8_t)) == 0 ||
+            memcmp (byte, PLY_BOOT_PROTOCOL_RESPONSE_TYPE_MULTIPLE_ANSWERS, sizeof(uint8_t)) == 0) {
+                if (!ply_read_uint32 (client->socket_fd, &size))
+                        goto out;
+
+                if (size > 0) {
+                        data = malloc (size);
+                        if (!ply_read (client->socket_fd, data, size))
+                                goto out;
+                }
         }
 
-        processed_reply = true;
+        processed_reply = ply_boot_client_handle_reply (client, request, byte[0], data, size);
 
 out:
+        free (data);
+
         if (!processed_reply)
                 if (request->failed_handler != NULL)
                         request->failed_handler (request->user_data, client);
 
         ply_list_remove_node (client->requests_waiting_for_replies, request_node);
+        ply_boot_client_request_free (request);
 
-        if (ply_list_get_length (client->requests_waiting_for_replies) == 0) {
-                if (client->daemon_has_reply_watch != NULL) {
-                        assert (client->loop != NULL);
-                        ply_event_loop_stop_watching_fd (client->loop,
-                                                         client->daemon_has_reply_watch);
-                        client->daemon_has_reply_watch = NULL;
+        ply_boot_client_stop_watching_for_replies_if_idle (client);
+
+        /* Requests were held back while the protocol version was
+         * being negotiated
+         */
+        if (!client->is_negotiating &&
+            ply_list_get_length (client->requests_to_send) > 0)
+                ply_boot_client_watch_for_writability (client);
+}
+
+static ply_list_node_t *
+ply_boot_client_find_request_waiting_for_reply (ply_boot_client_t *client,
+                                                uint32_t           request_id)
+{
+        ply_list_node_t *node;
+
+        node = ply_list_get_first_node (client->requests_waiting_for_replies);
+        while (node != NULL) {
+                ply_boot_client_request_t *request;
+
+                request = (ply_boot_client_request_t *) ply_list_node_get_data (node);
+
+                if (request->id == request_id)
+                        return node;
+
+                node = ply_list_get_next_node (client->requests_waiting_for_replies, node);
+        }
+
+        return NULL;
+}
+
+static void
+ply_boot_client_process_incoming_version_2_replies (ply_boot_client_t *client)
+{
+        char bytes[4096];
+        ssize_t bytes_read;
+
+        do {
+                bytes_read = recv (client->socket_fd, bytes, sizeof(bytes), MSG_DONTWAIT);
+
+                if (bytes_read > 0)
+                        ply_buffer_append_bytes (client->reply_buffer, bytes, bytes_read);
+        } while (bytes_read > 0 || (bytes_read < 0 && errno == EINTR));
+
+        /* Each reply is a request id and response type, optionally
+         * followed by a sized payload
+         */
+        while (ply_buffer_get_size (client->reply_buffer) >= 5) {
+                const char *reply;
+                size_t reply_size;
+                uint32_t request_id;
+                uint8_t response_type;
+                uint32_t size = 0;
+                const char *data = NULL;
+                ply_list_node_t *request_node;
+                ply_boot_client_request_t *request;
+
+                reply = ply_buffer_get_bytes (client->reply_buffer);
+                request_id = get_uint32 (reply);
+                response_type = reply[4];
+                reply_size = 5;
+
+                if (response_type == PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ANSWER[0] ||
+                    response_type == PLY_BOOT_PROTOCOL_RESPONSE_TYPE_MULTIPLE_ANSWERS[0]) {
+                        if (ply_buffer_get_size (client->reply_buffer) < 9)
+                                break;
+
+                        size = get_uint32 (reply + 5);
+                        if (ply_buffer_get_size (client->reply_buffer) < 9 + (size_t) size)
+                                break;
+
+                        data = reply + 9;
+                        reply_size += 4 + size;
+                }
+
+                request_node = ply_boot_client_find_request_waiting_for_reply (client, request_id);
+
+                if (request_node == NULL) {
+                        ply_error ("received unexpected response from boot status daemon");
+                        ply_buffer_remove_bytes (client->reply_buffer, reply_size);
+                        continue;
+                }
+
+                request = (ply_boot_client_request_t *) ply_list_node_get_data (request_node);
+                ply_list_remove_node (client->requests_waiting_for_replies, request_node);
+
+                /* Handlers may queue more requests or run the event loop,
+                 * so take the reply out of the buffer first
+                 */
+                if (data != NULL) {
+                        char *payload;
+
+                        payload = malloc (size + 1);
+                        memcpy (payload, data, size);
+                        ply_buffer_remove_bytes (client->reply_buffer, reply_size);
+
+                        if (!ply_boot_client_handle_reply (client, request, response_type, payload, size))
+                                if (request->failed_handler != NULL)
+                                        request->failed_handler (request->user_data, client);
+                        free (payload);
+                } else {
+                        ply_buffer_remove_bytes (client->reply_buffer, reply_size);
+
+                        if (!ply_boot_client_handle_reply (client, request, response_type, NULL, 0))
+                                if (request->failed_handler != NULL)
+                                        request->failed_handler (request->user_data, client);
                 }
+
+                ply_boot_client_request_free (request);
+        }
+
+        ply_boot_client_stop_watching_for_replies_if_idle (client);
+}
+
+static void
+ply_boot_client_process_incoming_replies (ply_boot_client_t *client)
+{
+        assert (client != NULL);
+
+        if (ply_list_get_length (client->requests_waiting_for_replies) == 0) {
+                ply_error ("received unexpected response from boot status daemon");
+                return;
         }
+
+        if (client->protocol_version >= 2)
+                ply_boot_client_process_incoming_version_2_replies (client);
+        else
+                ply_boot_client_process_incoming_version_1_reply (client);
 }
 
 static char *
@@ -379,7 +601,10 @@ ply_boot_client_get_request_string (ply_boot_client_t         *client,
                 return request_string;
         }
 
-        assert (strlen (request->argument) <= UCHAR_MAX);
+        if (strlen (request->argument) > UCHAR_MAX) {
+                ply_trace ("argument too long for protocol version 1");
+                return NULL;
+        }
 
         request_string = NULL;
         asprintf (&request_string, "%s\002%c%s", request->command,
@@ -389,6 +614,20 @@ ply_boot_client_get_request_string (ply_boot_client_t         *client,
         return request_string;
 }
 
+static void
+ply_boot_client_watch_for_replies (ply_boot_client_t *client)
+{
+        if (client->daemon_has_reply_watch != NULL)
+                return;
+
+        client->daemon_has_reply_watch =
+                ply_event_loop_watch_fd (client->loop, client->socket_fd,
+                                         PLY_EVENT_LOOP_FD_STATUS_HAS_DATA,
+                                         (ply_event_handler_t)
+                                         ply_boot_client_process_incoming_replies,
+                                         NULL, client);
+}
+
 static bool
 ply_boot_client_send_request (ply_boot_client_t         *client,
                               ply_boot_client_request_t *request)
@@ -401,47 +640,137 @@ ply_boot_client_send_request (ply_boot_client_t         *client,
 
         request_string = ply_boot_client_get_request_string (client, request,
                                                              &request_size);
-        if (!ply_write (client->socket_fd, request_string, request_size)) {
+        if (request_string == NULL ||
+            !ply_write (client->socket_fd, request_string, request_size)) {
                 free (request_string);
                 ply_boot_client_cancel_request (client, request);
                 return false;
         }
         free (request_string);
 
-        if (client->daemon_has_reply_watch == NULL) {
-                assert (ply_list_get_length (client->requests_waiting_for_replies) == 0);
-                client->daemon_has_reply_watch =
-                        ply_event_loop_watch_fd (client->loop, client->socket_fd,
-                                                 PLY_EVENT_LOOP_FD_STATUS_HAS_DATA,
-                                                 (ply_event_handler_t)
-                                                 ply_boot_client_process_incoming_replies,
-                                                 NULL, client);
-        }
+        ply_boot_client_watch_for_replies (client);
         return true;
 }
 
+static void
+ply_boot_client_send_batched_requests (ply_boot_client_t *client)
+{
+        ply_buffer_t *commands;
+        ply_buffer_t *message;
+        ply_list_t *batch;
+        ply_list_node_t *node;
+        bool written;
+
+        commands = ply_buffer_new ();
+        batch = ply_list_new ();
+
+        /* Pack as many queued requests as fit into one message
+         */
+        while ((node = ply_list_get_first_node (client->requests_to_send)) != NULL) {
+                ply_boot_client_request_t *request;
+                size_t argument_size;
+
+                request = (ply_boot_client_request_t *) ply_list_node_get_data (node);
+                argument_size = request->argument != NULL ? strlen (request->argument) + 1 : 0;
+
+                if (PLY_BOOT_PROTOCOL_COMMAND_HEADER_SIZE + argument_size > PLY_BOOT_PROTOCOL_MAX_MESSAGE_SIZE) {
+                        ply_trace ("argument too long to send to daemon");
+                        ply_list_remove_node (client->requests_to_send, node);
+                        ply_boot_client_cancel_request (client, request);
+                        continue;
+                }
+
+                if (ply_buffer_get_size (commands) + PLY_BOOT_PROTOCOL_COMMAND_HEADER_SIZE + argument_size > PLY_BOOT_PROTOCOL_MAX_MESSAGE_SIZE)
+                        break;
+
+                append_uint32 (commands, request->id);
+                ply_buffer_append_bytes (commands, request->command, 1);
+                append_uint32 (commands, argument_size);
+                if (argument_size > 0)
+                        ply_buffer_append_bytes (commands, request->argument, argument_size);
+
+                ply_list_remove_node (client->requests_to_send, node);
+                ply_list_append_data (batch, request);
+        }
+
+        if (ply_list_get_length (batch) == 0) {
+                ply_buffer_free (commands);
+                ply_list_free (batch);
+                return;
+        }
+
+        message = ply_buffer_new ();
+        append_uint32 (message, ply_buffer_get_size (commands));
+        ply_buffer_append_bytes (message, ply_buffer_get_bytes (commands),
+                                 ply_buffer_get_size (commands));
+
+        written = ply_write (client->socket_fd,
+                             ply_buffer_get_bytes (message),
+                             ply_buffer_get_size (message));
+        ply_buffer_free (message);
+        ply_buffer_free (commands);
+
+        node = ply_list_get_first_node (batch);
+        while (node != NULL) {
+                ply_boot_client_request_t *request;
+
+                request = (ply_boot_client_request_t *) ply_list_node_get_data (node);
+
+                if (written)
+                        ply_list_append_data (client->requests_waiting_for_replies, request);
+                else
+                        ply_boot_client_cancel_request (client, request);
+
+                node = ply_list_get_next_node (batch, node);
+        }
+        ply_list_free (batch);
+
+        if (written)
+                ply_boot_client_watch_for_replies (client);
+}
+
 static void
 ply_boot_client_process_pending_requests (ply_boot_client_t *client)
 {
         ply_list_node_t *request_node;
         ply_boot_client_request_t *request;
 
-        assert (ply_list_get_length (client->requests_to_send) != 0);
         assert (client->daemon_can_take_request_watch != NULL);
 
-        request_node = ply_list_get_first_node (client->requests_to_send);
-        assert (request_node != NULL);
+        if (client->is_negotiating) {
+                ply_event_loop_stop_watching_fd (client->loop,
+                                                 client->daemon_can_take_request_watch);
+                client->daemon_can_take_request_watch = NULL;
+                return;
+        }
 
-        request = (ply_boot_client_request_t *) ply_list_node_get_data (request_node);
-        assert (request != NULL);
+        if (client->protocol_version >= 2) {
+                ply_boot_client_send_batched_requests (client);
+        } else {
+                assert (ply_list_get_length (client->requests_to_send) != 0);
 
-        ply_list_remove_node (client->requests_to_send, request_node);
+                request_node = ply_list_get_first_node (client->requests_to_send);
+                assert (request_node != NULL);
 
-        if (ply_boot_client_send_request (client, request))
-                ply_list_append_data (client->requests_waiting_for_replies, request);
+                request = (ply_boot_client_request_t *) ply_list_node_get_data (request_node);
+                assert (request != NULL);
 
-        if (ply_list_get_length (client->requests_to_send) == 0) {
-                if (client->daemon_has_reply_watch != NULL) {
+                ply_list_remove_node (client->requests_to_send, request_node);
+
+                if (ply_boot_client_send_request (client, request)) {
+                        ply_list_append_data (client->requests_waiting_for_replies, request);
+
+                        /* Nothing else can go out until we know which
+                         * protocol version the daemon speaks
+                         */
+                        if (strcmp (request->command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_NEGOTIATE_VERSION) == 0)
+                                client->is_negotiating = true;
+                }
+        }
+
+        if (ply_list_get_length (client->requests_to_send) == 0 ||
+            client->is_negotiating) {
+                if (client->daemon_can_take_request_watch != NULL) {
                         assert (client->loop != NULL);
 
                         ply_event_loop_stop_watching_fd (client->loop,
@@ -462,18 +791,9 @@ ply_boot_client_queue_request (ply_boot_client_t                 *client,
         assert (client != NULL);
         assert (client->loop != NULL);
         assert (request_command != NULL);
-        assert (request_argument == NULL || strlen (request_argument) <= UCHAR_MAX);
-
-        if (client->daemon_can_take_request_watch == NULL &&
-            client->socket_fd >= 0) {
-                assert (ply_list_get_length (client->requests_to_send) == 0);
-                client->daemon_can_take_request_watch =
-                        ply_event_loop_watch_fd (client->loop, client->socket_fd,
-                                                 PLY_EVENT_LOOP_FD_STATUS_CAN_TAKE_DATA,
-                                                 (ply_event_handler_t)
-                                                 ply_boot_client_process_pending_requests,
-                                                 NULL, client);
-        }
+
+        if (!client->is_negotiating)
+                ply_boot_client_watch_for_writability (client);
 
         if (!client->is_connected) {
                 if (failed_handler != NULL)
@@ -768,6 +1088,73 @@ ply_boot_client_tell_daemon_about_error (ply_boot_client_t                 *clie
                                        NULL, handler, failed_handler, user_data);
 }
 
+typedef struct
+{
+        const char *name;
+        const char *request_type;
+        bool        takes_argument;
+} ply_boot_client_batch_command_t;
+
+static const ply_boot_client_batch_command_t batch_commands[] =
+{
+        { "update",           PLY_BOOT_PROTOCOL_REQUEST_TYPE_UPDATE,           true  },
+        { "system-update",    PLY_BOOT_PROTOCOL_REQUEST_TYPE_SYSTEM_UPDATE,    true  },
+        { "change-mode",      PLY_BOOT_PROTOCOL_REQUEST_TYPE_CHANGE_MODE,      true  },
+        { "message",          PLY_BOOT_PROTOCOL_REQUEST_TYPE_SHOW_MESSAGE,     true  },
+        { "display-message",  PLY_BOOT_PROTOCOL_REQUEST_TYPE_SHOW_MESSAGE,     true  },
+        { "hide-message",     PLY_BOOT_PROTOCOL_REQUEST_TYPE_HIDE_MESSAGE,     true  },
+        { "pause-progress",   PLY_BOOT_PROTOCOL_REQUEST_TYPE_PROGRESS_PAUSE,   false },
+        { "unpause-progress", PLY_BOOT_PROTOCOL_REQUEST_TYPE_PROGRESS_UNPAUSE, false },
+        { "show-splash",      PLY_BOOT_PROTOCOL_REQUEST_TYPE_SHOW_SPLASH,      false },
+        { "hide-splash",      PLY_BOOT_PROTOCOL_REQUEST_TYPE_HIDE_SPLASH,      false },
+        { "report-error",     PLY_BOOT_PROTOCOL_REQUEST_TYPE_ERROR,            false },
+        { "ping",             PLY_BOOT_PROTOCOL_REQUEST_TYPE_PING,             false },
+        { NULL,               NULL,                                            false }
+};
+
+bool
+ply_boot_client_send_batch_command (ply_boot_client_t                 *client,
+                                    const char                        *command_line,
+                                    ply_boot_client_response_handler_t failed_handler,
+                                    void                              *user_data)
+{
+        const char *argument;
+        size_t name_length;
+        int i;
+
+        assert (client != NULL);
+        assert (command_line != NULL);
+
+        /* A batch command is a command name, optionally followed by a
+         * single space and an argument that runs to the end of the line
+         */
+        argument = strchr (command_line, ' ');
+        if (argument != NULL) {
+                name_length = argument - command_line;
+                argument++;
+        } else {
+                name_length = strlen (command_line);
+        }
+
+        for (i = 0; batch_commands[i].name != NULL; i++) {
+                if (strlen (batch_commands[i].name) != name_length ||
+                    strncmp (batch_commands[i].name, command_line, name_length) != 0)
+                        continue;
+
+                if (batch_commands[i].takes_argument != (argument != NULL))
+                        return false;
+
+                /* No one waits on the acknowledgement, only failures
+                 * get reported back
+                 */
+                ply_boot_client_queue_request (client, batch_commands[i].request_type,
+                                               argument, NULL, failed_handler, user_data);
+                return true;
+        }
+
+        return false;
+}
+
 void
 ply_boot_client_flush (ply_boot_client_t *client)
 {
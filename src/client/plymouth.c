@@ -28,11 +28,13 @@
 #include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <sys/epoll.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 
 #include "ply-boot-client.h"
+#include "ply-buffer.h"
 #include "ply-command-parser.h"
 #include "ply-event-loop.h"
 #include "ply-logger.h"
@@ -50,6 +52,13 @@ typedef struct
         ply_boot_client_t    *client;
         ply_command_parser_t *command_parser;
         char                  kernel_command_line[PLY_MAX_COMMAND_LINE_SIZE];
+
+        ply_buffer_t         *batch_buffer;
+        ply_fd_watch_t       *batch_watch;
+        int                   batch_fd;
+        uint32_t              batch_input_closed : 1;
+        uint32_t              batch_from_fifo : 1;
+        uint32_t              batch_command_failed : 1;
 } state_t;
 
 typedef struct
@@ -406,7 +415,10 @@ on_disconnect (state_t *state)
                                         NULL
                                         );
 
-        if (!wait) {
+        /* a fifo never runs dry, the daemon quitting is how batch mode
+         * ends in that case
+         */
+        if (!wait && !state->batch_from_fifo) {
                 ply_error ("error: unexpectedly disconnected from boot status daemon");
                 status = 2;
         }
@@ -415,6 +427,212 @@ on_disconnect (state_t *state)
         ply_event_loop_exit (state->loop, status);
 }
 
+static void
+on_batch_command_failure (state_t *state)
+{
+        ply_error ("boot status daemon rejected batch command");
+        state->batch_command_failed = true;
+}
+
+static void
+on_batch_finished (state_t *state)
+{
+        ply_event_loop_exit (state->loop, state->batch_command_failed ? 1 : 0);
+}
+
+static void
+send_batch_command (state_t *state,
+                    char    *line)
+{
+        size_t length;
+
+        length = strlen (line);
+        if (length > 0 && line[length - 1] == '\r')
+                line[length - 1] = '\0';
+
+        if (line[0] == '\0' || line[0] == '#')
+                return;
+
+        if (!ply_boot_client_send_batch_command (state->client, line,
+                                                 (ply_boot_client_response_handler_t)
+                                                 on_batch_command_failure, state)) {
+                ply_error ("unknown batch command: %s", line);
+                state->batch_command_failed = true;
+        }
+}
+
+static void
+process_batch_lines (state_t *state)
+{
+        const char *bytes;
+        char *newline;
+
+        while ((newline = memchr (ply_buffer_get_bytes (state->batch_buffer), '\n',
+                                  ply_buffer_get_size (state->batch_buffer))) != NULL) {
+                char *line;
+
+                bytes = ply_buffer_get_bytes (state->batch_buffer);
+                line = strndup (bytes, newline - bytes);
+                ply_buffer_remove_bytes (state->batch_buffer, newline - bytes + 1);
+
+                send_batch_command (state, line);
+                free (line);
+        }
+}
+
+static void
+on_batch_input_closed (state_t *state)
+{
+        if (state->batch_input_closed)
+                return;
+
+        state->batch_input_closed = true;
+        state->batch_watch = NULL;
+
+        /* a last command may not be newline terminated
+         */
+        if (ply_buffer_get_size (state->batch_buffer) > 0) {
+                char *line;
+
+                line = ply_buffer_steal_bytes (state->batch_buffer);
+                send_batch_command (state, line);
+                free (line);
+        }
+
+        /* Replies can come back out of order, but every batch command is
+         * answered as soon as the daemon handles it, and it handles a
+         * connection's requests in order.  So once this ping comes back,
+         * any failure for the commands before it has been reported.
+         */
+        ply_boot_client_ping_daemon (state->client,
+                                     (ply_boot_client_response_handler_t)
+                                     on_batch_finished,
+                                     (ply_boot_client_response_handler_t)
+                                     on_failure, state);
+}
+
+static void
+on_batch_input (state_t *state)
+{
+        char bytes[4096];
+        ssize_t bytes_read;
+
+        bytes_read = read (state->batch_fd, bytes, sizeof(bytes));
+
+        if (bytes_read < 0 && (errno == EINTR || errno == EAGAIN))
+                return;
+
+        if (bytes_read <= 0) {
+                if (state->batch_watch != NULL)
+                        ply_event_loop_stop_watching_fd (state->loop, state->batch_watch);
+                state->batch_watch = NULL;
+                on_batch_input_closed (state);
+                return;
+        }
+
+        ply_buffer_append_bytes (state->batch_buffer, bytes, bytes_read);
+        process_batch_lines (state);
+}
+
+static bool
+fd_can_be_watched (int fd)
+{
+        struct epoll_event event = { .events = EPOLLIN };
+        int epoll_fd;
+        bool can_be_watched;
+
+        /* epoll refuses regular files and devices like /dev/null
+         */
+        epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+        if (epoll_fd < 0)
+                return false;
+
+        can_be_watched = epoll_ctl (epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+        close (epoll_fd);
+
+        return can_be_watched;
+}
+
+static void
+read_batch_input (state_t *state)
+{
+        char bytes[4096];
+        ssize_t bytes_read;
+
+        /* Input the event loop can't watch never blocks for long, so just
+         * read it all, sending what's there after each chunk
+         */
+        while ((bytes_read = read (state->batch_fd, bytes, sizeof(bytes))) != 0) {
+                if (bytes_read < 0) {
+                        if (errno == EINTR)
+                                continue;
+
+                        ply_error ("could not read batch commands: %m");
+                        state->batch_command_failed = true;
+                        break;
+                }
+
+                ply_buffer_append_bytes (state->batch_buffer, bytes, bytes_read);
+                process_batch_lines (state);
+                ply_boot_client_flush (state->client);
+        }
+
+        on_batch_input_closed (state);
+}
+
+static bool
+start_batch_mode (state_t    *state,
+                  const char *fifo_path)
+{
+        if (fifo_path != NULL) {
+                if (mkfifo (fifo_path, 0600) < 0 && errno != EEXIST) {
+                        ply_error ("could not create %s: %m", fifo_path);
+                        return false;
+                }
+
+                /* Keep a writer open ourselves so the fifo doesn't hit
+                 * end-of-file every time one of the scripts feeding it exits
+                 */
+                state->batch_fd = open (fifo_path, O_RDWR | O_CLOEXEC);
+                if (state->batch_fd < 0) {
+                        ply_error ("could not open %s: %m", fifo_path);
+                        return false;
+                }
+                state->batch_from_fifo = true;
+        } else {
+                state->batch_fd = STDIN_FILENO;
+        }
+
+        state->batch_buffer = ply_buffer_new ();
+
+        if (!fd_can_be_watched (state->batch_fd)) {
+                read_batch_input (state);
+                return true;
+        }
+
+        state->batch_watch = ply_event_loop_watch_fd (state->loop, state->batch_fd,
+                                                      PLY_EVENT_LOOP_FD_STATUS_HAS_DATA,
+                                                      (ply_event_handler_t)
+                                                      on_batch_input,
+                                                      (ply_event_handler_t)
+                                                      on_batch_input_closed,
+                                                      state);
+        return true;
+}
+
+static void
+close_batch_input (state_t *state)
+{
+        /* stdin isn't ours to close.  This runs once the event loop has
+         * stopped, which already took the fd out of its poll set.
+         */
+        if (state->batch_from_fifo) {
+                close (state->batch_fd);
+                state->batch_fd = -1;
+                state->batch_from_fifo = false;
+        }
+}
+
 static void
 on_password_request_execute (password_answer_state_t *password_answer_state,
                              ply_boot_client_t       *client)
@@ -878,9 +1096,9 @@ main (int    argc,
       char **argv)
 {
         state_t state = { 0 };
-        bool should_help, should_quit, should_ping, should_check_for_active_vt, should_sysinit, should_ask_for_password, should_show_splash, should_hide_splash, should_wait, should_be_verbose, report_error, should_get_plugin_path;
+        bool should_help, should_quit, should_ping, should_check_for_active_vt, should_sysinit, should_ask_for_password, should_show_splash, should_hide_splash, should_wait, should_be_verbose, report_error, should_get_plugin_path, should_batch;
         bool is_connected;
-        char *status, *chroot_dir, *ignore_keystroke;
+        char *status, *chroot_dir, *ignore_keystroke, *batch_fifo;
         int exit_code;
 
         exit_code = 0;
@@ -907,6 +1125,8 @@ main (int    argc,
                                         "update", "Tell boot daemon an update about boot progress", PLY_COMMAND_OPTION_TYPE_STRING,
                                         "details", "Tell boot daemon there were errors during boot", PLY_COMMAND_OPTION_TYPE_FLAG,
                                         "wait", "Wait for boot daemon to quit", PLY_COMMAND_OPTION_TYPE_FLAG,
+                                        "batch", "Send newline separated commands read from standard input", PLY_COMMAND_OPTION_TYPE_FLAG,
+                                        "batch-fifo", "Send newline separated commands read from a named pipe", PLY_COMMAND_OPTION_TYPE_STRING,
                                         NULL);
 
         ply_command_parser_add_command (state.command_parser,
@@ -1083,6 +1303,8 @@ main (int    argc,
                                         "update", &status,
                                         "wait", &should_wait,
                                         "details", &report_error,
+                                        "batch", &should_batch,
+                                        "batch-fifo", &batch_fifo,
                                         NULL);
 
         if (should_help || argc < 2) {
@@ -1132,11 +1354,18 @@ main (int    argc,
                         ply_trace ("no need to wait");
                         return 0;
                 }
+                if (should_batch || batch_fifo != NULL) {
+                        ply_trace ("nowhere to send batch commands");
+                        return 1;
+                }
         }
 
         ply_boot_client_attach_to_event_loop (state.client, state.loop);
 
-        if (should_show_splash) {
+        if (should_batch || batch_fifo != NULL) {
+                if (!start_batch_mode (&state, batch_fifo))
+                        return 1;
+        } else if (should_show_splash) {
                 ply_boot_client_tell_daemon_to_show_splash (state.client,
                                                             (ply_boot_client_response_handler_t)
                                                             on_success,
@@ -1215,6 +1444,8 @@ main (int    argc,
 
         exit_code = ply_event_loop_run (state.loop);
 
+        close_batch_input (&state);
+        ply_buffer_free (state.batch_buffer);
         ply_boot_client_free (state.client);
 
         ply_event_loop_free (state.loop);
@@ -23,9 +23,10 @@
  *             Ray Strode <rstrode@redhat.com>
  */
 #include "config.h"
-#include "ply-list.h"
 #include "ply-pixel-buffer.h"
 #include "ply-logger.h"
+#include "ply-utils.h"
+#include "ply-worker-pool.h"
 
 #include <assert.h>
 #include <errno.h>
@@ -39,21 +40,87 @@
 
 #define ALPHA_MASK 0xff000000
 
+/* Clip nesting rarely goes more than a couple of levels deep (the
+ * buffer's own area, the display draw area, and maybe a widget), so
+ * keep that many inline and only go to the heap for unusual cases.
+ */
+#define CLIP_AREA_STACK_INLINE_SIZE 8
+
+/* Upper bounds on how many rotated copies of one buffer are kept
+ * around once ply_pixel_buffer_enable_rotation_cache is called, and
+ * on how much memory they may take up together
+ */
+#define ROTATION_CACHE_MAX_ENTRIES 32
+#define ROTATION_CACHE_MAX_BYTES (16 * 1024 * 1024)
+
+/* When more than one compositor thread is configured, fills covering
+ * at least PARALLEL_PIXEL_COUNT pixels are split into bands of rows,
+ * each about BAND_PIXEL_COUNT pixels so it stays in cache while being
+ * worked on
+ */
+#define PARALLEL_PIXEL_COUNT (256 * 256)
+#define BAND_PIXEL_COUNT (16 * 1024)
+
+/* Columns in a row, end exclusive, that hold anything visible, and the
+ * longest run among them that is fully opaque
+ */
+typedef struct
+{
+        int visible_start;
+        int visible_end;
+        int opaque_start;
+        int opaque_end;
+} ply_pixel_buffer_row_span_t;
+
+typedef struct
+{
+        long                center_x;
+        long                center_y;
+        int                 angle_step;
+        ply_pixel_buffer_t *rotated_buffer;
+} ply_rotation_cache_entry_t;
+
 struct _ply_pixel_buffer
 {
         uint32_t       *bytes;
 
         ply_rectangle_t area; /* in device pixels */
         ply_rectangle_t logical_area; /* in logical pixels */
-        ply_list_t     *clip_areas; /* in device pixels */
+
+        /* Each entry is the intersection of itself with all entries
+         * below it, so the top of the stack is the effective clip
+         */
+        ply_rectangle_t *clip_areas; /* in device pixels */
+        ply_rectangle_t clip_area_stack[CLIP_AREA_STACK_INLINE_SIZE];
+        int             number_of_clip_areas;
+        int             clip_area_capacity;
 
         ply_region_t   *updated_areas; /* in device pixels */
         uint32_t        is_opaque : 1;
         int             device_scale;
 
         ply_pixel_buffer_rotation_t device_rotation;
+
+        ply_rotation_cache_entry_t *rotation_cache;
+        int                         rotation_cache_angle_steps;
+        int                         number_of_rotation_cache_entries;
+        int                         next_rotation_cache_entry;
+
+        /* filled in by ply_pixel_buffer_analyze_transparency, and
+         * thrown away as soon as anything draws into the buffer
+         */
+        ply_pixel_buffer_row_span_t *row_spans;
+        ply_rectangle_t              visible_area; /* in device pixels */
+        ply_rectangle_t              opaque_area; /* in device pixels */
+
+        /* set instead of bytes while the buffer is compressed */
+        uint32_t                    *compressed_runs;
+        uint32_t                    *compressed_row_offsets;
 };
 
+static void ply_pixel_buffer_contents_changed (ply_pixel_buffer_t *buffer);
+static void ply_pixel_buffer_uncompress (ply_pixel_buffer_t *buffer);
+
 static inline void ply_pixel_buffer_blend_value_at_pixel (ply_pixel_buffer_t *buffer,
                                                           int                 x,
                                                           int                 y,
@@ -251,52 +318,182 @@ ply_pixel_buffer_crop_area_to_clip_area (ply_pixel_buffer_t *buffer,
                                          ply_rectangle_t    *area,
                                          ply_rectangle_t    *cropped_area)
 {
-        ply_list_node_t *node;
-
         *cropped_area = *area;
         ply_pixel_buffer_adjust_area_for_device_scale (buffer, cropped_area);
 
-        node = ply_list_get_first_node (buffer->clip_areas);
-        while (node != NULL) {
-                ply_list_node_t *next_node;
-                ply_rectangle_t *clip_rectangle;
-
-                clip_rectangle = ply_list_node_get_data (node);
-                next_node = ply_list_get_next_node (buffer->clip_areas, node);
+        if (buffer->number_of_clip_areas > 0)
+                ply_rectangle_intersect (cropped_area,
+                                         &buffer->clip_areas[buffer->number_of_clip_areas - 1],
+                                         cropped_area);
+}
 
-                ply_rectangle_intersect (cropped_area, clip_rectangle, cropped_area);
+/* Maps an area in (unrotated) buffer coordinates to the area of
+ * bytes it occupies in device memory
+ */
+static void
+ply_pixel_buffer_get_device_area (ply_pixel_buffer_t *buffer,
+                                  ply_rectangle_t    *area,
+                                  ply_rectangle_t    *device_area)
+{
+        *device_area = *area;
 
-                node = next_node;
+        switch (buffer->device_rotation) {
+        case PLY_PIXEL_BUFFER_ROTATE_UPRIGHT:
+                break;
+        case PLY_PIXEL_BUFFER_ROTATE_UPSIDE_DOWN:
+                device_area->x = buffer->area.width - area->width - area->x;
+                device_area->y = buffer->area.height - area->height - area->y;
+                break;
+        case PLY_PIXEL_BUFFER_ROTATE_CLOCKWISE:
+                device_area->x = buffer->area.height - area->height - area->y;
+                device_area->y = area->x;
+                device_area->height = area->width;
+                device_area->width = area->height;
+                break;
+        case PLY_PIXEL_BUFFER_ROTATE_COUNTER_CLOCKWISE:
+                device_area->x = area->y;
+                device_area->y = buffer->area.width - area->width - area->x;
+                device_area->height = area->width;
+                device_area->width = area->height;
+                break;
         }
 }
 
+static unsigned long
+ply_pixel_buffer_get_device_stride (ply_pixel_buffer_t *buffer)
+{
+        if (buffer->device_rotation == PLY_PIXEL_BUFFER_ROTATE_CLOCKWISE ||
+            buffer->device_rotation == PLY_PIXEL_BUFFER_ROTATE_COUNTER_CLOCKWISE)
+                return buffer->area.height;
+
+        return buffer->area.width;
+}
+
 static void ply_pixel_buffer_add_updated_area (ply_pixel_buffer_t *buffer,
                                                ply_rectangle_t    *area)
 {
-        ply_rectangle_t updated_area = *area;
+        ply_rectangle_t updated_area;
+
+        ply_pixel_buffer_contents_changed (buffer);
+
+        ply_pixel_buffer_get_device_area (buffer, area, &updated_area);
+        ply_region_add_rectangle (buffer->updated_areas, &updated_area);
+}
+
+/* Writes count pixels along row y, starting at column x, repeating
+ * the period pixels in pattern as many times as needed.
+ */
+static void
+ply_pixel_buffer_write_row (ply_pixel_buffer_t *buffer,
+                            long                x,
+                            long                y,
+                            const uint32_t     *pattern,
+                            unsigned long       period,
+                            unsigned long       count)
+{
+        uint32_t *dst;
+        long step;
+        unsigned long i, j;
 
         switch (buffer->device_rotation) {
         case PLY_PIXEL_BUFFER_ROTATE_UPRIGHT:
-                break;
+        default:
+                dst = &buffer->bytes[y * buffer->area.width + x];
+                while (count >= period) {
+                        memcpy (dst, pattern, period * sizeof(uint32_t));
+                        dst += period;
+                        count -= period;
+                }
+                memcpy (dst, pattern, count * sizeof(uint32_t));
+                return;
         case PLY_PIXEL_BUFFER_ROTATE_UPSIDE_DOWN:
-                updated_area.x = buffer->area.width - area->width - area->x;
-                updated_area.y = buffer->area.height - area->height - area->y;
+                dst = &buffer->bytes[(buffer->area.height - 1 - y) * buffer->area.width +
+                                     (buffer->area.width - 1 - x)];
+                step = -1;
                 break;
         case PLY_PIXEL_BUFFER_ROTATE_CLOCKWISE:
-                updated_area.x = buffer->area.height - area->height - area->y;
-                updated_area.y = area->x;
-                updated_area.height = area->width;
-                updated_area.width = area->height;
+                dst = &buffer->bytes[x * buffer->area.height + (buffer->area.height - 1 - y)];
+                step = buffer->area.height;
                 break;
         case PLY_PIXEL_BUFFER_ROTATE_COUNTER_CLOCKWISE:
-                updated_area.x = area->y;
-                updated_area.y = buffer->area.width - area->width - area->x;
-                updated_area.height = area->width;
-                updated_area.width = area->height;
+                dst = &buffer->bytes[(buffer->area.width - 1 - x) * buffer->area.height + y];
+                step = -(long) buffer->area.height;
                 break;
         }
 
-        ply_region_add_rectangle (buffer->updated_areas, &updated_area);
+        for (i = 0, j = 0; i < count; i++) {
+                *dst = pattern[j];
+                dst += step;
+
+                if (++j == period)
+                        j = 0;
+        }
+}
+
+static ply_worker_pool_t *
+get_worker_pool (void)
+{
+        static ply_worker_pool_t *worker_pool;
+        static bool worker_pool_checked;
+
+        if (!worker_pool_checked) {
+                worker_pool_checked = true;
+
+                if (ply_get_compositor_thread_count () > 1)
+                        worker_pool = ply_worker_pool_new (ply_get_compositor_thread_count ());
+        }
+
+        return worker_pool;
+}
+
+/* Calls handler on bands of rows [start, end) out of height, spread
+ * over the compositor threads when the area is big enough to be worth
+ * it.  Handlers may only touch the rows they are given; clipping and
+ * updated areas are dealt with by the caller, before and after.
+ */
+static void
+ply_pixel_buffer_run_on_rows (unsigned long             width,
+                              unsigned long             height,
+                              ply_worker_pool_handler_t handler,
+                              void                     *user_data)
+{
+        ply_worker_pool_t *worker_pool;
+
+        worker_pool = get_worker_pool ();
+
+        if (worker_pool == NULL || width * height < PARALLEL_PIXEL_COUNT) {
+                handler (user_data, 0, height);
+                return;
+        }
+
+        ply_worker_pool_run (worker_pool, handler, user_data, height,
+                             MAX (BAND_PIXEL_COUNT / width, 1));
+}
+
+typedef struct
+{
+        uint32_t     *first_row;
+        unsigned long stride;
+        unsigned long width;
+        uint32_t      pixel_value;
+} ply_pixel_blend_fill_t;
+
+static void
+blend_fill_rows (ply_pixel_blend_fill_t *fill,
+                 unsigned long           start,
+                 unsigned long           end)
+{
+        uint32_t pixel_value = fill->pixel_value;
+        unsigned long row, column;
+        uint32_t *dst;
+
+        dst = fill->first_row + start * fill->stride;
+        for (row = start; row < end; row++) {
+                for (column = 0; column < fill->width; column++) {
+                        dst[column] = blend_two_pixel_values (pixel_value, dst[column]);
+                }
+                dst += fill->stride;
+        }
 }
 
 static void
@@ -304,12 +501,15 @@ ply_pixel_buffer_fill_area_with_pixel_value (ply_pixel_buffer_t *buffer,
                                              ply_rectangle_t    *fill_area,
                                              uint32_t            pixel_value)
 {
-        unsigned long row, column;
-        ply_rectangle_t cropped_area;
+        unsigned long row, column, stride;
+        ply_rectangle_t cropped_area, device_area;
+        uint32_t *first_row, *dst;
 
         if (fill_area == NULL)
                 fill_area = &buffer->logical_area;
 
+        ply_pixel_buffer_uncompress (buffer);
+
         ply_pixel_buffer_crop_area_to_clip_area (buffer, fill_area, &cropped_area);
 
         /* If we're filling the entire buffer with a fully opaque color,
@@ -320,39 +520,94 @@ ply_pixel_buffer_fill_area_with_pixel_value (ply_pixel_buffer_t *buffer,
                 buffer->is_opaque = true;
         }
 
-        for (row = cropped_area.y; row < cropped_area.y + cropped_area.height; row++) {
-                for (column = cropped_area.x; column < cropped_area.x + cropped_area.width; column++) {
-                        ply_pixel_buffer_blend_value_at_pixel (buffer,
-                                                               column, row,
-                                                               pixel_value);
+        if (cropped_area.width == 0 || cropped_area.height == 0)
+                return;
+
+        /* Every pixel gets the same treatment regardless of where it is,
+         * so work directly on device memory and skip the rotation math.
+         */
+        ply_pixel_buffer_get_device_area (buffer, &cropped_area, &device_area);
+        stride = ply_pixel_buffer_get_device_stride (buffer);
+        first_row = &buffer->bytes[device_area.y * stride + device_area.x];
+
+        if ((pixel_value >> 24) == 0xff) {
+                /* Opaque fills are plain stores: build one row and
+                 * copy it down
+                 */
+                for (column = 0; column < device_area.width; column++) {
+                        first_row[column] = pixel_value;
+                }
+
+                dst = first_row + stride;
+                for (row = 1; row < device_area.height; row++) {
+                        memcpy (dst, first_row, device_area.width * sizeof(uint32_t));
+                        dst += stride;
                 }
+        } else {
+                ply_pixel_blend_fill_t fill;
+
+                fill.first_row = first_row;
+                fill.stride = stride;
+                fill.width = device_area.width;
+                fill.pixel_value = pixel_value;
+
+                ply_pixel_buffer_run_on_rows (device_area.width, device_area.height,
+                                              (ply_worker_pool_handler_t) blend_fill_rows,
+                                              &fill);
         }
 
         ply_pixel_buffer_add_updated_area (buffer, &cropped_area);
 }
 
+static void
+ply_pixel_buffer_grow_clip_areas (ply_pixel_buffer_t *buffer)
+{
+        ply_rectangle_t *clip_areas;
+        int capacity;
+
+        capacity = buffer->clip_area_capacity * 2;
+
+        if (buffer->clip_areas == buffer->clip_area_stack) {
+                clip_areas = malloc (capacity * sizeof(ply_rectangle_t));
+                memcpy (clip_areas, buffer->clip_area_stack,
+                        buffer->number_of_clip_areas * sizeof(ply_rectangle_t));
+        } else {
+                clip_areas = realloc (buffer->clip_areas,
+                                      capacity * sizeof(ply_rectangle_t));
+        }
+
+        buffer->clip_areas = clip_areas;
+        buffer->clip_area_capacity = capacity;
+}
+
 void
 ply_pixel_buffer_push_clip_area (ply_pixel_buffer_t *buffer,
                                  ply_rectangle_t    *clip_area)
 {
         ply_rectangle_t *new_clip_area;
 
-        new_clip_area = malloc (sizeof(*new_clip_area));
+        if (buffer->number_of_clip_areas == buffer->clip_area_capacity)
+                ply_pixel_buffer_grow_clip_areas (buffer);
+
+        new_clip_area = &buffer->clip_areas[buffer->number_of_clip_areas];
 
         *new_clip_area = *clip_area;
         ply_pixel_buffer_adjust_area_for_device_scale (buffer, new_clip_area);
 
-        ply_list_append_data (buffer->clip_areas, new_clip_area);
+        if (buffer->number_of_clip_areas > 0)
+                ply_rectangle_intersect (new_clip_area,
+                                         new_clip_area - 1,
+                                         new_clip_area);
+
+        buffer->number_of_clip_areas++;
 }
 
 void
 ply_pixel_buffer_pop_clip_area (ply_pixel_buffer_t *buffer)
 {
-        ply_list_node_t *last_node;
+        assert (buffer->number_of_clip_areas > 0);
 
-        last_node = ply_list_get_last_node (buffer->clip_areas);
-        free (ply_list_node_get_data (last_node));
-        ply_list_remove_node (buffer->clip_areas, last_node);
+        buffer->number_of_clip_areas--;
 }
 
 ply_pixel_buffer_t *
@@ -387,7 +642,8 @@ ply_pixel_buffer_new_with_device_rotation (unsigned long               width,
         buffer->device_scale = 1;
         buffer->device_rotation = device_rotation;
 
-        buffer->clip_areas = ply_list_new ();
+        buffer->clip_areas = buffer->clip_area_stack;
+        buffer->clip_area_capacity = CLIP_AREA_STACK_INLINE_SIZE;
         ply_pixel_buffer_push_clip_area (buffer, &buffer->area);
         buffer->is_opaque = false;
 
@@ -397,12 +653,11 @@ ply_pixel_buffer_new_with_device_rotation (unsigned long               width,
 static void
 free_clip_areas (ply_pixel_buffer_t *buffer)
 {
-        while (ply_list_get_length (buffer->clip_areas) > 0) {
-                ply_pixel_buffer_pop_clip_area (buffer);
-        }
+        if (buffer->clip_areas != buffer->clip_area_stack)
+                free (buffer->clip_areas);
 
-        ply_list_free (buffer->clip_areas);
         buffer->clip_areas = NULL;
+        buffer->number_of_clip_areas = 0;
 }
 
 void
@@ -412,6 +667,10 @@ ply_pixel_buffer_free (ply_pixel_buffer_t *buffer)
                 return;
 
         free_clip_areas (buffer);
+        ply_pixel_buffer_contents_changed (buffer);
+        free (buffer->rotation_cache);
+        free (buffer->compressed_runs);
+        free (buffer->compressed_row_offsets);
         free (buffer->bytes);
         ply_region_free (buffer->updated_areas);
         free (buffer);
@@ -462,12 +721,6 @@ ply_pixel_buffer_get_updated_areas (ply_pixel_buffer_t *buffer)
         return buffer->updated_areas;
 }
 
-void
-ply_pixel_buffer_fill_with_gradient (ply_pixel_buffer_t *buffer,
-                                     ply_rectangle_t    *fill_area,
-                                     uint32_t            start,
-                                     uint32_t            end)
-{
 /* The gradient produced is a linear interpolation of the two passed
  * in color stops: start and end.
  *
@@ -511,73 +764,132 @@ ply_pixel_buffer_fill_with_gradient (ply_pixel_buffer_t *buffer,
  */
 #define COLOR_MASK (0xff << (24 - NOISE_BITS))
 
-        uint32_t red, green, blue, red_step, green_step, blue_step, t, pixel;
-        uint32_t x, y;
-        /* we use a fixed seed so that the dithering doesn't change on repaints
-         * of the same area.
-         */
-        uint32_t noise = 0x100001;
+/* Each row is dithered with a short run of noise that gets repeated
+ * across the row, rather than fresh noise per pixel
+ */
+#define UNROLLED_PIXEL_COUNT 8
+
+#define RANDOMIZE(num) (num = (num + (num << 1)) & NOISE_MASK)
+
+typedef struct
+{
+        ply_pixel_buffer_t *buffer;
+        ply_rectangle_t     area;
+        uint32_t            period;
+
+        /* channels and noise for the first row of area */
+        uint32_t            red, green, blue;
+        uint32_t            red_step, green_step, blue_step;
+        uint32_t            noise;
+} ply_pixel_gradient_t;
+
+/* RANDOMIZE multiplies by 3, so the noise a band starts with can be
+ * found without generating everything before it
+ */
+static uint32_t
+advance_noise (uint32_t      noise,
+               unsigned long steps)
+{
+        uint32_t factor = 3;
+
+        while (steps > 0) {
+                if (steps & 1)
+                        noise = (noise * factor) & NOISE_MASK;
+                factor = (factor * factor) & NOISE_MASK;
+                steps >>= 1;
+        }
+
+        return noise;
+}
+
+static void
+fill_gradient_rows (ply_pixel_gradient_t *gradient,
+                    unsigned long         start,
+                    unsigned long         end)
+{
+        uint32_t red, green, blue, noise, pixel;
+        uint32_t shaded_set[UNROLLED_PIXEL_COUNT];
+        unsigned long x, y;
+
+        red = gradient->red + gradient->red_step * start;
+        green = gradient->green + gradient->green_step * start;
+        blue = gradient->blue + gradient->blue_step * start;
+        noise = advance_noise (gradient->noise, start * gradient->period * 3);
+
+        for (y = start; y < end; y++) {
+                for (x = 0; x < gradient->period; x++) {
+                        pixel = 0xff000000;
+                        RANDOMIZE (noise);
+                        pixel |= (((red + noise) & COLOR_MASK) >> RED_SHIFT);
+                        RANDOMIZE (noise);
+                        pixel |= (((green + noise) & COLOR_MASK) >> GREEN_SHIFT);
+                        RANDOMIZE (noise);
+                        pixel |= (((blue + noise) & COLOR_MASK) >> BLUE_SHIFT);
+
+                        shaded_set[x] = pixel;
+                }
+
+                ply_pixel_buffer_write_row (gradient->buffer,
+                                            gradient->area.x, gradient->area.y + y,
+                                            shaded_set, gradient->period,
+                                            gradient->area.width);
+
+                red += gradient->red_step;
+                green += gradient->green_step;
+                blue += gradient->blue_step;
+        }
+}
+
+void
+ply_pixel_buffer_fill_with_gradient (ply_pixel_buffer_t *buffer,
+                                     ply_rectangle_t    *fill_area,
+                                     uint32_t            start,
+                                     uint32_t            end)
+{
+        ply_pixel_gradient_t gradient;
+        uint32_t t;
         ply_rectangle_t cropped_area;
 
         if (fill_area == NULL)
                 fill_area = &buffer->logical_area;
 
+        ply_pixel_buffer_uncompress (buffer);
+
         ply_pixel_buffer_crop_area_to_clip_area (buffer, fill_area, &cropped_area);
 
-        red = (start << RED_SHIFT) & COLOR_MASK;
-        green = (start << GREEN_SHIFT) & COLOR_MASK;
-        blue = (start << BLUE_SHIFT) & COLOR_MASK;
+        if (cropped_area.width == 0 || cropped_area.height == 0)
+                return;
+
+        gradient.red = (start << RED_SHIFT) & COLOR_MASK;
+        gradient.green = (start << GREEN_SHIFT) & COLOR_MASK;
+        gradient.blue = (start << BLUE_SHIFT) & COLOR_MASK;
 
         t = (end << RED_SHIFT) & COLOR_MASK;
-        red_step = (int32_t) (t - red) / (int32_t) buffer->area.height;
+        gradient.red_step = (int32_t) (t - gradient.red) / (int32_t) buffer->area.height;
         t = (end << GREEN_SHIFT) & COLOR_MASK;
-        green_step = (int32_t) (t - green) / (int32_t) buffer->area.height;
+        gradient.green_step = (int32_t) (t - gradient.green) / (int32_t) buffer->area.height;
         t = (end << BLUE_SHIFT) & COLOR_MASK;
-        blue_step = (int32_t) (t - blue) / (int32_t) buffer->area.height;
-
+        gradient.blue_step = (int32_t) (t - gradient.blue) / (int32_t) buffer->area.height;
 
-#define RANDOMIZE(num) (num = (num + (num << 1)) & NOISE_MASK)
-#define UNROLLED_PIXEL_COUNT 8
-
-        for (y = buffer->area.y; y < buffer->area.y + buffer->area.height; y++) {
-                if (cropped_area.y <= y && y < cropped_area.y + cropped_area.height) {
-                        if (cropped_area.width < UNROLLED_PIXEL_COUNT || buffer->device_rotation) {
-                                for (x = cropped_area.x; x < cropped_area.x + cropped_area.width; x++) {
-                                        pixel = 0xff000000;
-                                        RANDOMIZE (noise);
-                                        pixel |= (((red + noise) & COLOR_MASK) >> RED_SHIFT);
-                                        RANDOMIZE (noise);
-                                        pixel |= (((green + noise) & COLOR_MASK) >> GREEN_SHIFT);
-                                        RANDOMIZE (noise);
-                                        pixel |= (((blue + noise) & COLOR_MASK) >> BLUE_SHIFT);
-
-                                        ply_pixel_buffer_set_pixel (buffer, x, y, pixel);
-                                }
-                        } else {
-                                uint32_t shaded_set[UNROLLED_PIXEL_COUNT];
-                                uint32_t *ptr = &buffer->bytes[y * buffer->area.width + cropped_area.x];
-                                for (x = 0; x < UNROLLED_PIXEL_COUNT; x++) {
-                                        shaded_set[x] = 0xff000000;
-                                        RANDOMIZE (noise);
-                                        shaded_set[x] |= (((red + noise) & COLOR_MASK) >> RED_SHIFT);
-                                        RANDOMIZE (noise);
-                                        shaded_set[x] |= (((green + noise) & COLOR_MASK) >> GREEN_SHIFT);
-                                        RANDOMIZE (noise);
-                                        shaded_set[x] |= (((blue + noise) & COLOR_MASK) >> BLUE_SHIFT);
-                                }
-                                for (x = cropped_area.width; x >= UNROLLED_PIXEL_COUNT; x -= UNROLLED_PIXEL_COUNT) {
-                                        memcpy (ptr, (void *) shaded_set, UNROLLED_PIXEL_COUNT * sizeof(uint32_t));
-                                        ptr += UNROLLED_PIXEL_COUNT;
-                                }
+        /* Rows above the cropped area don't consume any noise, so just
+         * jump the color channels straight to the first visible row
+         */
+        t = cropped_area.y - buffer->area.y;
+        gradient.red += gradient.red_step * t;
+        gradient.green += gradient.green_step * t;
+        gradient.blue += gradient.blue_step * t;
 
-                                memcpy (ptr, (void *) shaded_set, x * sizeof(uint32_t));
-                        }
-                }
+        /* we use a fixed seed so that the dithering doesn't change on repaints
+         * of the same area.
+         */
+        gradient.noise = 0x100001;
+        gradient.period = MIN (cropped_area.width, UNROLLED_PIXEL_COUNT);
+        gradient.buffer = buffer;
+        gradient.area = cropped_area;
 
-                red += red_step;
-                green += green_step;
-                blue += blue_step;
-        }
+        ply_pixel_buffer_run_on_rows (cropped_area.width, cropped_area.height,
+                                      (ply_worker_pool_handler_t) fill_gradient_rows,
+                                      &gradient);
 
         ply_pixel_buffer_add_updated_area (buffer, &cropped_area);
 }
@@ -647,167 +959,467 @@ ply_pixel_buffer_fill_with_hex_color (ply_pixel_buffer_t *buffer,
                                                                 hex_color, 1.0);
 }
 
-static inline uint32_t
-ply_pixels_interpolate (uint32_t *bytes,
-                        int       width,
-                        int       height,
-                        double    x,
-                        double    y)
-{
-        int ix;
-        int iy;
-        int i;
-        int offset_x;
-        int offset_y;
-        uint32_t pixels[2][2];
-        uint32_t reply = 0;
-
-        for (offset_y = 0; offset_y < 2; offset_y++) {
-                for (offset_x = 0; offset_x < 2; offset_x++) {
-                        ix = x + offset_x;
-                        iy = y + offset_y;
-
-                        if (ix < 0 || ix >= width || iy < 0 || iy >= height)
-                                pixels[offset_y][offset_x] = 0x00000000;
-                        else
-                                pixels[offset_y][offset_x] = bytes[ix + iy * width];
-                }
-        }
-        if (!pixels[0][0] && !pixels[0][1] && !pixels[1][0] && !pixels[1][1]) return 0;
-
-        ix = x;
-        iy = y;
-        x -= ix;
-        y -= iy;
-        for (i = 0; i < 4; i++) {
-                uint32_t value = 0;
-                uint32_t mask = 0xFF << (i * 8);
-                value += ((pixels[0][0]) & mask) * (1 - x) * (1 - y);
-                value += ((pixels[0][1]) & mask) * x * (1 - y);
-                value += ((pixels[1][0]) & mask) * (1 - x) * y;
-                value += ((pixels[1][1]) & mask) * x * y;
-                reply |= value & mask;
-        }
-        return reply;
-}
+/* The scaler below works in fixed point: source positions and
+ * weights carry SCALE_FRACTION_BITS of fraction, and rows that have
+ * been scaled horizontally keep their channels as 8.8 fixed point
+ * until the vertical pass folds them back down to 8 bits.
+ *
+ * Each axis is scaled with either bilinear filtering, or, when
+ * shrinking by more than BOX_FILTER_THRESHOLD, with a box filter
+ * that averages every source pixel an output pixel covers.
+ * Bilinear filtering alone would skip source pixels entirely at
+ * those ratios and alias badly.
+ */
+#define SCALE_FRACTION_BITS 8
+#define SCALE_ONE (1 << SCALE_FRACTION_BITS)
+#define BOX_FILTER_THRESHOLD 2.0
 
-void
-ply_pixel_buffer_fill_with_argb32_data_at_opacity_with_clip_and_scale (ply_pixel_buffer_t *buffer,
-                                                                       ply_rectangle_t    *fill_area,
-                                                                       ply_rectangle_t    *clip_area,
-                                                                       uint32_t           *data,
-                                                                       double              opacity,
-                                                                       int                 scale)
+typedef struct
 {
-        unsigned long row, column;
-        uint8_t opacity_as_byte;
-        ply_rectangle_t logical_fill_area;
-        ply_rectangle_t cropped_area;
-        unsigned long x;
-        unsigned long y;
-        double scale_factor;
+        /* bilinear: the two source pixels and their weights, with
+         * pixels outside the source given a weight of 0.
+         * box: the source pixels from first to first + count - 1
+         */
+        int      first;
+        int      second;
+        uint32_t first_weight;
+        uint32_t second_weight;
+        int      count;
+        uint32_t reciprocal;
+} ply_scale_tap_t;
+
+typedef struct
+{
+        uint32_t        *source;
+        long             source_width;
+        long             source_height;
+
+        long             width;
+        ply_scale_tap_t *column_taps;
+        ply_scale_tap_t *row_taps;
+        uint32_t         columns_use_box_filter : 1;
+        uint32_t         rows_use_box_filter : 1;
+
+        uint16_t        *scaled_rows[2];
+        long             scaled_row_indices[2];
+        uint32_t        *row_sums;
+} ply_pixel_scaler_t;
+
+static ply_scale_tap_t *
+ply_pixel_scaler_compute_taps (long    count,
+                               double  start,
+                               double  step,
+                               long    source_size,
+                               bool   *use_box_filter)
+{
+        ply_scale_tap_t *taps;
+        long i;
 
-        assert (buffer != NULL);
+        taps = calloc (count, sizeof(ply_scale_tap_t));
+        *use_box_filter = step >= BOX_FILTER_THRESHOLD;
 
-        if (fill_area == NULL) {
-                fill_area = &buffer->logical_area;
-                logical_fill_area = buffer->logical_area;
-        } else {
-                logical_fill_area = *fill_area;
-                ply_rectangle_downscale (&logical_fill_area, scale);
-        }
+        for (i = 0; i < count; i++) {
+                ply_scale_tap_t *tap = &taps[i];
 
-        ply_pixel_buffer_crop_area_to_clip_area (buffer, &logical_fill_area, &cropped_area);
+                if (*use_box_filter) {
+                        long first, last;
 
-        if (clip_area) {
-                ply_rectangle_t device_clip_area;
+                        first = floor (start + i * step);
+                        last = floor (start + (i + 1) * step);
 
-                device_clip_area = *clip_area;
-                ply_rectangle_downscale (&device_clip_area, scale);
-                ply_pixel_buffer_adjust_area_for_device_scale (buffer, &device_clip_area);
-                ply_rectangle_intersect (&cropped_area, &device_clip_area, &cropped_area);
-        }
+                        first = CLAMP (first, 0, source_size);
+                        last = CLAMP (last, first + 1, source_size);
 
-        if (cropped_area.width == 0 || cropped_area.height == 0)
-                return;
+                        tap->first = first;
+                        tap->count = last - first;
 
-        opacity_as_byte = (uint8_t) (opacity * 255.0);
-        scale_factor = (double)scale / buffer->device_scale;
-        x = cropped_area.x;
-        y = cropped_area.y;
+                        if (tap->count > 0)
+                                tap->reciprocal = (1 << 24) / tap->count;
+                } else {
+                        long position;
 
-        /* column, row are the point we want to write into, in
-           pixel_buffer coordinate space (device pixels)
+                        position = lround ((start + i * step) * SCALE_ONE);
 
-           scale_factor * (column - fill_area->x), scale_factor * (row - fill_area->y)
-           is the point we want to source from, in the data coordinate
-           space */
-        for (row = y; row < y + cropped_area.height; row++) {
-                for (column = x; column < x + cropped_area.width; column++) {
-                        uint32_t pixel_value;
+                        tap->first = position >> SCALE_FRACTION_BITS;
+                        tap->second = tap->first + 1;
+                        tap->second_weight = position & (SCALE_ONE - 1);
+                        tap->first_weight = SCALE_ONE - tap->second_weight;
 
-                        if (buffer->device_scale == scale)
-                                pixel_value = data[fill_area->width * (row - fill_area->y) +
-                                                   column - fill_area->x];
-                        else
-                                pixel_value = ply_pixels_interpolate (data,
-                                                                      fill_area->width,
-                                                                      fill_area->height,
-                                                                      scale_factor * column - fill_area->x,
-                                                                      scale_factor * row - fill_area->y);
-                        if ((pixel_value >> 24) == 0x00)
-                                continue;
+                        if (tap->first < 0 || tap->first >= source_size) {
+                                tap->first = 0;
+                                tap->first_weight = 0;
+                        }
 
-                        pixel_value = make_pixel_value_translucent (pixel_value, opacity_as_byte);
-                        ply_pixel_buffer_blend_value_at_pixel (buffer,
-                                                               column, row,
-                                                               pixel_value);
+                        if (tap->second < 0 || tap->second >= source_size) {
+                                tap->second = 0;
+                                tap->second_weight = 0;
+                        }
                 }
         }
 
-        ply_pixel_buffer_add_updated_area (buffer, &cropped_area);
+        return taps;
 }
 
-void
-ply_pixel_buffer_fill_with_argb32_data_at_opacity_with_clip (ply_pixel_buffer_t *buffer,
-                                                             ply_rectangle_t    *fill_area,
-                                                             ply_rectangle_t    *clip_area,
-                                                             uint32_t           *data,
-                                                             double              opacity)
+static void
+ply_pixel_scaler_init (ply_pixel_scaler_t *scaler,
+                       uint32_t           *source,
+                       long                source_width,
+                       long                source_height,
+                       long                width,
+                       double              x_start,
+                       double              x_step,
+                       long                height,
+                       double              y_start,
+                       double              y_step)
 {
-        ply_pixel_buffer_fill_with_argb32_data_at_opacity_with_clip_and_scale (buffer,
-                                                                               fill_area,
-                                                                               clip_area,
-                                                                               data,
-                                                                               opacity,
-                                                                               1);
+        bool use_box_filter;
+
+        scaler->source = source;
+        scaler->source_width = source_width;
+        scaler->source_height = source_height;
+        scaler->width = width;
+
+        scaler->column_taps = ply_pixel_scaler_compute_taps (width, x_start, x_step,
+                                                             source_width, &use_box_filter);
+        scaler->columns_use_box_filter = use_box_filter;
+
+        scaler->row_taps = ply_pixel_scaler_compute_taps (height, y_start, y_step,
+                                                          source_height, &use_box_filter);
+        scaler->rows_use_box_filter = use_box_filter;
+
+        scaler->scaled_rows[0] = malloc (width * 4 * sizeof(uint16_t));
+        scaler->scaled_rows[1] = malloc (width * 4 * sizeof(uint16_t));
+        scaler->scaled_row_indices[0] = -1;
+        scaler->scaled_row_indices[1] = -1;
+
+        if (scaler->rows_use_box_filter)
+                scaler->row_sums = malloc (width * 4 * sizeof(uint32_t));
+        else
+                scaler->row_sums = NULL;
 }
 
-void
-ply_pixel_buffer_fill_with_argb32_data_at_opacity (ply_pixel_buffer_t *buffer,
-                                                   ply_rectangle_t    *fill_area,
-                                                   uint32_t           *data,
-                                                   double              opacity)
+static void
+ply_pixel_scaler_destroy (ply_pixel_scaler_t *scaler)
 {
-        ply_pixel_buffer_fill_with_argb32_data_at_opacity_with_clip_and_scale (buffer,
-                                                                               fill_area,
-                                                                               NULL,
-                                                                               data, opacity, 1);
+        free (scaler->column_taps);
+        free (scaler->row_taps);
+        free (scaler->scaled_rows[0]);
+        free (scaler->scaled_rows[1]);
+        free (scaler->row_sums);
 }
 
-void
-ply_pixel_buffer_fill_with_argb32_data (ply_pixel_buffer_t *buffer,
-                                        ply_rectangle_t    *fill_area,
-                                        uint32_t           *data)
+/* Scales one source row horizontally into 8.8 fixed point channels */
+static void
+ply_pixel_scaler_scale_row (ply_pixel_scaler_t *scaler,
+                            long                source_row,
+                            uint16_t           *scaled_row)
 {
-        ply_pixel_buffer_fill_with_argb32_data_at_opacity_with_clip_and_scale (buffer,
-                                                                               fill_area,
-                                                                               NULL,
-                                                                               data, 1.0, 1);
-}
+        uint32_t *source;
+        long x;
+        int channel;
 
-void
-ply_pixel_buffer_fill_with_argb32_data_with_clip (ply_pixel_buffer_t *buffer,
+        source = scaler->source + source_row * scaler->source_width;
+
+        if (scaler->columns_use_box_filter) {
+                for (x = 0; x < scaler->width; x++) {
+                        ply_scale_tap_t *tap = &scaler->column_taps[x];
+                        uint32_t sums[4] = { 0, 0, 0, 0 };
+                        int i;
+
+                        for (i = 0; i < tap->count; i++) {
+                                uint32_t pixel = source[tap->first + i];
+
+                                for (channel = 0; channel < 4; channel++) {
+                                        sums[channel] += (pixel >> (channel * 8)) & 0xff;
+                                }
+                        }
+
+                        for (channel = 0; channel < 4; channel++) {
+                                scaled_row[x * 4 + channel] = (sums[channel] * tap->reciprocal + 0x8000) >> 16;
+                        }
+                }
+        } else {
+                for (x = 0; x < scaler->width; x++) {
+                        ply_scale_tap_t *tap = &scaler->column_taps[x];
+                        uint32_t first_pixel = source[tap->first];
+                        uint32_t second_pixel = source[tap->second];
+
+                        for (channel = 0; channel < 4; channel++) {
+                                scaled_row[x * 4 + channel] =
+                                        ((first_pixel >> (channel * 8)) & 0xff) * tap->first_weight +
+                                        ((second_pixel >> (channel * 8)) & 0xff) * tap->second_weight;
+                        }
+                }
+        }
+}
+
+static uint16_t *
+ply_pixel_scaler_get_scaled_row (ply_pixel_scaler_t *scaler,
+                                 long                source_row,
+                                 long                row_to_keep)
+{
+        int slot;
+
+        for (slot = 0; slot < 2; slot++) {
+                if (scaler->scaled_row_indices[slot] == source_row)
+                        return scaler->scaled_rows[slot];
+        }
+
+        slot = scaler->scaled_row_indices[0] == row_to_keep ? 1 : 0;
+
+        ply_pixel_scaler_scale_row (scaler, source_row, scaler->scaled_rows[slot]);
+        scaler->scaled_row_indices[slot] = source_row;
+
+        return scaler->scaled_rows[slot];
+}
+
+static void
+ply_pixel_scaler_get_row (ply_pixel_scaler_t *scaler,
+                          long                y,
+                          uint32_t           *output)
+{
+        ply_scale_tap_t *tap = &scaler->row_taps[y];
+        long x, i, count;
+
+        count = scaler->width * 4;
+
+        if (scaler->rows_use_box_filter) {
+                uint32_t *sums = scaler->row_sums;
+
+                if (tap->count == 0) {
+                        memset (output, 0, scaler->width * sizeof(uint32_t));
+                        return;
+                }
+
+                memset (sums, 0, count * sizeof(uint32_t));
+                for (i = 0; i < tap->count; i++) {
+                        uint16_t *row = ply_pixel_scaler_get_scaled_row (scaler, tap->first + i, -1);
+
+                        for (x = 0; x < count; x++) {
+                                sums[x] += row[x];
+                        }
+                }
+
+                for (x = 0; x < scaler->width; x++) {
+                        uint32_t *sum = &sums[x * 4];
+
+                        output[x] = (uint32_t) (((uint64_t) sum[0] * tap->reciprocal + (1ULL << 31)) >> 32) |
+                                    (uint32_t) (((uint64_t) sum[1] * tap->reciprocal + (1ULL << 31)) >> 32) << 8 |
+                                    (uint32_t) (((uint64_t) sum[2] * tap->reciprocal + (1ULL << 31)) >> 32) << 16 |
+                                    (uint32_t) (((uint64_t) sum[3] * tap->reciprocal + (1ULL << 31)) >> 32) << 24;
+                }
+        } else {
+                uint16_t *first_row, *second_row;
+                uint32_t first_weight, second_weight;
+
+                if (tap->first_weight == 0 && tap->second_weight == 0) {
+                        memset (output, 0, scaler->width * sizeof(uint32_t));
+                        return;
+                }
+
+                first_row = ply_pixel_scaler_get_scaled_row (scaler, tap->first, -1);
+                second_row = ply_pixel_scaler_get_scaled_row (scaler, tap->second, tap->first);
+                first_weight = tap->first_weight;
+                second_weight = tap->second_weight;
+
+                for (x = 0; x < scaler->width; x++) {
+                        uint32_t channels[4];
+                        int channel;
+
+                        for (channel = 0; channel < 4; channel++) {
+                                channels[channel] = (first_row[x * 4 + channel] * first_weight +
+                                                     second_row[x * 4 + channel] * second_weight +
+                                                     0x8000) >> 16;
+                        }
+
+                        output[x] = channels[0] | channels[1] << 8 | channels[2] << 16 | channels[3] << 24;
+                }
+        }
+}
+
+typedef struct
+{
+        ply_pixel_buffer_t *buffer;
+        ply_rectangle_t     area;
+        uint32_t           *source; /* first pixel of area */
+        unsigned long       source_stride;
+        uint8_t             opacity;
+} ply_pixel_argb32_fill_t;
+
+static void
+blend_argb32_rows (ply_pixel_argb32_fill_t *fill,
+                   unsigned long            start,
+                   unsigned long            end)
+{
+        ply_pixel_buffer_t *buffer = fill->buffer;
+        unsigned long x = fill->area.x, y = fill->area.y, width = fill->area.width;
+        uint8_t opacity = fill->opacity;
+        unsigned long row, column;
+
+        for (row = start; row < end; row++) {
+                uint32_t *source_row;
+
+                source_row = &fill->source[row * fill->source_stride];
+
+                for (column = 0; column < width; column++) {
+                        uint32_t pixel_value;
+
+                        pixel_value = source_row[column];
+
+                        if ((pixel_value >> 24) == 0x00)
+                                continue;
+
+                        pixel_value = make_pixel_value_translucent (pixel_value, opacity);
+                        ply_pixel_buffer_blend_value_at_pixel (buffer,
+                                                               x + column, y + row,
+                                                               pixel_value);
+                }
+        }
+}
+
+void
+ply_pixel_buffer_fill_with_argb32_data_at_opacity_with_clip_and_scale (ply_pixel_buffer_t *buffer,
+                                                                       ply_rectangle_t    *fill_area,
+                                                                       ply_rectangle_t    *clip_area,
+                                                                       uint32_t           *data,
+                                                                       double              opacity,
+                                                                       int                 scale)
+{
+        unsigned long row, column;
+        uint8_t opacity_as_byte;
+        ply_rectangle_t logical_fill_area;
+        ply_rectangle_t cropped_area;
+        unsigned long x;
+        unsigned long y;
+        double scale_factor;
+        ply_pixel_scaler_t scaler;
+        uint32_t *scaled_row = NULL;
+
+        assert (buffer != NULL);
+
+        ply_pixel_buffer_uncompress (buffer);
+
+        if (fill_area == NULL) {
+                fill_area = &buffer->logical_area;
+                logical_fill_area = buffer->logical_area;
+        } else {
+                logical_fill_area = *fill_area;
+                ply_rectangle_downscale (&logical_fill_area, scale);
+        }
+
+        ply_pixel_buffer_crop_area_to_clip_area (buffer, &logical_fill_area, &cropped_area);
+
+        if (clip_area) {
+                ply_rectangle_t device_clip_area;
+
+                device_clip_area = *clip_area;
+                ply_rectangle_downscale (&device_clip_area, scale);
+                ply_pixel_buffer_adjust_area_for_device_scale (buffer, &device_clip_area);
+                ply_rectangle_intersect (&cropped_area, &device_clip_area, &cropped_area);
+        }
+
+        if (cropped_area.width == 0 || cropped_area.height == 0)
+                return;
+
+        opacity_as_byte = (uint8_t) (opacity * 255.0);
+        scale_factor = (double)scale / buffer->device_scale;
+        x = cropped_area.x;
+        y = cropped_area.y;
+
+        /* column, row are the point we want to write into, in
+           pixel_buffer coordinate space (device pixels)
+
+           scale_factor * column - fill_area->x, scale_factor * row - fill_area->y
+           is the point we want to source from, in the data coordinate
+           space */
+        if (buffer->device_scale != scale) {
+                ply_pixel_scaler_init (&scaler, data,
+                                       fill_area->width, fill_area->height,
+                                       cropped_area.width,
+                                       scale_factor * x - fill_area->x, scale_factor,
+                                       cropped_area.height,
+                                       scale_factor * y - fill_area->y, scale_factor);
+                scaled_row = malloc (cropped_area.width * sizeof(uint32_t));
+        }
+
+        if (buffer->device_scale == scale) {
+                ply_pixel_argb32_fill_t fill;
+
+                fill.buffer = buffer;
+                fill.area = cropped_area;
+                fill.source = &data[fill_area->width * (y - fill_area->y) + x - fill_area->x];
+                fill.source_stride = fill_area->width;
+                fill.opacity = opacity_as_byte;
+
+                ply_pixel_buffer_run_on_rows (cropped_area.width, cropped_area.height,
+                                              (ply_worker_pool_handler_t) blend_argb32_rows,
+                                              &fill);
+        } else {
+                for (row = y; row < y + cropped_area.height; row++) {
+                        ply_pixel_scaler_get_row (&scaler, row - y, scaled_row);
+
+                        for (column = x; column < x + cropped_area.width; column++) {
+                                uint32_t pixel_value;
+
+                                pixel_value = scaled_row[column - x];
+
+                                if ((pixel_value >> 24) == 0x00)
+                                        continue;
+
+                                pixel_value = make_pixel_value_translucent (pixel_value, opacity_as_byte);
+                                ply_pixel_buffer_blend_value_at_pixel (buffer,
+                                                                       column, row,
+                                                                       pixel_value);
+                        }
+                }
+
+                free (scaled_row);
+                ply_pixel_scaler_destroy (&scaler);
+        }
+
+        ply_pixel_buffer_add_updated_area (buffer, &cropped_area);
+}
+
+void
+ply_pixel_buffer_fill_with_argb32_data_at_opacity_with_clip (ply_pixel_buffer_t *buffer,
+                                                             ply_rectangle_t    *fill_area,
+                                                             ply_rectangle_t    *clip_area,
+                                                             uint32_t           *data,
+                                                             double              opacity)
+{
+        ply_pixel_buffer_fill_with_argb32_data_at_opacity_with_clip_and_scale (buffer,
+                                                                               fill_area,
+                                                                               clip_area,
+                                                                               data,
+                                                                               opacity,
+                                                                               1);
+}
+
+void
+ply_pixel_buffer_fill_with_argb32_data_at_opacity (ply_pixel_buffer_t *buffer,
+                                                   ply_rectangle_t    *fill_area,
+                                                   uint32_t           *data,
+                                                   double              opacity)
+{
+        ply_pixel_buffer_fill_with_argb32_data_at_opacity_with_clip_and_scale (buffer,
+                                                                               fill_area,
+                                                                               NULL,
+                                                                               data, opacity, 1);
+}
+
+void
+ply_pixel_buffer_fill_with_argb32_data (ply_pixel_buffer_t *buffer,
+                                        ply_rectangle_t    *fill_area,
+                                        uint32_t           *data)
+{
+        ply_pixel_buffer_fill_with_argb32_data_at_opacity_with_clip_and_scale (buffer,
+                                                                               fill_area,
+                                                                               NULL,
+                                                                               data, 1.0, 1);
+}
+
+void
+ply_pixel_buffer_fill_with_argb32_data_with_clip (ply_pixel_buffer_t *buffer,
                                                   ply_rectangle_t    *fill_area,
                                                   ply_rectangle_t    *clip_area,
                                                   uint32_t           *data)
@@ -818,19 +1430,384 @@ ply_pixel_buffer_fill_with_argb32_data_with_clip (ply_pixel_buffer_t *buffer,
                                                                                data, 1.0, 1);
 }
 
-static void
-ply_pixel_buffer_copy_area (ply_pixel_buffer_t *canvas,
-                            ply_pixel_buffer_t *source,
-                            int x, int y,
-                            ply_rectangle_t *cropped_area)
-{
-        unsigned long row;
+static void
+ply_pixel_buffer_blend_row (ply_pixel_buffer_t *canvas,
+                            long                start,
+                            long                end,
+                            long                y,
+                            uint32_t           *source_row,
+                            uint8_t             opacity)
+{
+        long x;
+
+        for (x = start; x < end; x++) {
+                uint32_t pixel_value = source_row[x];
+
+                if ((pixel_value >> 24) == 0x00)
+                        continue;
+
+                pixel_value = make_pixel_value_translucent (pixel_value, opacity);
+                ply_pixel_buffer_blend_value_at_pixel (canvas, x, y, pixel_value);
+        }
+}
+
+/* Works out which canvas device pixels a blit of source at x_offset,
+ * y_offset touches, and where the source's top left corner lands
+ */
+static bool
+ply_pixel_buffer_get_blit_area (ply_pixel_buffer_t *canvas,
+                                ply_pixel_buffer_t *source,
+                                int                 x_offset,
+                                int                 y_offset,
+                                ply_rectangle_t    *clip_area,
+                                ply_rectangle_t    *cropped_area,
+                                long               *origin_x,
+                                long               *origin_y)
+{
+        ply_rectangle_t visible_area;
+
+        cropped_area->x = x_offset;
+        cropped_area->y = y_offset;
+        cropped_area->width = source->logical_area.width;
+        cropped_area->height = source->logical_area.height;
+
+        ply_pixel_buffer_crop_area_to_clip_area (canvas, cropped_area, cropped_area);
+
+        /* clip_area is in source device pixels, which are also canvas device pixels */
+        if (clip_area)
+                ply_rectangle_intersect (cropped_area, clip_area, cropped_area);
+
+        *origin_x = x_offset * canvas->device_scale;
+        *origin_y = y_offset * canvas->device_scale;
+
+        /* Nothing outside the visible part of the source needs drawing,
+         * or reporting as updated
+         */
+        if (source->row_spans != NULL) {
+                visible_area = source->visible_area;
+                visible_area.x += *origin_x;
+                visible_area.y += *origin_y;
+                ply_rectangle_intersect (cropped_area, &visible_area, cropped_area);
+        }
+
+        return cropped_area->width != 0 && cropped_area->height != 0;
+}
+
+typedef struct
+{
+        ply_pixel_buffer_t *canvas;
+        ply_pixel_buffer_t *source;
+        ply_rectangle_t     area;
+        long                origin_x;
+        long                origin_y;
+        uint8_t             opacity;
+} ply_pixel_buffer_blit_t;
+
+static void
+blit_span_rows (ply_pixel_buffer_blit_t *blit,
+                unsigned long            first_row,
+                unsigned long            last_row)
+{
+        ply_pixel_buffer_t *canvas = blit->canvas;
+        ply_pixel_buffer_t *source = blit->source;
+        long origin_x = blit->origin_x;
+        long origin_y = blit->origin_y;
+        long y;
+
+        for (y = blit->area.y + first_row; y < (long) (blit->area.y + last_row); y++) {
+                uint32_t *source_row;
+                long start, end, opaque_start, opaque_end;
+
+                /* Work in source columns for the rest of the row */
+                source_row = &source->bytes[(y - origin_y) * source->area.width];
+                start = blit->area.x - origin_x;
+                end = start + blit->area.width;
+
+                if (source->row_spans != NULL) {
+                        ply_pixel_buffer_row_span_t *span = &source->row_spans[y - origin_y];
+
+                        start = MAX (start, span->visible_start);
+                        end = MIN (end, span->visible_end);
+                        opaque_start = MAX (start, span->opaque_start);
+                        opaque_end = MIN (end, span->opaque_end);
+                } else {
+                        opaque_start = start;
+                        opaque_end = end;
+                }
+
+                if (start >= end)
+                        continue;
+
+                if (blit->opacity != 255 || opaque_start >= opaque_end) {
+                        ply_pixel_buffer_blend_row (canvas, start + origin_x, end + origin_x, y,
+                                                    source_row - origin_x, blit->opacity);
+                        continue;
+                }
+
+                ply_pixel_buffer_blend_row (canvas, start + origin_x, opaque_start + origin_x, y,
+                                            source_row - origin_x, blit->opacity);
+                ply_pixel_buffer_write_row (canvas, opaque_start + origin_x, y,
+                                            &source_row[opaque_start],
+                                            opaque_end - opaque_start,
+                                            opaque_end - opaque_start);
+                ply_pixel_buffer_blend_row (canvas, opaque_end + origin_x, end + origin_x, y,
+                                            source_row - origin_x, blit->opacity);
+        }
+}
+
+static void
+ply_pixel_buffer_fill_with_buffer_spans (ply_pixel_buffer_t *canvas,
+                                         ply_pixel_buffer_t *source,
+                                         int                 x_offset,
+                                         int                 y_offset,
+                                         ply_rectangle_t    *clip_area,
+                                         float               opacity)
+{
+        ply_pixel_buffer_blit_t blit;
+
+        if (!ply_pixel_buffer_get_blit_area (canvas, source, x_offset, y_offset, clip_area,
+                                             &blit.area, &blit.origin_x, &blit.origin_y))
+                return;
+
+        blit.canvas = canvas;
+        blit.source = source;
+        blit.opacity = (uint8_t) (opacity * 255.0);
+
+        ply_pixel_buffer_run_on_rows (blit.area.width, blit.area.height,
+                                      (ply_worker_pool_handler_t) blit_span_rows,
+                                      &blit);
+
+        ply_pixel_buffer_add_updated_area (canvas, &blit.area);
+}
+
+/* Compressed buffers store each row as a sequence of runs.  Every run
+ * starts with a header word holding its kind and length; opaque and
+ * translucent runs are followed by their pixels, transparent runs
+ * aren't, and transparent runs at the end of a row are left out.
+ */
+#define RUN_KIND_SHIFT 28
+#define RUN_LENGTH_MASK ((1 << RUN_KIND_SHIFT) - 1)
+
+typedef enum
+{
+        RUN_KIND_TRANSPARENT = 0,
+        RUN_KIND_OPAQUE,
+        RUN_KIND_TRANSLUCENT,
+} run_kind_t;
+
+static inline run_kind_t
+get_run_kind (uint32_t pixel_value)
+{
+        switch (pixel_value >> 24) {
+        case 0x00:
+                return RUN_KIND_TRANSPARENT;
+        case 0xff:
+                return RUN_KIND_OPAQUE;
+        default:
+                return RUN_KIND_TRANSLUCENT;
+        }
+}
+
+/* Encodes a row into runs, or just counts the words needed if runs is NULL */
+static size_t
+compress_row (uint32_t *row,
+              long      width,
+              uint32_t *runs)
+{
+        size_t size = 0;
+        long x, length;
+        run_kind_t kind;
+
+        for (x = 0; x < width; x += length) {
+                kind = get_run_kind (row[x]);
+
+                for (length = 1; x + length < width && get_run_kind (row[x + length]) == kind; length++) {
+                }
+
+                if (kind == RUN_KIND_TRANSPARENT && x + length == width)
+                        break;
+
+                if (runs != NULL)
+                        runs[size] = (kind << RUN_KIND_SHIFT) | length;
+                size++;
+
+                if (kind == RUN_KIND_TRANSPARENT)
+                        continue;
+
+                if (runs != NULL)
+                        memcpy (&runs[size], &row[x], length * sizeof(uint32_t));
+                size += length;
+        }
+
+        return size;
+}
+
+bool
+ply_pixel_buffer_compress (ply_pixel_buffer_t *buffer)
+{
+        size_t size;
+        long y, width, height;
+
+        assert (buffer != NULL);
+
+        if (buffer->compressed_runs != NULL)
+                return true;
+
+        if (buffer->device_rotation != PLY_PIXEL_BUFFER_ROTATE_UPRIGHT)
+                return false;
+
+        width = buffer->area.width;
+        height = buffer->area.height;
+
+        if (width > RUN_LENGTH_MASK)
+                return false;
+
+        size = 0;
+        for (y = 0; y < height; y++) {
+                size += compress_row (&buffer->bytes[y * width], width, NULL);
+        }
+
+        /* Not worth the trouble unless it at least halves the size */
+        if ((size + height + 1) * 2 > (size_t) (width * height))
+                return false;
+
+        buffer->compressed_runs = malloc (MAX (size, 1) * sizeof(uint32_t));
+        buffer->compressed_row_offsets = malloc ((height + 1) * sizeof(uint32_t));
+
+        size = 0;
+        for (y = 0; y < height; y++) {
+                buffer->compressed_row_offsets[y] = size;
+                size += compress_row (&buffer->bytes[y * width], width,
+                                      &buffer->compressed_runs[size]);
+        }
+        buffer->compressed_row_offsets[height] = size;
+
+        free (buffer->bytes);
+        buffer->bytes = NULL;
+
+        return true;
+}
+
+/* Expands the runs of a compressed buffer into newly allocated pixels,
+ * leaving the buffer itself compressed
+ */
+static uint32_t *
+ply_pixel_buffer_decode_runs (ply_pixel_buffer_t *buffer)
+{
+        uint32_t *bytes;
+        long y, width, height;
+
+        width = buffer->area.width;
+        height = buffer->area.height;
+
+        bytes = calloc (height, width * sizeof(uint32_t));
+
+        for (y = 0; y < height; y++) {
+                uint32_t *run = &buffer->compressed_runs[buffer->compressed_row_offsets[y]];
+                uint32_t *end = &buffer->compressed_runs[buffer->compressed_row_offsets[y + 1]];
+                uint32_t *row = &bytes[y * width];
+
+                while (run < end) {
+                        run_kind_t kind = *run >> RUN_KIND_SHIFT;
+                        long length = *run & RUN_LENGTH_MASK;
+
+                        run++;
+
+                        if (kind != RUN_KIND_TRANSPARENT) {
+                                memcpy (row, run, length * sizeof(uint32_t));
+                                run += length;
+                        }
+
+                        row += length;
+                }
+        }
+
+        return bytes;
+}
+
+static void
+ply_pixel_buffer_uncompress (ply_pixel_buffer_t *buffer)
+{
+        if (buffer->compressed_runs == NULL)
+                return;
+
+        buffer->bytes = ply_pixel_buffer_decode_runs (buffer);
+
+        free (buffer->compressed_runs);
+        free (buffer->compressed_row_offsets);
+        buffer->compressed_runs = NULL;
+        buffer->compressed_row_offsets = NULL;
+}
+
+bool
+ply_pixel_buffer_is_compressed (ply_pixel_buffer_t *buffer)
+{
+        assert (buffer != NULL);
+        return buffer->compressed_runs != NULL;
+}
+
+static void
+ply_pixel_buffer_fill_with_compressed_buffer (ply_pixel_buffer_t *canvas,
+                                              ply_pixel_buffer_t *source,
+                                              int                 x_offset,
+                                              int                 y_offset,
+                                              ply_rectangle_t    *clip_area,
+                                              float               opacity)
+{
+        ply_rectangle_t cropped_area;
+        uint8_t opacity_as_byte;
+        long origin_x, origin_y, y, start_x, end_x, end_y;
+
+        if (!ply_pixel_buffer_get_blit_area (canvas, source, x_offset, y_offset, clip_area,
+                                             &cropped_area, &origin_x, &origin_y))
+                return;
+
+        opacity_as_byte = (uint8_t) (opacity * 255.0);
+
+        start_x = cropped_area.x;
+        end_x = cropped_area.x + (long) cropped_area.width;
+        end_y = cropped_area.y + (long) cropped_area.height;
+
+        for (y = cropped_area.y; y < end_y; y++) {
+                long source_y = y - origin_y;
+                uint32_t *run = &source->compressed_runs[source->compressed_row_offsets[source_y]];
+                uint32_t *end = &source->compressed_runs[source->compressed_row_offsets[source_y + 1]];
+                long x;
+
+                /* Walk the row in canvas columns */
+                x = origin_x;
+
+                while (run < end && x < end_x) {
+                        run_kind_t kind = *run >> RUN_KIND_SHIFT;
+                        long length = *run & RUN_LENGTH_MASK;
+                        long first, last;
+
+                        run++;
+
+                        if (kind == RUN_KIND_TRANSPARENT) {
+                                x += length;
+                                continue;
+                        }
 
-        for (row = y; row < y + cropped_area->height; row++) {
-                memcpy (canvas->bytes + (cropped_area->y + row - y) * canvas->area.width + cropped_area->x,
-                        source->bytes + (row * source->area.width) + x,
-                        cropped_area->width * 4);
+                        first = MAX (x, start_x);
+                        last = MIN (x + length, end_x);
+
+                        if (first < last) {
+                                if (kind == RUN_KIND_OPAQUE && opacity_as_byte == 255)
+                                        ply_pixel_buffer_write_row (canvas, first, y,
+                                                                    run + (first - x),
+                                                                    last - first, last - first);
+                                else
+                                        ply_pixel_buffer_blend_row (canvas, first, last, y,
+                                                                    run - x, opacity_as_byte);
+                        }
+
+                        run += length;
+                        x += length;
+                }
         }
+
+        ply_pixel_buffer_add_updated_area (canvas, &cropped_area);
 }
 
 void
@@ -842,50 +1819,50 @@ ply_pixel_buffer_fill_with_buffer_at_opacity_with_clip (ply_pixel_buffer_t *canv
                                                         float               opacity)
 {
         ply_rectangle_t fill_area;
-        unsigned long x;
-        unsigned long y;
+        uint32_t *scratch_bytes = NULL;
 
         assert (canvas != NULL);
         assert (source != NULL);
 
-        /* Fast path to memcpy if we need no blending or scaling */
-        if (opacity == 1.0 && ply_pixel_buffer_is_opaque (source) &&
-            canvas->device_scale == source->device_scale &&
-            canvas->device_rotation == PLY_PIXEL_BUFFER_ROTATE_UPRIGHT) {
-                ply_rectangle_t cropped_area;
-
-                cropped_area.x = x_offset;
-                cropped_area.y = y_offset;
-                cropped_area.width = source->logical_area.width;
-                cropped_area.height = source->logical_area.height;
-
-                ply_pixel_buffer_crop_area_to_clip_area (canvas, &cropped_area, &cropped_area);
-
-                /* clip_area is in source device pixels, which are also canvas device pixels */
-                if (clip_area)
-                        ply_rectangle_intersect (&cropped_area, clip_area, &cropped_area);
-
-                if (cropped_area.width == 0 || cropped_area.height == 0)
-                        return;
-
-                x = cropped_area.x - x_offset;
-                y = cropped_area.y - y_offset;
+        ply_pixel_buffer_uncompress (canvas);
 
-                ply_pixel_buffer_copy_area (canvas, source, x, y, &cropped_area);
+        if (source->compressed_runs != NULL &&
+            canvas->device_scale == source->device_scale) {
+                ply_pixel_buffer_fill_with_compressed_buffer (canvas, source,
+                                                              x_offset, y_offset,
+                                                              clip_area, opacity);
+                return;
+        }
 
-                ply_region_add_rectangle (canvas->updated_areas, &cropped_area);
+        /* Fast path that copies opaque runs and skips transparent ones,
+         * when we need no scaling and know where those runs are
+         */
+        if (canvas->device_scale == source->device_scale &&
+            source->device_rotation == PLY_PIXEL_BUFFER_ROTATE_UPRIGHT &&
+            (source->row_spans != NULL ||
+             (opacity == 1.0 && ply_pixel_buffer_is_opaque (source)))) {
+                ply_pixel_buffer_fill_with_buffer_spans (canvas, source,
+                                                         x_offset, y_offset,
+                                                         clip_area, opacity);
         } else {
                 fill_area.x = x_offset * source->device_scale;
                 fill_area.y = y_offset * source->device_scale;
                 fill_area.width = source->area.width;
                 fill_area.height = source->area.height;
 
+                /* Scaled blits of a compressed frame work on a throwaway
+                 * copy, so the shared frame stays compressed
+                 */
+                if (source->compressed_runs != NULL)
+                        scratch_bytes = ply_pixel_buffer_decode_runs (source);
+
                 ply_pixel_buffer_fill_with_argb32_data_at_opacity_with_clip_and_scale (canvas,
                                                                                        &fill_area,
                                                                                        clip_area,
-                                                                                       source->bytes,
+                                                                                       scratch_bytes != NULL ? scratch_bytes : source->bytes,
                                                                                        opacity,
                                                                                        source->device_scale);
+                free (scratch_bytes);
         }
 }
 
@@ -933,26 +1910,23 @@ ply_pixel_buffer_fill_with_buffer (ply_pixel_buffer_t *canvas,
                                                                 1.0);
 }
 
-uint32_t *
-ply_pixel_buffer_get_argb32_data (ply_pixel_buffer_t *buffer)
+static uint32_t *
+ply_pixel_buffer_get_bytes (ply_pixel_buffer_t *buffer)
 {
+        ply_pixel_buffer_uncompress (buffer);
+
         return buffer->bytes;
 }
 
-static inline uint32_t
-ply_pixel_buffer_interpolate (ply_pixel_buffer_t *buffer,
-                              double              x,
-                              double              y)
+uint32_t *
+ply_pixel_buffer_get_argb32_data (ply_pixel_buffer_t *buffer)
 {
-        int width;
-        int height;
-        uint32_t *bytes;
-
-        width = buffer->area.width;
-        height = buffer->area.height;
-        bytes = ply_pixel_buffer_get_argb32_data (buffer);
+        /* The caller may write through the pointer, so anything worked
+         * out from the old contents can't be trusted anymore
+         */
+        ply_pixel_buffer_contents_changed (buffer);
 
-        return ply_pixels_interpolate (bytes, width, height, x, y);
+        return ply_pixel_buffer_get_bytes (buffer);
 }
 
 ply_pixel_buffer_t *
@@ -961,15 +1935,17 @@ ply_pixel_buffer_resize (ply_pixel_buffer_t *old_buffer,
                          long                height)
 {
         ply_pixel_buffer_t *buffer;
-        int x, y;
-        double old_x, old_y;
+        ply_pixel_scaler_t scaler;
+        int y;
         int old_width, old_height;
         double scale_x, scale_y;
         uint32_t *bytes;
 
+        ply_pixel_buffer_uncompress (old_buffer);
+
         buffer = ply_pixel_buffer_new (width, height);
 
-        bytes = ply_pixel_buffer_get_argb32_data (buffer);
+        bytes = ply_pixel_buffer_get_bytes (buffer);
 
         old_width = old_buffer->area.width;
         old_height = old_buffer->area.height;
@@ -977,36 +1953,207 @@ ply_pixel_buffer_resize (ply_pixel_buffer_t *old_buffer,
         scale_x = ((double) old_width - 1) / MAX (width - 1, 1);
         scale_y = ((double) old_height - 1) / MAX (height - 1, 1);
 
+        ply_pixel_scaler_init (&scaler, ply_pixel_buffer_get_bytes (old_buffer),
+                               old_width, old_height,
+                               width, 0.0, scale_x,
+                               height, 0.0, scale_y);
+
         for (y = 0; y < height; y++) {
-                old_y = y * scale_y;
-                for (x = 0; x < width; x++) {
-                        old_x = x * scale_x;
-                        bytes[x + y * width] =
-                                ply_pixel_buffer_interpolate (old_buffer, old_x, old_y);
-                }
+                ply_pixel_scaler_get_row (&scaler, y, &bytes[y * width]);
         }
+
+        ply_pixel_scaler_destroy (&scaler);
+
         return buffer;
 }
 
-ply_pixel_buffer_t *
-ply_pixel_buffer_rotate (ply_pixel_buffer_t *old_buffer,
-                         long                center_x,
-                         long                center_y,
-                         double              theta_offset)
+/* Blends between two pixels with an 8-bit weight for the second
+ * one, doing red/blue and alpha/green in parallel
+ */
+__attribute__((__pure__))
+static inline uint32_t
+interpolate_two_pixel_values (uint32_t pixel_value_1,
+                              uint32_t pixel_value_2,
+                              uint32_t weight)
+{
+        uint32_t red_blue, alpha_green;
+
+        red_blue = ((pixel_value_1 & 0x00ff00ff) * (256 - weight) +
+                    (pixel_value_2 & 0x00ff00ff) * weight) >> 8;
+        alpha_green = ((pixel_value_1 >> 8) & 0x00ff00ff) * (256 - weight) +
+                      ((pixel_value_2 >> 8) & 0x00ff00ff) * weight;
+
+        return (red_blue & 0x00ff00ff) | (alpha_green & 0xff00ff00);
+}
+
+/* Samples bytes at the 16.16 fixed point position x, y, treating
+ * everything outside of the buffer as transparent
+ */
+static inline uint32_t
+ply_pixels_interpolate_fixed (uint32_t *bytes,
+                              long      width,
+                              long      height,
+                              int32_t   x,
+                              int32_t   y)
+{
+        uint32_t top_left, top_right, bottom_left, bottom_right;
+        uint32_t x_weight, y_weight;
+        long ix, iy;
+
+        ix = x >> 16;
+        iy = y >> 16;
+        x_weight = (x >> 8) & 0xff;
+        y_weight = (y >> 8) & 0xff;
+
+        if (ix >= 0 && iy >= 0 && ix + 1 < width && iy + 1 < height) {
+                uint32_t *row = &bytes[iy * width + ix];
+
+                top_left = row[0];
+                top_right = row[1];
+                bottom_left = row[width];
+                bottom_right = row[width + 1];
+        } else {
+                bool left_inside = ix >= 0 && ix < width;
+                bool right_inside = ix + 1 >= 0 && ix + 1 < width;
+                bool top_inside = iy >= 0 && iy < height;
+                bool bottom_inside = iy + 1 >= 0 && iy + 1 < height;
+
+                top_left = top_inside && left_inside ? bytes[iy * width + ix] : 0;
+                top_right = top_inside && right_inside ? bytes[iy * width + ix + 1] : 0;
+                bottom_left = bottom_inside && left_inside ? bytes[(iy + 1) * width + ix] : 0;
+                bottom_right = bottom_inside && right_inside ? bytes[(iy + 1) * width + ix + 1] : 0;
+        }
+
+        if ((top_left | top_right | bottom_left | bottom_right) == 0)
+                return 0;
+
+        return interpolate_two_pixel_values (interpolate_two_pixel_values (top_left, top_right, x_weight),
+                                             interpolate_two_pixel_values (bottom_left, bottom_right, x_weight),
+                                             y_weight);
+}
+
+/* Finds the smallest rectangle holding all of the buffer's non-transparent
+ * pixels.  Returns false if there aren't any.
+ */
+static bool
+ply_pixel_buffer_get_visible_area (ply_pixel_buffer_t *buffer,
+                                   ply_rectangle_t    *visible_area)
+{
+        long x, y, left, right, top, bottom;
+        long width, height;
+        uint32_t *row;
+
+        width = buffer->area.width;
+        height = buffer->area.height;
+
+        left = width;
+        right = -1;
+        top = -1;
+        bottom = -1;
+
+        for (y = 0; y < height; y++) {
+                row = &buffer->bytes[y * width];
+
+                for (x = 0; x < width && row[x] == 0; x++) {
+                }
+
+                if (x == width)
+                        continue;
+
+                left = MIN (left, x);
+
+                for (x = width - 1; row[x] == 0; x--) {
+                }
+
+                right = MAX (right, x);
+
+                if (top < 0)
+                        top = y;
+                bottom = y;
+        }
+
+        if (top < 0)
+                return false;
+
+        visible_area->x = left;
+        visible_area->y = top;
+        visible_area->width = right - left + 1;
+        visible_area->height = bottom - top + 1;
+
+        return true;
+}
+
+/* Narrows [*start, *end] to the values of t for which
+ * offset + t * step lies within [minimum, maximum]
+ */
+static void
+constrain_span (double *start,
+                double *end,
+                double  offset,
+                double  step,
+                double  minimum,
+                double  maximum)
+{
+        double t1, t2;
+
+        if (fabs (step) < 1e-9) {
+                if (offset < minimum || offset > maximum)
+                        *end = *start - 1;
+                return;
+        }
+
+        t1 = (minimum - offset) / step;
+        t2 = (maximum - offset) / step;
+
+        *start = MAX (*start, MIN (t1, t2));
+        *end = MIN (*end, MAX (t1, t2));
+}
+
+static ply_pixel_buffer_t *
+ply_pixel_buffer_rotate_uncached (ply_pixel_buffer_t *old_buffer,
+                                  long                center_x,
+                                  long                center_y,
+                                  double              theta_offset)
 {
         ply_pixel_buffer_t *buffer;
-        int x, y;
-        double old_x, old_y;
-        int width;
-        int height;
-        uint32_t *bytes;
+        ply_rectangle_t visible_area;
+        long x, y;
+        long width;
+        long height;
+        long visible_right, visible_bottom;
+        uint32_t *bytes, *old_bytes;
+        double min_x, max_x, min_y, max_y;
+        int32_t fixed_step_x, fixed_step_y;
+
+        ply_pixel_buffer_uncompress (old_buffer);
 
         width = old_buffer->area.width;
         height = old_buffer->area.height;
 
         buffer = ply_pixel_buffer_new (width, height);
 
-        bytes = ply_pixel_buffer_get_argb32_data (buffer);
+        bytes = ply_pixel_buffer_get_bytes (buffer);
+        old_bytes = ply_pixel_buffer_get_bytes (old_buffer);
+
+        /* Only destination pixels that land within a pixel of something
+         * visible in the source can end up non-transparent, so bound
+         * the walk to that
+         */
+        if (old_buffer->row_spans != NULL)
+                visible_area = old_buffer->visible_area;
+        else if (!ply_pixel_buffer_get_visible_area (old_buffer, &visible_area))
+                return buffer;
+
+        if (visible_area.width == 0 || visible_area.height == 0)
+                return buffer;
+
+        visible_right = visible_area.x + (long) visible_area.width;
+        visible_bottom = visible_area.y + (long) visible_area.height;
+
+        min_x = MAX (visible_area.x - 1, 0);
+        max_x = MIN (visible_right, width);
+        min_y = MAX (visible_area.y - 1, 0);
+        max_y = MIN (visible_bottom, height);
 
         double d = sqrt ((center_x * center_x +
                           center_y * center_y));
@@ -1016,53 +2163,440 @@ ply_pixel_buffer_rotate (ply_pixel_buffer_t *old_buffer,
         double step_x = cos (-theta_offset);
         double step_y = sin (-theta_offset);
 
+        fixed_step_x = lround (step_x * 65536.0);
+        fixed_step_y = lround (step_y * 65536.0);
+
         for (y = 0; y < height; y++) {
-                old_y = start_y;
-                old_x = start_x;
-                start_y += step_x;
-                start_x -= step_y;
-                for (x = 0; x < width; x++) {
-                        if (old_x < 0 || old_x > width || old_y < 0 || old_y > height)
-                                bytes[x + y * width] = 0;
-                        else
-                                bytes[x + y * width] =
-                                        ply_pixel_buffer_interpolate (old_buffer, old_x, old_y);
-                        old_x += step_x;
-                        old_y += step_y;
+                double row_x, row_y, first_x, last_x;
+                int32_t old_x, old_y;
+                uint32_t *row;
+
+                /* source position of the first pixel in this row */
+                row_x = start_x - y * step_y;
+                row_y = start_y + y * step_x;
+
+                first_x = 0;
+                last_x = width - 1;
+                constrain_span (&first_x, &last_x, row_x, step_x, min_x, max_x);
+                constrain_span (&first_x, &last_x, row_y, step_y, min_y, max_y);
+
+                if (first_x > last_x)
+                        continue;
+
+                x = ceil (first_x);
+                old_x = lround ((row_x + x * step_x) * 65536.0);
+                old_y = lround ((row_y + x * step_y) * 65536.0);
+                row = &bytes[y * width];
+
+                for (; x <= (long) floor (last_x); x++) {
+                        row[x] = ply_pixels_interpolate_fixed (old_bytes, width, height, old_x, old_y);
+                        old_x += fixed_step_x;
+                        old_y += fixed_step_y;
                 }
         }
         return buffer;
 }
 
+static ply_pixel_buffer_t *
+ply_pixel_buffer_copy (ply_pixel_buffer_t *old_buffer)
+{
+        ply_pixel_buffer_t *buffer;
+
+        ply_pixel_buffer_uncompress (old_buffer);
+
+        buffer = ply_pixel_buffer_new (old_buffer->area.width, old_buffer->area.height);
+        memcpy (buffer->bytes, old_buffer->bytes,
+                old_buffer->area.width * old_buffer->area.height * sizeof(uint32_t));
+        buffer->is_opaque = old_buffer->is_opaque;
+
+        return buffer;
+}
+
+/* Finds the biggest rectangle made of the opaque runs of consecutive
+ * rows.  Every row only has its longest run recorded, so this can miss
+ * the best answer for oddly shaped images, but it's exact for the
+ * panels and boxes that matter for occlusion.
+ */
+static void
+find_opaque_area (ply_pixel_buffer_row_span_t *spans,
+                  long                         height,
+                  ply_rectangle_t             *opaque_area)
+{
+        long top, bottom, left, right;
+        unsigned long best = 0;
+
+        opaque_area->x = 0;
+        opaque_area->y = 0;
+        opaque_area->width = 0;
+        opaque_area->height = 0;
+
+        for (top = 0; top < height; top++) {
+                left = spans[top].opaque_start;
+                right = spans[top].opaque_end;
+
+                for (bottom = top; bottom < height; bottom++) {
+                        left = MAX (left, spans[bottom].opaque_start);
+                        right = MIN (right, spans[bottom].opaque_end);
+
+                        /* Nothing further down can beat what we have */
+                        if (right <= left ||
+                            (unsigned long) ((right - left) * (height - top)) <= best)
+                                break;
+
+                        if ((unsigned long) ((right - left) * (bottom - top + 1)) > best) {
+                                best = (right - left) * (bottom - top + 1);
+                                opaque_area->x = left;
+                                opaque_area->y = top;
+                                opaque_area->width = right - left;
+                                opaque_area->height = bottom - top + 1;
+                        }
+                }
+        }
+}
+
+void
+ply_pixel_buffer_analyze_transparency (ply_pixel_buffer_t *buffer)
+{
+        ply_pixel_buffer_row_span_t *spans;
+        long x, y, width, height;
+        long left, right, top, bottom;
+        bool is_opaque;
+
+        assert (buffer != NULL);
+
+        ply_pixel_buffer_uncompress (buffer);
+
+        /* spans are kept in source columns, which only line up with
+         * memory when the buffer isn't rotated
+         */
+        if (buffer->device_rotation != PLY_PIXEL_BUFFER_ROTATE_UPRIGHT)
+                return;
+
+        width = buffer->area.width;
+        height = buffer->area.height;
+
+        free (buffer->row_spans);
+        spans = calloc (height, sizeof(ply_pixel_buffer_row_span_t));
+
+        left = width;
+        right = 0;
+        top = -1;
+        bottom = -1;
+        is_opaque = true;
+
+        for (y = 0; y < height; y++) {
+                uint32_t *row = &buffer->bytes[y * width];
+                ply_pixel_buffer_row_span_t *span = &spans[y];
+                long start, end, run_start;
+
+                for (start = 0; start < width && (row[start] >> 24) == 0x00; start++) {
+                }
+
+                if (start == width) {
+                        is_opaque = false;
+                        continue;
+                }
+
+                for (end = width; (row[end - 1] >> 24) == 0x00; end--) {
+                }
+
+                span->visible_start = start;
+                span->visible_end = end;
+
+                run_start = -1;
+                for (x = start; x <= end; x++) {
+                        if (x < end && (row[x] >> 24) == 0xff) {
+                                if (run_start < 0)
+                                        run_start = x;
+                                continue;
+                        }
+
+                        if (run_start >= 0 && x - run_start > span->opaque_end - span->opaque_start) {
+                                span->opaque_start = run_start;
+                                span->opaque_end = x;
+                        }
+                        run_start = -1;
+                }
+
+                if (span->opaque_start != 0 || span->opaque_end != width)
+                        is_opaque = false;
+
+                left = MIN (left, start);
+                right = MAX (right, end);
+                if (top < 0)
+                        top = y;
+                bottom = y + 1;
+        }
+
+        buffer->row_spans = spans;
+
+        if (top < 0) {
+                buffer->visible_area.x = 0;
+                buffer->visible_area.y = 0;
+                buffer->visible_area.width = 0;
+                buffer->visible_area.height = 0;
+        } else {
+                buffer->visible_area.x = left;
+                buffer->visible_area.y = top;
+                buffer->visible_area.width = right - left;
+                buffer->visible_area.height = bottom - top;
+        }
+
+        find_opaque_area (spans, height, &buffer->opaque_area);
+
+        if (is_opaque)
+                buffer->is_opaque = true;
+}
+
+bool
+ply_pixel_buffer_get_opaque_area (ply_pixel_buffer_t *buffer,
+                                  ply_rectangle_t    *opaque_area)
+{
+        long right, bottom;
+
+        assert (buffer != NULL);
+
+        if (buffer->is_opaque) {
+                *opaque_area = buffer->logical_area;
+        } else if (buffer->row_spans != NULL) {
+                /* Round inwards, so partly covered logical pixels
+                 * don't count
+                 */
+                right = (buffer->opaque_area.x + buffer->opaque_area.width) / buffer->device_scale;
+                bottom = (buffer->opaque_area.y + buffer->opaque_area.height) / buffer->device_scale;
+                opaque_area->x = (buffer->opaque_area.x + buffer->device_scale - 1) / buffer->device_scale;
+                opaque_area->y = (buffer->opaque_area.y + buffer->device_scale - 1) / buffer->device_scale;
+                opaque_area->width = MAX (right - opaque_area->x, 0);
+                opaque_area->height = MAX (bottom - opaque_area->y, 0);
+        } else {
+                return false;
+        }
+
+        return opaque_area->width != 0 && opaque_area->height != 0;
+}
+
+static void
+ply_pixel_buffer_drop_rotation_cache (ply_pixel_buffer_t *buffer)
+{
+        int i;
+
+        for (i = 0; i < buffer->number_of_rotation_cache_entries; i++) {
+                ply_pixel_buffer_free (buffer->rotation_cache[i].rotated_buffer);
+        }
+
+        buffer->number_of_rotation_cache_entries = 0;
+        buffer->next_rotation_cache_entry = 0;
+}
+
+static void
+ply_pixel_buffer_contents_changed (ply_pixel_buffer_t *buffer)
+{
+        ply_pixel_buffer_drop_rotation_cache (buffer);
+
+        free (buffer->row_spans);
+        buffer->row_spans = NULL;
+}
+
+void
+ply_pixel_buffer_enable_rotation_cache (ply_pixel_buffer_t *buffer,
+                                        int                 angle_steps)
+{
+        assert (buffer != NULL);
+        assert (angle_steps > 0);
+
+        if (buffer->rotation_cache_angle_steps == angle_steps)
+                return;
+
+        ply_pixel_buffer_drop_rotation_cache (buffer);
+
+        if (buffer->rotation_cache == NULL)
+                buffer->rotation_cache = calloc (ROTATION_CACHE_MAX_ENTRIES,
+                                                 sizeof(ply_rotation_cache_entry_t));
+
+        buffer->rotation_cache_angle_steps = angle_steps;
+}
+
+/* Every rotated copy is the size of the buffer itself
+ */
+static int
+ply_pixel_buffer_get_rotation_cache_limit (ply_pixel_buffer_t *buffer)
+{
+        size_t buffer_size;
+
+        buffer_size = buffer->area.width * buffer->area.height * sizeof(uint32_t);
+        if (buffer_size == 0)
+                return 0;
+
+        return MIN (ROTATION_CACHE_MAX_BYTES / buffer_size, (size_t) ROTATION_CACHE_MAX_ENTRIES);
+}
+
+ply_pixel_buffer_t *
+ply_pixel_buffer_rotate (ply_pixel_buffer_t *old_buffer,
+                         long                center_x,
+                         long                center_y,
+                         double              theta_offset)
+{
+        ply_rotation_cache_entry_t *entry;
+        int angle_step, i;
+        int cache_limit;
+
+        if (old_buffer->rotation_cache == NULL)
+                return ply_pixel_buffer_rotate_uncached (old_buffer, center_x, center_y, theta_offset);
+
+        cache_limit = ply_pixel_buffer_get_rotation_cache_limit (old_buffer);
+        if (cache_limit == 0)
+                return ply_pixel_buffer_rotate_uncached (old_buffer, center_x, center_y, theta_offset);
+
+        /* Snap the angle to the nearest step so that a spinning image
+         * keeps landing on angles that have already been rendered
+         */
+        angle_step = lround (theta_offset * old_buffer->rotation_cache_angle_steps / (2 * M_PI));
+        angle_step %= old_buffer->rotation_cache_angle_steps;
+        if (angle_step < 0)
+                angle_step += old_buffer->rotation_cache_angle_steps;
+
+        for (i = 0; i < old_buffer->number_of_rotation_cache_entries; i++) {
+                entry = &old_buffer->rotation_cache[i];
+
+                if (entry->angle_step == angle_step &&
+                    entry->center_x == center_x &&
+                    entry->center_y == center_y)
+                        return ply_pixel_buffer_copy (entry->rotated_buffer);
+        }
+
+        entry = &old_buffer->rotation_cache[old_buffer->next_rotation_cache_entry];
+
+        if (old_buffer->number_of_rotation_cache_entries < cache_limit)
+                old_buffer->number_of_rotation_cache_entries++;
+        else
+                ply_pixel_buffer_free (entry->rotated_buffer);
+
+        old_buffer->next_rotation_cache_entry = (old_buffer->next_rotation_cache_entry + 1) % cache_limit;
+
+        entry->center_x = center_x;
+        entry->center_y = center_y;
+        entry->angle_step = angle_step;
+        entry->rotated_buffer = ply_pixel_buffer_rotate_uncached (old_buffer, center_x, center_y,
+                                                                  angle_step * 2 * M_PI / old_buffer->rotation_cache_angle_steps);
+
+        return ply_pixel_buffer_copy (entry->rotated_buffer);
+}
+
 ply_pixel_buffer_t *
 ply_pixel_buffer_tile (ply_pixel_buffer_t *old_buffer,
                        long                width,
                        long                height)
 {
         long x, y;
-        long old_x, old_y;
         long old_width, old_height;
         uint32_t *bytes, *old_bytes;
         ply_pixel_buffer_t *buffer;
 
+        ply_pixel_buffer_uncompress (old_buffer);
+
         buffer = ply_pixel_buffer_new (width, height);
 
-        old_bytes = ply_pixel_buffer_get_argb32_data (old_buffer);
-        bytes = ply_pixel_buffer_get_argb32_data (buffer);
+        old_bytes = ply_pixel_buffer_get_bytes (old_buffer);
+        bytes = ply_pixel_buffer_get_bytes (buffer);
 
         old_width = old_buffer->area.width;
         old_height = old_buffer->area.height;
 
-        for (y = 0; y < height; y++) {
-                old_y = y % old_height;
-                for (x = 0; x < width; x++) {
-                        old_x = x % old_width;
-                        bytes[x + y * width] = old_bytes[old_x + old_y * old_width];
+        /* Lay out one band of tiles a source row at a time... */
+        for (y = 0; y < MIN (height, old_height); y++) {
+                uint32_t *row = &bytes[y * width];
+                uint32_t *old_row = &old_bytes[y * old_width];
+
+                for (x = 0; x + old_width <= width; x += old_width) {
+                        memcpy (&row[x], old_row, old_width * sizeof(uint32_t));
                 }
+
+                memcpy (&row[x], old_row, (width - x) * sizeof(uint32_t));
+        }
+
+        /* ...then copy that band down the rest of the buffer, doubling
+         * the size of each copy as more rows become available
+         */
+        while (y < height) {
+                long rows = MIN (y, height - y);
+
+                memcpy (&bytes[y * width], bytes, rows * width * sizeof(uint32_t));
+                y += rows;
         }
+
+        buffer->is_opaque = old_buffer->is_opaque;
+
         return buffer;
 }
 
+void
+ply_pixel_buffer_fill_with_tiled_buffer (ply_pixel_buffer_t *canvas,
+                                         ply_rectangle_t    *fill_area,
+                                         ply_pixel_buffer_t *tile)
+{
+        ply_rectangle_t cropped_area;
+        long x, y, tile_width, tile_height;
+        long area_width, area_right, area_bottom;
+        double scale_factor;
+
+        assert (canvas != NULL);
+        assert (tile != NULL);
+
+        ply_pixel_buffer_uncompress (canvas);
+        ply_pixel_buffer_uncompress (tile);
+
+        if (fill_area == NULL)
+                fill_area = &canvas->logical_area;
+
+        ply_pixel_buffer_crop_area_to_clip_area (canvas, fill_area, &cropped_area);
+
+        if (cropped_area.width == 0 || cropped_area.height == 0)
+                return;
+
+        tile_width = tile->area.width;
+        tile_height = tile->area.height;
+        area_width = cropped_area.width;
+        area_right = cropped_area.x + area_width;
+        area_bottom = cropped_area.y + (long) cropped_area.height;
+
+        /* Tiles are anchored at the top left corner of the canvas, and
+         * sampled without filtering if the scales don't match
+         */
+        scale_factor = (double) tile->device_scale / canvas->device_scale;
+
+        for (y = cropped_area.y; y < area_bottom; y++) {
+                uint32_t *tile_row;
+                long tile_x, count;
+
+                tile_row = &tile->bytes[((long) (y * scale_factor) % tile_height) * tile_width];
+
+                if (tile->is_opaque && canvas->device_scale == tile->device_scale) {
+                        tile_x = cropped_area.x % tile_width;
+                        count = MIN (area_width, tile_width - tile_x);
+
+                        ply_pixel_buffer_write_row (canvas, cropped_area.x, y,
+                                                    &tile_row[tile_x], count, count);
+                        ply_pixel_buffer_write_row (canvas, cropped_area.x + count, y,
+                                                    tile_row, tile_width,
+                                                    area_width - count);
+                        continue;
+                }
+
+                for (x = cropped_area.x; x < area_right; x++) {
+                        uint32_t pixel_value;
+
+                        pixel_value = tile_row[(long) (x * scale_factor) % tile_width];
+
+                        if ((pixel_value >> 24) == 0x00)
+                                continue;
+
+                        ply_pixel_buffer_blend_value_at_pixel (canvas, x, y, pixel_value);
+                }
+        }
+
+        ply_pixel_buffer_add_updated_area (canvas, &cropped_area);
+}
+
 int
 ply_pixel_buffer_get_device_scale (ply_pixel_buffer_t *buffer)
 {
@@ -63,6 +63,14 @@ unsigned long ply_pixel_buffer_get_width (ply_pixel_buffer_t *buffer);
 unsigned long ply_pixel_buffer_get_height (ply_pixel_buffer_t *buffer);
 
 bool ply_pixel_buffer_is_opaque (ply_pixel_buffer_t *buffer);
+void ply_pixel_buffer_analyze_transparency (ply_pixel_buffer_t *buffer);
+/* Gives a rectangle, in logical pixels, that is known to be completely
+ * opaque; only available for opaque or analyzed buffers
+ */
+bool ply_pixel_buffer_get_opaque_area (ply_pixel_buffer_t *buffer,
+                                       ply_rectangle_t    *opaque_area);
+bool ply_pixel_buffer_compress (ply_pixel_buffer_t *buffer);
+bool ply_pixel_buffer_is_compressed (ply_pixel_buffer_t *buffer);
 void ply_pixel_buffer_set_opaque (ply_pixel_buffer_t *buffer,
                                   bool                is_opaque);
 
@@ -148,10 +156,15 @@ ply_pixel_buffer_t *ply_pixel_buffer_rotate (ply_pixel_buffer_t *old_buffer,
                                              long                center_x,
                                              long                center_y,
                                              double              theta_offset);
+void ply_pixel_buffer_enable_rotation_cache (ply_pixel_buffer_t *buffer,
+                                             int                 angle_steps);
 
 ply_pixel_buffer_t *ply_pixel_buffer_tile (ply_pixel_buffer_t *old_buffer,
                                            long                width,
                                            long                height);
+void ply_pixel_buffer_fill_with_tiled_buffer (ply_pixel_buffer_t *canvas,
+                                              ply_rectangle_t    *fill_area,
+                                              ply_pixel_buffer_t *tile);
 
 #endif
 
@@ -45,6 +45,7 @@
 #include "ply-array.h"
 #include "ply-logger.h"
 #include "ply-image.h"
+#include "ply-image-cache.h"
 #include "ply-pixel-buffer.h"
 #include "ply-utils.h"
 
@@ -106,7 +107,7 @@ ply_animation_remove_frames (ply_animation_t *animation)
 
         frames = (ply_pixel_buffer_t **) ply_array_steal_pointer_elements (animation->frames);
         for (i = 0; frames[i] != NULL; i++) {
-                ply_pixel_buffer_free (frames[i]);
+                ply_image_cache_release_buffer (frames[i]);
         }
         free (frames);
 }
@@ -201,17 +202,15 @@ static bool
 ply_animation_add_frame (ply_animation_t *animation,
                          const char      *filename)
 {
-        ply_image_t *image;
         ply_pixel_buffer_t *frame;
 
-        image = ply_image_new (filename);
+        frame = ply_image_cache_get_buffer (filename);
 
-        if (!ply_image_load (image)) {
-                ply_image_free (image);
+        if (frame == NULL)
                 return false;
-        }
 
-        frame = ply_image_convert_to_pixel_buffer (image);
+        /* Frames are mostly transparent, so store them run-length encoded */
+        ply_pixel_buffer_compress (frame);
 
         ply_array_add_pointer_element (animation->frames, frame);
 
@@ -0,0 +1,145 @@
+/* ply-image-cache.c - shared cache of decoded images
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#include "config.h"
+#include "ply-image-cache.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "ply-hashtable.h"
+#include "ply-image.h"
+#include "ply-logger.h"
+
+/* Splash plugins create a view per display, and each view loads its
+ * own throbber and animation frames from the same files.  Rather than
+ * decode and hold every frame once per head, views share one copy of
+ * each file for as long as any of them is using it.
+ */
+typedef struct
+{
+        char               *filename;
+        struct timespec     modification_time;
+        off_t               size;
+        ply_pixel_buffer_t *buffer;
+        int                 reference_count;
+} ply_image_cache_entry_t;
+
+static ply_hashtable_t *entries_by_filename;
+static ply_hashtable_t *entries_by_buffer;
+
+static bool
+ply_image_cache_entry_is_current (ply_image_cache_entry_t *entry,
+                                  struct stat             *file_info)
+{
+        return entry->size == file_info->st_size &&
+               entry->modification_time.tv_sec == file_info->st_mtim.tv_sec &&
+               entry->modification_time.tv_nsec == file_info->st_mtim.tv_nsec;
+}
+
+ply_pixel_buffer_t *
+ply_image_cache_get_buffer (const char *filename)
+{
+        ply_image_cache_entry_t *entry;
+        ply_image_t *image;
+        struct stat file_info;
+
+        assert (filename != NULL);
+
+        if (stat (filename, &file_info) < 0)
+                return NULL;
+
+        if (entries_by_filename == NULL) {
+                entries_by_filename = ply_hashtable_new (ply_hashtable_string_hash,
+                                                         ply_hashtable_string_compare);
+                entries_by_buffer = ply_hashtable_new (ply_hashtable_direct_hash,
+                                                       ply_hashtable_direct_compare);
+        }
+
+        entry = ply_hashtable_lookup (entries_by_filename, (void *) filename);
+
+        if (entry != NULL) {
+                if (ply_image_cache_entry_is_current (entry, &file_info)) {
+                        entry->reference_count++;
+                        return entry->buffer;
+                }
+
+                /* The file changed on disk.  Whoever still holds the old
+                 * copy keeps it, but new callers get the new contents.
+                 */
+                ply_hashtable_remove (entries_by_filename, entry->filename);
+        }
+
+        image = ply_image_new (filename);
+
+        if (!ply_image_load (image)) {
+                ply_image_free (image);
+                return NULL;
+        }
+
+        entry = calloc (1, sizeof(ply_image_cache_entry_t));
+        entry->filename = strdup (filename);
+        entry->modification_time = file_info.st_mtim;
+        entry->size = file_info.st_size;
+        entry->buffer = ply_image_convert_to_pixel_buffer (image);
+        entry->reference_count = 1;
+
+        ply_hashtable_insert (entries_by_filename, entry->filename, entry);
+        ply_hashtable_insert (entries_by_buffer, entry->buffer, entry);
+
+        return entry->buffer;
+}
+
+void
+ply_image_cache_release_buffer (ply_pixel_buffer_t *buffer)
+{
+        ply_image_cache_entry_t *entry;
+
+        if (buffer == NULL)
+                return;
+
+        assert (entries_by_buffer != NULL);
+
+        entry = ply_hashtable_lookup (entries_by_buffer, buffer);
+        assert (entry != NULL);
+
+        entry->reference_count--;
+
+        if (entry->reference_count > 0)
+                return;
+
+        ply_hashtable_remove (entries_by_buffer, buffer);
+
+        if (ply_hashtable_lookup (entries_by_filename, entry->filename) == entry)
+                ply_hashtable_remove (entries_by_filename, entry->filename);
+
+        ply_pixel_buffer_free (entry->buffer);
+        free (entry->filename);
+        free (entry);
+
+        if (ply_hashtable_get_size (entries_by_buffer) == 0) {
+                ply_hashtable_free (entries_by_filename);
+                ply_hashtable_free (entries_by_buffer);
+                entries_by_filename = NULL;
+                entries_by_buffer = NULL;
+        }
+}
+/* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
@@ -0,0 +1,33 @@
+/* ply-image-cache.h - shared cache of decoded images
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifndef PLY_IMAGE_CACHE_H
+#define PLY_IMAGE_CACHE_H
+
+#include "ply-pixel-buffer.h"
+
+#ifndef PLY_HIDE_FUNCTION_DECLARATIONS
+/* Returns the decoded contents of filename, shared with anyone else
+ * who asked for the same unchanged file.  The buffer must be treated
+ * as read-only and handed back with ply_image_cache_release_buffer.
+ */
+ply_pixel_buffer_t *ply_image_cache_get_buffer (const char *filename);
+void ply_image_cache_release_buffer (ply_pixel_buffer_t *buffer);
+#endif
+
+#endif /* PLY_IMAGE_CACHE_H */
+/* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
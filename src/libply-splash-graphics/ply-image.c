@@ -191,6 +191,12 @@ ply_image_load (ply_image_t *image)
         fclose (fp);
         png_destroy_read_struct (&png, &info, NULL);
 
+        /* Note which parts of the image are opaque or transparent while
+         * the pixels are still warm in cache, so drawing it later can
+         * copy or skip those parts instead of blending them
+         */
+        ply_pixel_buffer_analyze_transparency (image->buffer);
+
         return true;
 }
 
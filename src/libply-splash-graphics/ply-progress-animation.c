@@ -45,6 +45,7 @@
 #include "ply-array.h"
 #include "ply-logger.h"
 #include "ply-image.h"
+#include "ply-image-cache.h"
 #include "ply-utils.h"
 
 #include <linux/kd.h>
@@ -116,11 +117,11 @@ static void
 ply_progress_animation_remove_frames (ply_progress_animation_t *progress_animation)
 {
         int i;
-        ply_image_t **frames;
+        ply_pixel_buffer_t **frames;
 
-        frames = (ply_image_t **) ply_array_steal_pointer_elements (progress_animation->frames);
+        frames = (ply_pixel_buffer_t **) ply_array_steal_pointer_elements (progress_animation->frames);
         for (i = 0; frames[i] != NULL; i++) {
-                ply_image_free (frames[i]);
+                ply_image_cache_release_buffer (frames[i]);
         }
         free (frames);
 }
@@ -140,20 +141,20 @@ ply_progress_animation_free (ply_progress_animation_t *progress_animation)
 }
 
 static void
-image_fade_merge (ply_image_t *frame0,
-                  ply_image_t *frame1,
-                  float        fade,
-                  int          width,
-                  int          height,
-                  uint32_t    *reply_data)
+image_fade_merge (ply_pixel_buffer_t *frame0,
+                  ply_pixel_buffer_t *frame1,
+                  float               fade,
+                  int                 width,
+                  int                 height,
+                  uint32_t           *reply_data)
 {
-        int frame0_width = ply_image_get_width (frame0);
-        int frame0_height = ply_image_get_height (frame0);
-        int frame1_width = ply_image_get_width (frame1);
-        int frame1_height = ply_image_get_height (frame1);
+        int frame0_width = ply_pixel_buffer_get_width (frame0);
+        int frame0_height = ply_pixel_buffer_get_height (frame0);
+        int frame1_width = ply_pixel_buffer_get_width (frame1);
+        int frame1_height = ply_pixel_buffer_get_height (frame1);
 
-        uint32_t *frame0_data = ply_image_get_data (frame0);
-        uint32_t *frame1_data = ply_image_get_data (frame1);
+        uint32_t *frame0_data = ply_pixel_buffer_get_argb32_data (frame0);
+        uint32_t *frame1_data = ply_pixel_buffer_get_argb32_data (frame1);
 
         int x, y, i;
 
@@ -205,7 +206,7 @@ ply_progress_animation_draw (ply_progress_animation_t *progress_animation)
 {
         int number_of_frames;
         int frame_number;
-        ply_image_t *const *frames;
+        ply_pixel_buffer_t *const *frames;
         ply_pixel_buffer_t *previous_frame_buffer, *current_frame_buffer;
 
         if (progress_animation->is_hidden)
@@ -225,11 +226,11 @@ ply_progress_animation_draw (ply_progress_animation_t *progress_animation)
                 progress_animation->transition_start_time = ply_get_timestamp ();
         }
 
-        frames = (ply_image_t *const *) ply_array_get_pointer_elements (progress_animation->frames);
+        frames = (ply_pixel_buffer_t *const *) ply_array_get_pointer_elements (progress_animation->frames);
 
         progress_animation->frame_area.x = progress_animation->area.x;
         progress_animation->frame_area.y = progress_animation->area.y;
-        current_frame_buffer = ply_image_get_buffer (frames[frame_number]);
+        current_frame_buffer = frames[frame_number];
 
         if (progress_animation->is_transitioning) {
                 double now;
@@ -246,8 +247,8 @@ ply_progress_animation_draw (ply_progress_animation_t *progress_animation)
                 fade_percentage = CLAMP (fade_percentage, 0.0, 1.0);
 
                 if (progress_animation->transition == PLY_PROGRESS_ANIMATION_TRANSITION_MERGE_FADE) {
-                        width = MAX (ply_image_get_width (frames[frame_number]), ply_image_get_width (frames[frame_number - 1]));
-                        height = MAX (ply_image_get_height (frames[frame_number]), ply_image_get_height (frames[frame_number - 1]));
+                        width = MAX (ply_pixel_buffer_get_width (frames[frame_number]), ply_pixel_buffer_get_width (frames[frame_number - 1]));
+                        height = MAX (ply_pixel_buffer_get_height (frames[frame_number]), ply_pixel_buffer_get_height (frames[frame_number - 1]));
                         progress_animation->frame_area.width = width;
                         progress_animation->frame_area.height = height;
 
@@ -257,11 +258,11 @@ ply_progress_animation_draw (ply_progress_animation_t *progress_animation)
 
                         image_fade_merge (frames[frame_number - 1], frames[frame_number], fade_percentage, width, height, faded_data);
                 } else {
-                        previous_frame_buffer = ply_image_get_buffer (frames[frame_number - 1]);
+                        previous_frame_buffer = frames[frame_number - 1];
                         if (progress_animation->transition == PLY_PROGRESS_ANIMATION_TRANSITION_FADE_OVER) {
                                 ply_pixel_buffer_free (progress_animation->last_rendered_frame);
-                                progress_animation->last_rendered_frame = ply_pixel_buffer_new (ply_image_get_width (frames[frame_number - 1]),
-                                                                                                ply_image_get_height (frames[frame_number - 1]));
+                                progress_animation->last_rendered_frame = ply_pixel_buffer_new (ply_pixel_buffer_get_width (frames[frame_number - 1]),
+                                                                                                ply_pixel_buffer_get_height (frames[frame_number - 1]));
                                 ply_pixel_buffer_fill_with_buffer (progress_animation->last_rendered_frame,
                                                                    previous_frame_buffer,
                                                                    0,
@@ -281,15 +282,15 @@ ply_progress_animation_draw (ply_progress_animation_t *progress_animation)
                                                                       0,
                                                                       fade_percentage);
 
-                        width = MAX (ply_image_get_width (frames[frame_number]), ply_image_get_width (frames[frame_number - 1]));
-                        height = MAX (ply_image_get_height (frames[frame_number]), ply_image_get_height (frames[frame_number - 1]));
+                        width = MAX (ply_pixel_buffer_get_width (frames[frame_number]), ply_pixel_buffer_get_width (frames[frame_number - 1]));
+                        height = MAX (ply_pixel_buffer_get_height (frames[frame_number]), ply_pixel_buffer_get_height (frames[frame_number - 1]));
                         progress_animation->frame_area.width = width;
                         progress_animation->frame_area.height = height;
                 }
         } else {
                 ply_pixel_buffer_free (progress_animation->last_rendered_frame);
-                progress_animation->frame_area.width = ply_image_get_width (frames[frame_number]);
-                progress_animation->frame_area.height = ply_image_get_height (frames[frame_number]);
+                progress_animation->frame_area.width = ply_pixel_buffer_get_width (frames[frame_number]);
+                progress_animation->frame_area.height = ply_pixel_buffer_get_height (frames[frame_number]);
                 progress_animation->last_rendered_frame = ply_pixel_buffer_new (progress_animation->frame_area.width,
                                                                                 progress_animation->frame_area.height);
 
@@ -312,19 +313,17 @@ static bool
 ply_progress_animation_add_frame (ply_progress_animation_t *progress_animation,
                                   const char               *filename)
 {
-        ply_image_t *image;
+        ply_pixel_buffer_t *frame;
 
-        image = ply_image_new (filename);
+        frame = ply_image_cache_get_buffer (filename);
 
-        if (!ply_image_load (image)) {
-                ply_image_free (image);
+        if (frame == NULL)
                 return false;
-        }
 
-        ply_array_add_pointer_element (progress_animation->frames, image);
+        ply_array_add_pointer_element (progress_animation->frames, frame);
 
-        progress_animation->area.width = MAX (progress_animation->area.width, (size_t) ply_image_get_width (image));
-        progress_animation->area.height = MAX (progress_animation->area.height, (size_t) ply_image_get_height (image));
+        progress_animation->area.width = MAX (progress_animation->area.width, (size_t) ply_pixel_buffer_get_width (frame));
+        progress_animation->area.height = MAX (progress_animation->area.height, (size_t) ply_pixel_buffer_get_height (frame));
 
         return true;
 }
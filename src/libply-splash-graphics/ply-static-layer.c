@@ -0,0 +1,151 @@
+/* ply-static-layer.c - cached rendering of content that rarely changes
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#include "config.h"
+#include "ply-static-layer.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "ply-logger.h"
+#include "ply-rectangle.h"
+
+/* Splash backgrounds are made of gradients, tiles and blended images
+ * that stay the same from frame to frame, while only the animations on
+ * top of them move.  A static layer renders that content once into a
+ * buffer of its own, and afterwards damaged areas are restored by
+ * copying rows out of it.
+ */
+struct _ply_static_layer
+{
+        ply_static_layer_draw_handler_t draw_handler;
+        void                           *user_data;
+
+        ply_pixel_buffer_t             *buffer;
+};
+
+ply_static_layer_t *
+ply_static_layer_new (ply_static_layer_draw_handler_t draw_handler,
+                      void                           *user_data)
+{
+        ply_static_layer_t *layer;
+
+        assert (draw_handler != NULL);
+
+        layer = calloc (1, sizeof(ply_static_layer_t));
+        layer->draw_handler = draw_handler;
+        layer->user_data = user_data;
+
+        return layer;
+}
+
+void
+ply_static_layer_invalidate (ply_static_layer_t *layer)
+{
+        if (layer->buffer == NULL)
+                return;
+
+        ply_pixel_buffer_free (layer->buffer);
+        layer->buffer = NULL;
+}
+
+void
+ply_static_layer_free (ply_static_layer_t *layer)
+{
+        if (layer == NULL)
+                return;
+
+        ply_static_layer_invalidate (layer);
+        free (layer);
+}
+
+static bool
+ply_static_layer_matches (ply_static_layer_t *layer,
+                          ply_pixel_buffer_t *buffer)
+{
+        ply_rectangle_t layer_area, buffer_area;
+
+        if (layer->buffer == NULL)
+                return false;
+
+        if (ply_pixel_buffer_get_device_scale (layer->buffer) !=
+            ply_pixel_buffer_get_device_scale (buffer))
+                return false;
+
+        ply_pixel_buffer_get_size (layer->buffer, &layer_area);
+        ply_pixel_buffer_get_size (buffer, &buffer_area);
+
+        return layer_area.width == buffer_area.width &&
+               layer_area.height == buffer_area.height;
+}
+
+static void
+ply_static_layer_render (ply_static_layer_t *layer,
+                         ply_pixel_buffer_t *buffer)
+{
+        ply_rectangle_t area;
+        int scale;
+
+        ply_static_layer_invalidate (layer);
+
+        ply_pixel_buffer_get_size (buffer, &area);
+        scale = ply_pixel_buffer_get_device_scale (buffer);
+
+        ply_trace ("rendering %lux%lu static layer", area.width, area.height);
+
+        /* The cached copy is always upright; copying it back out is
+         * what takes care of any rotation of the target
+         */
+        layer->buffer = ply_pixel_buffer_new (area.width * scale,
+                                              area.height * scale);
+        ply_pixel_buffer_set_device_scale (layer->buffer, scale);
+
+        layer->draw_handler (layer->user_data, layer->buffer,
+                             0, 0, area.width, area.height);
+
+        /* Usually the layer ends up fully opaque, and then restoring
+         * it is a plain row copy
+         */
+        ply_pixel_buffer_analyze_transparency (layer->buffer);
+}
+
+void
+ply_static_layer_draw_area (ply_static_layer_t *layer,
+                            ply_pixel_buffer_t *buffer,
+                            int                 x,
+                            int                 y,
+                            int                 width,
+                            int                 height)
+{
+        ply_rectangle_t area;
+        int scale;
+
+        if (!ply_static_layer_matches (layer, buffer))
+                ply_static_layer_render (layer, buffer);
+
+        /* Clip areas for buffer to buffer fills are in device pixels */
+        scale = ply_pixel_buffer_get_device_scale (buffer);
+        area.x = x * scale;
+        area.y = y * scale;
+        area.width = width * scale;
+        area.height = height * scale;
+
+        ply_pixel_buffer_fill_with_buffer_with_clip (buffer, layer->buffer,
+                                                     0, 0, &area);
+}
+/* vim: set ts=4 sw=4 et ai ci cino={.5s,^-2,+.5s,t0,g0,e-2,n-2,p2s,(0,=.5s,:.5s */
@@ -0,0 +1,52 @@
+/* ply-static-layer.h - cached rendering of content that rarely changes
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifndef PLY_STATIC_LAYER_H
+#define PLY_STATIC_LAYER_H
+
+#include "ply-pixel-buffer.h"
+
+typedef struct _ply_static_layer ply_static_layer_t;
+
+typedef void (*ply_static_layer_draw_handler_t) (void               *user_data,
+                                                 ply_pixel_buffer_t *buffer,
+                                                 int                 x,
+                                                 int                 y,
+                                                 int                 width,
+                                                 int                 height);
+
+#ifndef PLY_HIDE_FUNCTION_DECLARATIONS
+ply_static_layer_t *ply_static_layer_new (ply_static_layer_draw_handler_t draw_handler,
+                                          void                           *user_data);
+void ply_static_layer_free (ply_static_layer_t *layer);
+
+/* Throws away the cached rendering, so the draw handler gets called
+ * again the next time the layer is drawn.  The cache is also rebuilt
+ * on its own whenever the target buffer changes size or scale.
+ */
+void ply_static_layer_invalidate (ply_static_layer_t *layer);
+
+void ply_static_layer_draw_area (ply_static_layer_t *layer,
+                                 ply_pixel_buffer_t *buffer,
+                                 int                 x,
+                                 int                 y,
+                                 int                 width,
+                                 int                 height);
+#endif
+
+#endif /* PLY_STATIC_LAYER_H */
+/* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
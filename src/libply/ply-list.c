@@ -279,6 +279,13 @@ ply_list_get_next_node (ply_list_t      *list,
         return node->next;
 }
 
+ply_list_node_t *
+ply_list_get_previous_node (ply_list_t      *list,
+                            ply_list_node_t *node)
+{
+        return node->previous;
+}
+
 static void
 ply_list_sort_swap (void **element_a,
                     void **element_b)
@@ -55,6 +55,8 @@ ply_list_node_t *ply_list_get_nth_node (ply_list_t *list,
                                         int         index);
 ply_list_node_t *ply_list_get_next_node (ply_list_t      *list,
                                          ply_list_node_t *node);
+ply_list_node_t *ply_list_get_previous_node (ply_list_t      *list,
+                                             ply_list_node_t *node);
 void *ply_list_node_get_data (ply_list_node_t *node);
 #endif
 
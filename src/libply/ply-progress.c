@@ -28,15 +28,19 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <math.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 
+#include "ply-hashtable.h"
 #include "ply-list.h"
 #include "ply-logger.h"
 #include "ply-progress.h"
@@ -50,27 +54,72 @@
 #define DEFAULT_BOOT_DURATION 60.0
 #endif
 
+#define PLY_PROGRESS_CACHE_MAGIC "PLYPROG"
+#define PLY_PROGRESS_CACHE_VERSION 1
+
+typedef struct
+{
+        double   time;
+        char    *string;
+        uint32_t disabled : 1;
+} ply_progress_message_t;
 
 struct _ply_progress
 {
-        double      start_time;
-        double      pause_time;
-        double      scalar;
-        double      last_percentage;
-        double      last_percentage_time;
-        double      dead_time;
-        double      next_message_percentage;
-        ply_list_t *current_message_list;
-        ply_list_t *previous_message_list;
-        uint32_t    paused : 1;
+        double                   start_time;
+        double                   pause_time;
+        double                   scalar;
+        double                   last_percentage;
+        double                   last_percentage_time;
+        double                   dead_time;
+        double                   next_message_percentage;
+        ply_list_t              *current_message_list;
+        ply_hashtable_t         *current_messages;
+
+        /* messages from the last boot, sorted by time */
+        ply_progress_message_t **previous_messages;
+        int                      number_of_previous_messages;
+        int                      previous_messages_capacity;
+        ply_hashtable_t         *previous_message_index;
+
+        uint32_t                 paused : 1;
 };
 
+/* The cache file is laid out so it can be used straight from a mapping:
+ * a header, a table of entries, then the NUL terminated strings the
+ * entries point into.  It's written in host byte order, since it never
+ * leaves the machine that wrote it.
+ */
+typedef struct
+{
+        char     magic[8];
+        uint32_t version;
+        uint32_t number_of_entries;
+} ply_progress_cache_header_t;
+
 typedef struct
 {
         double   time;
-        char    *string;
-        uint32_t disabled : 1;
-} ply_progress_message_t;
+        uint32_t string_offset;
+        uint32_t string_size;
+} ply_progress_cache_entry_t;
+
+static unsigned int
+hash_message_string (void *element)
+{
+        const unsigned char *p;
+        unsigned int hash = 2166136261u;
+
+        /* FNV-1a; unit names share long prefixes, which the generic
+         * string hash clusters badly on
+         */
+        for (p = element; *p != '\0'; p++) {
+                hash ^= *p;
+                hash *= 16777619u;
+        }
+
+        return hash;
+}
 
 ply_progress_t *
 ply_progress_new (void)
@@ -86,7 +135,10 @@ ply_progress_new (void)
         progress->dead_time = 0.0;
         progress->next_message_percentage = 0.25;
         progress->current_message_list = ply_list_new ();
-        progress->previous_message_list = ply_list_new ();
+        progress->current_messages = ply_hashtable_new (hash_message_string,
+                                                        ply_hashtable_string_compare);
+        progress->previous_message_index = ply_hashtable_new (hash_message_string,
+                                                              ply_hashtable_string_compare);
         progress->paused = false;
         return progress;
 }
@@ -95,6 +147,7 @@ void
 ply_progress_free (ply_progress_t *progress)
 {
         ply_list_node_t *node;
+        int i;
 
         node = ply_list_get_first_node (progress->current_message_list);
 
@@ -108,127 +161,269 @@ ply_progress_free (ply_progress_t *progress)
                 node = next_node;
         }
         ply_list_free (progress->current_message_list);
+        ply_hashtable_free (progress->current_messages);
 
-        node = ply_list_get_first_node (progress->previous_message_list);
-
-        while (node) {
-                ply_list_node_t *next_node;
-                ply_progress_message_t *message = ply_list_node_get_data (node);
-                next_node = ply_list_get_next_node (progress->previous_message_list, node);
-
-                free (message->string);
-                free (message);
-                node = next_node;
+        for (i = 0; i < progress->number_of_previous_messages; i++) {
+                free (progress->previous_messages[i]->string);
+                free (progress->previous_messages[i]);
         }
-        ply_list_free (progress->previous_message_list);
+        free (progress->previous_messages);
+        ply_hashtable_free (progress->previous_message_index);
         free (progress);
         return;
 }
 
-
 static ply_progress_message_t *
-ply_progress_message_search (ply_list_t *message_list, const char *string)
+ply_progress_message_search_next (ply_progress_t *progress,
+                                  double          time)
 {
-        ply_list_node_t *node;
+        int low, high;
+
+        /* find the first message strictly later than time */
+        low = 0;
+        high = progress->number_of_previous_messages;
+        while (low < high) {
+                int middle = low + (high - low) / 2;
+
+                if (progress->previous_messages[middle]->time > time)
+                        high = middle;
+                else
+                        low = middle + 1;
+        }
 
-        node = ply_list_get_first_node (message_list);
+        if (low == progress->number_of_previous_messages)
+                return NULL;
 
-        while (node) {
-                ply_progress_message_t *message = ply_list_node_get_data (node);
-                if (strcmp (string, message->string) == 0)
-                        return message;
-                node = ply_list_get_next_node (message_list, node);
+        return progress->previous_messages[low];
+}
+
+static void
+ply_progress_add_previous_message (ply_progress_t *progress,
+                                   double          time,
+                                   char           *string)
+{
+        ply_progress_message_t *message;
+
+        if (progress->number_of_previous_messages == progress->previous_messages_capacity) {
+                progress->previous_messages_capacity = MAX (64, progress->previous_messages_capacity * 2);
+                progress->previous_messages = realloc (progress->previous_messages,
+                                                       progress->previous_messages_capacity * sizeof(ply_progress_message_t *));
         }
-        return NULL;
+
+        message = calloc (1, sizeof(ply_progress_message_t));
+        message->time = time;
+        message->string = string;
+        progress->previous_messages[progress->number_of_previous_messages++] = message;
+
+        /* If a message shows up more than once, the first one wins */
+        if (ply_hashtable_lookup (progress->previous_message_index, string) == NULL)
+                ply_hashtable_insert (progress->previous_message_index, string, message);
 }
 
+static int
+compare_message_times (const void *a,
+                       const void *b)
+{
+        const ply_progress_message_t *message_a = *(ply_progress_message_t *const *) a;
+        const ply_progress_message_t *message_b = *(ply_progress_message_t *const *) b;
+
+        if (message_a->time < message_b->time)
+                return -1;
+        if (message_a->time > message_b->time)
+                return 1;
+        return 0;
+}
 
-static ply_progress_message_t *
-ply_progress_message_search_next (ply_list_t *message_list, double time)
+static bool
+ply_progress_load_binary_cache (ply_progress_t *progress,
+                                const char     *data,
+                                size_t          size)
 {
-        ply_list_node_t *node;
+        const ply_progress_cache_header_t *header;
+        const ply_progress_cache_entry_t *entries;
+        const char *strings;
+        size_t strings_size;
+        uint32_t i;
 
-        node = ply_list_get_first_node (message_list);
-        ply_progress_message_t *best = NULL;
-        while (node) {
-                ply_progress_message_t *message = ply_list_node_get_data (node);
-                if (message->time > time && (!best || message->time < best->time))
-                        best = message;
-                node = ply_list_get_next_node (message_list, node);
+        header = (const ply_progress_cache_header_t *) data;
+
+        if (header->version != PLY_PROGRESS_CACHE_VERSION) {
+                ply_trace ("progress cache has unknown version %u", header->version);
+                return false;
+        }
+
+        if (header->number_of_entries > (size - sizeof(*header)) / sizeof(*entries)) {
+                ply_trace ("progress cache is truncated");
+                return false;
+        }
+
+        entries = (const ply_progress_cache_entry_t *) (data + sizeof(*header));
+        strings = (const char *) (entries + header->number_of_entries);
+        strings_size = size - (strings - data);
+
+        for (i = 0; i < header->number_of_entries; i++) {
+                if (entries[i].string_offset >= strings_size ||
+                    entries[i].string_size >= strings_size - entries[i].string_offset ||
+                    strings[entries[i].string_offset + entries[i].string_size] != '\0') {
+                        ply_trace ("progress cache entry %u is corrupt", i);
+                        return false;
+                }
+        }
+
+        for (i = 0; i < header->number_of_entries; i++)
+                ply_progress_add_previous_message (progress, entries[i].time,
+                                                   strndup (strings + entries[i].string_offset,
+                                                            entries[i].string_size));
+
+        return true;
+}
+
+static void
+ply_progress_load_text_cache (ply_progress_t *progress,
+                              const char     *data,
+                              size_t          size)
+{
+        const char *end = data + size;
+
+        /* older versions wrote one "time:message" line per message */
+        while (data < end) {
+                const char *newline, *colon;
+                char *time_end;
+                double time;
+
+                newline = memchr (data, '\n', end - data);
+                if (newline == NULL)
+                        newline = end;
+
+                colon = memchr (data, ':', newline - data);
+                if (colon == NULL)
+                        break;
+
+                time = strtod (data, &time_end);
+                if (time_end != colon)
+                        break;
+
+                ply_progress_add_previous_message (progress, time,
+                                                   strndup (colon + 1, newline - colon - 1));
+                data = newline + 1;
         }
-        return best;
 }
 
 void
 ply_progress_load_cache (ply_progress_t *progress,
                          const char     *filename)
 {
-        FILE *fp;
+        struct stat file_info;
+        char *data;
+        int fd;
 
-        fp = fopen (filename, "r");
-        if (fp == NULL)
+        fd = open (filename, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
                 return;
 
-        while (1) {
-                int items_matched;
-                double time;
-                int string_size = 81;
-                char *string;
-                char colon;
-                int i = 0;
-
-                items_matched = fscanf (fp, "%lf", &time);
-                if (items_matched < 1) break;
-                items_matched = fscanf (fp, "%c", &colon);
-                if (items_matched < 1 || colon != ':') break;
-
-                string = malloc (sizeof(char) * string_size);
-                while (1) {
-                        if (i >= string_size) {
-                                string_size *= 2;
-                                string = realloc (string, sizeof(char) * string_size);
-                        }
-                        items_matched = fscanf (fp, "%c", &string[i]);
-                        if (items_matched < 1 || string[i] == '\n') {
-                                string[i] = '\0';
-                                break;
-                        }
-                        i++;
-                }
-                ply_progress_message_t *message = malloc (sizeof(ply_progress_message_t));
-                message->time = time;
-                message->string = string;
-                ply_list_append_data (progress->previous_message_list, message);
+        if (fstat (fd, &file_info) < 0 || file_info.st_size == 0) {
+                close (fd);
+                return;
         }
-        fclose (fp);
+
+        data = mmap (NULL, file_info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close (fd);
+
+        if (data == MAP_FAILED) {
+                ply_trace ("could not map progress cache %s: %m", filename);
+                return;
+        }
+
+        if ((size_t) file_info.st_size >= sizeof(ply_progress_cache_header_t) &&
+            memcmp (data, PLY_PROGRESS_CACHE_MAGIC, sizeof(PLY_PROGRESS_CACHE_MAGIC)) == 0)
+                ply_progress_load_binary_cache (progress, data, file_info.st_size);
+        else
+                ply_progress_load_text_cache (progress, data, file_info.st_size);
+
+        munmap (data, file_info.st_size);
+
+        qsort (progress->previous_messages, progress->number_of_previous_messages,
+               sizeof(ply_progress_message_t *), compare_message_times);
 }
 
 void
 ply_progress_save_cache (ply_progress_t *progress,
                          const char     *filename)
 {
-        FILE *fp;
+        ply_progress_cache_header_t header = { PLY_PROGRESS_CACHE_MAGIC };
+        ply_progress_cache_entry_t *entries;
         ply_list_node_t *node;
         double cur_time = ply_progress_get_time (progress);
+        char *temporary_filename;
+        uint32_t string_offset;
+        bool saved;
+        int fd;
+        int i;
 
         ply_trace ("saving progress cache to %s", filename);
 
-        fp = fopen (filename, "w");
-        if (fp == NULL) {
+        entries = calloc (ply_list_get_length (progress->current_message_list) + 1,
+                          sizeof(ply_progress_cache_entry_t));
+
+        i = 0;
+        string_offset = 0;
+        for (node = ply_list_get_first_node (progress->current_message_list);
+             node != NULL;
+             node = ply_list_get_next_node (progress->current_message_list, node)) {
+                ply_progress_message_t *message = ply_list_node_get_data (node);
+
+                if (message->disabled)
+                        continue;
+
+                entries[i].time = message->time / cur_time;
+                entries[i].string_offset = string_offset;
+                entries[i].string_size = strlen (message->string);
+                string_offset += entries[i].string_size + 1;
+                i++;
+        }
+
+        header.version = PLY_PROGRESS_CACHE_VERSION;
+        header.number_of_entries = i;
+
+        /* Write next to the real file and rename over it, so a crash
+         * can't leave a half written cache behind
+         */
+        asprintf (&temporary_filename, "%s.XXXXXX", filename);
+        fd = mkostemp (temporary_filename, O_CLOEXEC);
+        if (fd < 0) {
                 ply_trace ("failed to save cache: %m");
+                free (temporary_filename);
+                free (entries);
                 return;
         }
 
-        node = ply_list_get_first_node (progress->current_message_list);
+        saved = ply_write (fd, &header, sizeof(header)) &&
+                (i == 0 || ply_write (fd, entries, i * sizeof(ply_progress_cache_entry_t)));
 
-        while (node) {
+        for (node = ply_list_get_first_node (progress->current_message_list);
+             saved && node != NULL;
+             node = ply_list_get_next_node (progress->current_message_list, node)) {
                 ply_progress_message_t *message = ply_list_node_get_data (node);
-                double percentage = message->time / cur_time;
+
                 if (!message->disabled)
-                        fprintf (fp, "%.3lf:%s\n", percentage, message->string);
-                node = ply_list_get_next_node (progress->current_message_list, node);
+                        saved = ply_write (fd, message->string, strlen (message->string) + 1);
         }
-        fclose (fp);
+
+        if (saved)
+                saved = fchmod (fd, 0644) == 0 && fsync (fd) == 0;
+
+        close (fd);
+
+        if (saved)
+                saved = rename (temporary_filename, filename) == 0;
+
+        if (!saved) {
+                ply_trace ("failed to save cache: %m");
+                unlink (temporary_filename);
+        }
+
+        free (temporary_filename);
+        free (entries);
 }
 
 
@@ -299,14 +494,14 @@ ply_progress_status_update (ply_progress_t *progress,
 {
         ply_progress_message_t *message, *message_next;
 
-        message = ply_progress_message_search (progress->current_message_list, status);
+        message = ply_hashtable_lookup (progress->current_messages, (void *) status);
         if (message) {
                 message->disabled = true;
         }                                               /* Remove duplicates as they confuse things*/
         else {
-                message = ply_progress_message_search (progress->previous_message_list, status);
+                message = ply_hashtable_lookup (progress->previous_message_index, (void *) status);
                 if (message) {
-                        message_next = ply_progress_message_search_next (progress->previous_message_list, message->time);
+                        message_next = ply_progress_message_search_next (progress, message->time);
                         if (message_next)
                                 progress->next_message_percentage = message_next->time;
                         else
@@ -320,6 +515,7 @@ ply_progress_status_update (ply_progress_t *progress,
                 message->string = strdup (status);
                 message->disabled = false;
                 ply_list_append_data (progress->current_message_list, message);
+                ply_hashtable_insert (progress->current_messages, message->string, message);
         }
 }
 
@@ -79,6 +79,7 @@ static int errno_stack[PLY_ERRNO_STACK_SIZE];
 static int errno_stack_position = 0;
 
 static int overridden_device_scale = 0;
+static int compositor_thread_count = 1;
 
 bool
 ply_open_unidirectional_pipe (int *sender_fd,
@@ -969,6 +970,26 @@ ply_set_device_scale (int device_scale)
     ply_trace ("Device scale is set to %d", device_scale);
 }
 
+void
+ply_set_compositor_thread_count (int thread_count)
+{
+        /* 0 means one thread per online processor */
+        if (thread_count <= 0)
+                thread_count = sysconf (_SC_NPROCESSORS_ONLN);
+
+        if (thread_count <= 0)
+                thread_count = 1;
+
+        compositor_thread_count = thread_count;
+        ply_trace ("Compositor thread count is set to %d", thread_count);
+}
+
+int
+ply_get_compositor_thread_count (void)
+{
+        return compositor_thread_count;
+}
+
 /* The minimum resolution at which we turn on a device-scale of 2 */
 #define HIDPI_LIMIT 192
 #define HIDPI_MIN_HEIGHT 1200
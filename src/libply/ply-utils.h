@@ -123,6 +123,9 @@ pid_t ply_get_process_parent_pid (pid_t pid);
 
 void ply_set_device_scale (int device_scale);
 
+void ply_set_compositor_thread_count (int thread_count);
+int ply_get_compositor_thread_count (void);
+
 int ply_get_device_scale (uint32_t width,
                           uint32_t height,
                           uint32_t width_mm,
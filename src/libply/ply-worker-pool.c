@@ -0,0 +1,209 @@
+/* ply-worker-pool.c - splits loops across a fixed set of threads
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#include "config.h"
+#include "ply-worker-pool.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "ply-logger.h"
+
+/* Everything in plymouthd happens on the event loop thread, and the
+ * pool doesn't change that: a run hands slices of one loop to the
+ * worker threads, helps out itself, and doesn't return until all of
+ * them are finished.  So callers never see work still in flight, and
+ * anything they do before or after a run stays single threaded.
+ */
+struct _ply_worker_pool
+{
+        pthread_mutex_t           mutex;
+        pthread_cond_t            work_available;
+        pthread_cond_t            work_finished;
+
+        pthread_t                *threads;
+        int                       thread_count;
+
+        ply_worker_pool_handler_t handler;
+        void                     *user_data;
+        unsigned long             count;
+        unsigned long             slice_size;
+        unsigned long             next_slice;
+
+        unsigned long             generation;
+        int                       busy_workers;
+
+        uint32_t                  is_quitting : 1;
+};
+
+/* Called, and returns, with the mutex held */
+static void
+ply_worker_pool_run_slices (ply_worker_pool_t *pool)
+{
+        while (pool->next_slice < pool->count) {
+                ply_worker_pool_handler_t handler;
+                void *user_data;
+                unsigned long start, end;
+
+                handler = pool->handler;
+                user_data = pool->user_data;
+                start = pool->next_slice;
+                end = start + pool->slice_size;
+                if (end > pool->count)
+                        end = pool->count;
+                pool->next_slice = end;
+
+                pthread_mutex_unlock (&pool->mutex);
+                handler (user_data, start, end);
+                pthread_mutex_lock (&pool->mutex);
+        }
+}
+
+static void *
+ply_worker_pool_thread_main (void *data)
+{
+        ply_worker_pool_t *pool = data;
+        unsigned long generation = 0;
+
+        pthread_mutex_lock (&pool->mutex);
+        while (true) {
+                while (!pool->is_quitting && pool->generation == generation) {
+                        pthread_cond_wait (&pool->work_available, &pool->mutex);
+                }
+
+                if (pool->is_quitting)
+                        break;
+
+                generation = pool->generation;
+
+                pool->busy_workers++;
+                ply_worker_pool_run_slices (pool);
+                pool->busy_workers--;
+
+                if (pool->busy_workers == 0)
+                        pthread_cond_signal (&pool->work_finished);
+        }
+        pthread_mutex_unlock (&pool->mutex);
+
+        return NULL;
+}
+
+ply_worker_pool_t *
+ply_worker_pool_new (int thread_count)
+{
+        ply_worker_pool_t *pool;
+        sigset_t all_signals, old_signals;
+        int i;
+
+        assert (thread_count > 0);
+
+        pool = calloc (1, sizeof(ply_worker_pool_t));
+        pthread_mutex_init (&pool->mutex, NULL);
+        pthread_cond_init (&pool->work_available, NULL);
+        pthread_cond_init (&pool->work_finished, NULL);
+
+        /* The calling thread does its share of every run, so only the
+         * rest need spawning
+         */
+        pool->threads = calloc (thread_count, sizeof(pthread_t));
+
+        /* Signals are handled through the event loop, so keep them
+         * away from the workers
+         */
+        sigfillset (&all_signals);
+        pthread_sigmask (SIG_SETMASK, &all_signals, &old_signals);
+
+        for (i = 0; i < thread_count - 1; i++) {
+                if (pthread_create (&pool->threads[i], NULL,
+                                    ply_worker_pool_thread_main, pool) != 0) {
+                        ply_trace ("could not start worker thread: %m");
+                        break;
+                }
+        }
+        pool->thread_count = i + 1;
+
+        pthread_sigmask (SIG_SETMASK, &old_signals, NULL);
+
+        ply_trace ("running with %d worker threads", pool->thread_count);
+
+        return pool;
+}
+
+void
+ply_worker_pool_free (ply_worker_pool_t *pool)
+{
+        int i;
+
+        if (pool == NULL)
+                return;
+
+        pthread_mutex_lock (&pool->mutex);
+        pool->is_quitting = true;
+        pthread_cond_broadcast (&pool->work_available);
+        pthread_mutex_unlock (&pool->mutex);
+
+        for (i = 0; i < pool->thread_count - 1; i++) {
+                pthread_join (pool->threads[i], NULL);
+        }
+
+        pthread_cond_destroy (&pool->work_finished);
+        pthread_cond_destroy (&pool->work_available);
+        pthread_mutex_destroy (&pool->mutex);
+        free (pool->threads);
+        free (pool);
+}
+
+int
+ply_worker_pool_get_thread_count (ply_worker_pool_t *pool)
+{
+        return pool->thread_count;
+}
+
+void
+ply_worker_pool_run (ply_worker_pool_t        *pool,
+                     ply_worker_pool_handler_t handler,
+                     void                     *user_data,
+                     unsigned long             count,
+                     unsigned long             slice_size)
+{
+        assert (slice_size > 0);
+
+        if (pool->thread_count == 1 || count <= slice_size) {
+                handler (user_data, 0, count);
+                return;
+        }
+
+        pthread_mutex_lock (&pool->mutex);
+        pool->handler = handler;
+        pool->user_data = user_data;
+        pool->count = count;
+        pool->slice_size = slice_size;
+        pool->next_slice = 0;
+        pool->generation++;
+        pthread_cond_broadcast (&pool->work_available);
+
+        ply_worker_pool_run_slices (pool);
+
+        while (pool->busy_workers > 0) {
+                pthread_cond_wait (&pool->work_finished, &pool->mutex);
+        }
+        pthread_mutex_unlock (&pool->mutex);
+}
+/* vim: set ts=4 sw=4 et ai ci cino={.5s,^-2,+.5s,t0,g0,e-2,n-2,p2s,(0,=.5s,:.5s */
@@ -0,0 +1,46 @@
+/* ply-worker-pool.h - splits loops across a fixed set of threads
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifndef PLY_WORKER_POOL_H
+#define PLY_WORKER_POOL_H
+
+#include <stdbool.h>
+
+typedef struct _ply_worker_pool ply_worker_pool_t;
+
+/* Called with a [start, end) slice of the work; slices never overlap */
+typedef void (*ply_worker_pool_handler_t) (void         *user_data,
+                                           unsigned long start,
+                                           unsigned long end);
+
+#ifndef PLY_HIDE_FUNCTION_DECLARATIONS
+ply_worker_pool_t *ply_worker_pool_new (int thread_count);
+void ply_worker_pool_free (ply_worker_pool_t *pool);
+int ply_worker_pool_get_thread_count (ply_worker_pool_t *pool);
+
+/* Runs handler over [0, count) in slices of slice_size, on the pool's
+ * threads and the calling thread, and returns once every slice is done.
+ */
+void ply_worker_pool_run (ply_worker_pool_t        *pool,
+                          ply_worker_pool_handler_t handler,
+                          void                     *user_data,
+                          unsigned long             count,
+                          unsigned long             slice_size);
+#endif
+
+#endif /* PLY_WORKER_POOL_H */
+/* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
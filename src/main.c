@@ -60,6 +60,14 @@
 #define PLY_MAX_COMMAND_LINE_SIZE 4097
 #endif
 
+/* Status and progress updates that arrive faster than this are coalesced,
+ * so the splash redraws at most once per frame no matter how chatty
+ * clients are
+ */
+#ifndef SPLASH_UPDATE_INTERVAL
+#define SPLASH_UPDATE_INTERVAL (1.0 / 30)
+#endif
+
 #define BOOT_DURATION_FILE     PLYMOUTH_TIME_DIRECTORY "/boot-duration"
 #define SHUTDOWN_DURATION_FILE PLYMOUTH_TIME_DIRECTORY "/shutdown-duration"
 
@@ -108,6 +116,10 @@ typedef struct
         double                  start_time;
         double                  splash_delay;
         double                  device_timeout;
+        double                  last_splash_update_time;
+
+        ply_list_t             *pending_statuses;
+        int                     pending_system_update;
 
         char                    kernel_command_line[PLY_MAX_COMMAND_LINE_SIZE];
         uint32_t                kernel_command_line_is_set : 1;
@@ -121,6 +133,7 @@ typedef struct
         uint32_t                is_inactive : 1;
         uint32_t                is_shown : 1;
         uint32_t                should_force_details : 1;
+        uint32_t                splash_update_is_scheduled : 1;
 
         char                   *override_splash_path;
         char                   *system_default_splash_path;
@@ -211,6 +224,129 @@ on_session_hangup (state_t *state)
         ply_trace ("got hang up on terminal session fd");
 }
 
+static void
+pause_pixel_displays (state_t *state)
+{
+        ply_list_t *pixel_displays;
+        ply_list_node_t *node;
+
+        if (state->device_manager == NULL)
+                return;
+
+        pixel_displays = ply_device_manager_get_pixel_displays (state->device_manager);
+        node = ply_list_get_first_node (pixel_displays);
+        while (node != NULL) {
+                ply_pixel_display_t *pixel_display;
+
+                pixel_display = ply_list_node_get_data (node);
+                ply_pixel_display_pause_updates (pixel_display);
+                node = ply_list_get_next_node (pixel_displays, node);
+        }
+}
+
+static void
+unpause_pixel_displays (state_t *state)
+{
+        ply_list_t *pixel_displays;
+        ply_list_node_t *node;
+
+        if (state->device_manager == NULL)
+                return;
+
+        pixel_displays = ply_device_manager_get_pixel_displays (state->device_manager);
+        node = ply_list_get_first_node (pixel_displays);
+        while (node != NULL) {
+                ply_pixel_display_t *pixel_display;
+
+                pixel_display = ply_list_node_get_data (node);
+                ply_pixel_display_unpause_updates (pixel_display);
+                node = ply_list_get_next_node (pixel_displays, node);
+        }
+}
+
+static void
+flush_splash_updates (state_t *state)
+{
+        ply_list_node_t *node;
+        int progress;
+
+        state->splash_update_is_scheduled = false;
+        state->last_splash_update_time = ply_get_timestamp ();
+
+        progress = state->pending_system_update;
+        state->pending_system_update = -1;
+
+        /* Themes may act on every status message, so all of them get
+         * passed on in order, only progress is latest-wins.  The displays
+         * are held for the duration so the screen is updated once per
+         * flush, however many messages were queued.
+         */
+        if (state->boot_splash == NULL) {
+                while ((node = ply_list_get_first_node (state->pending_statuses)) != NULL) {
+                        free (ply_list_node_get_data (node));
+                        ply_list_remove_node (state->pending_statuses, node);
+                }
+                return;
+        }
+
+        pause_pixel_displays (state);
+
+        while ((node = ply_list_get_first_node (state->pending_statuses)) != NULL) {
+                char *status = ply_list_node_get_data (node);
+
+                ply_list_remove_node (state->pending_statuses, node);
+                ply_boot_splash_update_status (state->boot_splash, status);
+                free (status);
+        }
+
+        if (progress >= 0) {
+                ply_trace ("setting system update to '%i'", progress);
+                if (!ply_boot_splash_system_update (state->boot_splash, progress))
+                        ply_trace ("failed to update splash");
+        }
+
+        unpause_pixel_displays (state);
+}
+
+static void
+cancel_splash_updates (state_t *state)
+{
+        if (!state->splash_update_is_scheduled)
+                return;
+
+        ply_event_loop_stop_watching_for_timeout (state->loop,
+                                                  (ply_event_loop_timeout_handler_t)
+                                                  flush_splash_updates,
+                                                  state);
+        state->splash_update_is_scheduled = false;
+}
+
+static void
+schedule_splash_update (state_t *state)
+{
+        double time_since_last_update;
+
+        if (state->splash_update_is_scheduled)
+                return;
+
+        time_since_last_update = ply_get_timestamp () - state->last_splash_update_time;
+
+        /* An update after a quiet spell goes out right away, later ones
+         * wait for the frame to end and get passed on together
+         */
+        if (time_since_last_update >= SPLASH_UPDATE_INTERVAL) {
+                flush_splash_updates (state);
+                return;
+        }
+
+        state->splash_update_is_scheduled = true;
+        ply_event_loop_watch_for_timeout (state->loop,
+                                          SPLASH_UPDATE_INTERVAL - time_since_last_update,
+                                          (ply_event_loop_timeout_handler_t)
+                                          flush_splash_updates,
+                                          state);
+}
+
 static void
 on_update (state_t    *state,
            const char *status)
@@ -218,9 +354,10 @@ on_update (state_t    *state,
         ply_trace ("updating status to '%s'", status);
         ply_progress_status_update (state->progress,
                                     status);
-        if (state->boot_splash != NULL)
-                ply_boot_splash_update_status (state->boot_splash,
-                                               status);
+        if (state->boot_splash != NULL) {
+                ply_list_append_data (state->pending_statuses, strdup (status));
+                schedule_splash_update (state);
+        }
 }
 
 static void
@@ -261,11 +398,9 @@ on_system_update (state_t *state,
                 return;
         }
 
-        ply_trace ("setting system update to '%i'", progress);
-        if (!ply_boot_splash_system_update (state->boot_splash, progress)) {
-                ply_trace ("failed to update splash");
-                return;
-        }
+        ply_trace ("got system update '%i'", progress);
+        state->pending_system_update = progress;
+        schedule_splash_update (state);
 }
 
 static void
@@ -298,6 +433,7 @@ load_settings (state_t    *state,
         bool settings_loaded = false;
         char *scale_string = NULL;
         char *splash_string = NULL;
+        char *threads_string = NULL;
 
         ply_trace ("Trying to load %s", path);
         key_file = ply_key_file_new (path);
@@ -354,6 +490,13 @@ load_settings (state_t    *state,
                 free (scale_string);
         }
 
+        threads_string = ply_key_file_get_value (key_file, "Daemon", "CompositorThreads");
+
+        if (threads_string != NULL) {
+                ply_set_compositor_thread_count (strtol (threads_string, NULL, 0));
+                free (threads_string);
+        }
+
         settings_loaded = true;
 out:
         free (splash_string);
@@ -1422,6 +1565,9 @@ on_quit (state_t       *state,
         state->quit_trigger = quit_trigger;
         state->should_retain_splash = retain_splash;
 
+        cancel_splash_updates (state);
+        flush_splash_updates (state);
+
 #ifdef PLY_ENABLE_SYSTEMD_INTEGRATION
         tell_systemd_to_stop_printing_details (state);
 #endif
@@ -2213,6 +2359,7 @@ main (int    argc,
         char *kernel_command_line = NULL;
         char *tty = NULL;
         ply_device_manager_flags_t device_manager_flags = PLY_DEVICE_MANAGER_FLAGS_NONE;
+        ply_list_node_t *node;
 
         state.start_time = ply_get_timestamp ();
         state.command_parser = ply_command_parser_new ("plymouthd", "Splash server");
@@ -2366,6 +2513,8 @@ main (int    argc,
         state.progress = ply_progress_new ();
         state.splash_delay = NAN;
         state.device_timeout = NAN;
+        state.pending_statuses = ply_list_new ();
+        state.pending_system_update = -1;
 
         ply_progress_load_cache (state.progress,
                                  get_cache_file_for_mode (state.mode));
@@ -2421,6 +2570,11 @@ main (int    argc,
 
         ply_buffer_free (state.boot_buffer);
         ply_progress_free (state.progress);
+        while ((node = ply_list_get_first_node (state.pending_statuses)) != NULL) {
+                free (ply_list_node_get_data (node));
+                ply_list_remove_node (state.pending_statuses, node);
+        }
+        ply_list_free (state.pending_statuses);
 
         ply_trace ("exiting with code %d", exit_code);
 
@@ -50,6 +50,7 @@
 #include "ply-key-file.h"
 #include "ply-pixel-buffer.h"
 #include "ply-pixel-display.h"
+#include "ply-static-layer.h"
 #include "ply-trigger.h"
 #include "ply-utils.h"
 
@@ -84,6 +85,7 @@ typedef struct
         ply_entry_t              *entry;
         ply_label_t              *label;
         ply_label_t              *message_label;
+        ply_static_layer_t       *background_layer;
         ply_rectangle_t           lock_area;
         double                    logo_opacity;
 } view_t;
@@ -238,6 +240,12 @@ free_stars (view_t *view)
 }
 
 static void detach_from_event_loop (ply_boot_splash_plugin_t *plugin);
+static void draw_background (view_t             *view,
+                             ply_pixel_buffer_t *pixel_buffer,
+                             int                 x,
+                             int                 y,
+                             int                 width,
+                             int                 height);
 
 static view_t *
 view_new (ply_boot_splash_plugin_t *plugin,
@@ -255,6 +263,9 @@ view_new (ply_boot_splash_plugin_t *plugin,
 
         view->message_label = ply_label_new ();
 
+        view->background_layer = ply_static_layer_new ((ply_static_layer_draw_handler_t)
+                                                       draw_background, view);
+
         return view;
 }
 
@@ -264,6 +275,7 @@ view_free (view_t *view)
         ply_entry_free (view->entry);
         ply_label_free (view->message_label);
         free_stars (view);
+        ply_static_layer_free (view->background_layer);
 
         ply_pixel_display_set_draw_handler (view->display, NULL, NULL);
 
@@ -728,7 +740,8 @@ on_draw (view_t             *view,
 
         plugin = view->plugin;
 
-        draw_background (view, pixel_buffer, x, y, width, height);
+        ply_static_layer_draw_area (view->background_layer, pixel_buffer,
+                                    x, y, width, height);
 
         if (plugin->state == PLY_BOOT_SPLASH_DISPLAY_NORMAL)
                 draw_normal_view (view, pixel_buffer, x, y, width, height);
@@ -55,6 +55,8 @@
 
 #include "script.h"
 #include "script-parse.h"
+#include "script-compile.h"
+#include "script-optimize.h"
 #include "script-object.h"
 #include "script-execute.h"
 #include "script-lib-image.h"
@@ -78,6 +80,13 @@ struct _ply_boot_splash_plugin
 
         char                       *script_filename;
         char                       *image_dir;
+        int                         rotation_cache_steps;
+        long                        image_cache_size;
+        bool                        profile;
+        bool                        optimizer_statistics;
+        double                      frame_time_budget;
+        double                      frame_time_debt;
+        unsigned long               skipped_frames;
 
         ply_list_t                 *script_env_vars;
         script_op_t                *script_main_op;
@@ -167,6 +176,11 @@ static ply_boot_splash_plugin_t *
 create_plugin (ply_key_file_t *key_file)
 {
         ply_boot_splash_plugin_t *plugin;
+        char *steps;
+        char *cache_size;
+        char *profile;
+        char *statistics;
+        char *budget;
 
         plugin = calloc (1, sizeof(ply_boot_splash_plugin_t));
         plugin->image_dir = ply_key_file_get_value (key_file,
@@ -176,6 +190,35 @@ create_plugin (ply_key_file_t *key_file)
                                                           "script",
                                                           "ScriptFile");
 
+        /* Off unless the theme asks for it, since angles get snapped
+         * to 1/RotationCacheSteps of a turn
+         */
+        steps = ply_key_file_get_value (key_file, "script", "RotationCacheSteps");
+        if (steps != NULL)
+                plugin->rotation_cache_steps = MAX (strtol (steps, NULL, 0), 0);
+        free (steps);
+
+        /* In kilobytes, with 0 turning the cache of transformed images off */
+        plugin->image_cache_size = -1;
+        cache_size = ply_key_file_get_value (key_file, "script", "ImageCacheSize");
+        if (cache_size != NULL)
+                plugin->image_cache_size = MAX (strtol (cache_size, NULL, 0), 0);
+        free (cache_size);
+
+        profile = ply_key_file_get_value (key_file, "script", "Profile");
+        plugin->profile = profile != NULL && strcmp (profile, "true") == 0;
+        free (profile);
+
+        statistics = ply_key_file_get_value (key_file, "script", "OptimizerStatistics");
+        plugin->optimizer_statistics = statistics != NULL && strcmp (statistics, "true") == 0;
+        free (statistics);
+
+        /* In milliseconds of script and drawing time per frame */
+        budget = ply_key_file_get_value (key_file, "script", "FrameTimeBudget");
+        if (budget != NULL)
+                plugin->frame_time_budget = MAX (strtod (budget, NULL), 0) / 1000.0;
+        free (budget);
+
         plugin->script_env_vars = ply_list_new ();
         ply_key_file_foreach_entry (key_file, add_script_env_var, plugin->script_env_vars);
 
@@ -218,7 +261,8 @@ destroy_plugin (ply_boot_splash_plugin_t *plugin)
 static void
 on_timeout (ply_boot_splash_plugin_t *plugin)
 {
-        double sleep_time;
+        script_profile_frame_t profile_frame;
+        double sleep_time, start_time, frame_time;
 
         sleep_time = 1.0 / plugin->script_plymouth_lib->refresh_rate;
         ply_event_loop_watch_for_timeout (plugin->loop,
@@ -226,12 +270,33 @@ on_timeout (ply_boot_splash_plugin_t *plugin)
                                           (ply_event_loop_timeout_handler_t)
                                           on_timeout, plugin);
 
+        /* A frame that ran over budget is paid back by skipping the
+         * frames after it, so the event loop still gets to run
+         */
+        if (plugin->frame_time_debt > 0) {
+                plugin->frame_time_debt -= sleep_time;
+                plugin->skipped_frames++;
+                return;
+        }
+
+        start_time = ply_get_timestamp ();
+
+        script_profile_begin (&profile_frame, "refresh", "refresh callback");
         script_lib_plymouth_on_refresh (plugin->script_state,
                                         plugin->script_plymouth_lib);
+        script_profile_end (&profile_frame);
 
         pause_displays (plugin);
+        script_profile_begin (&profile_frame, "composite", "sprite compositing");
         script_lib_sprite_refresh (plugin->script_sprite_lib);
+        script_profile_end (&profile_frame);
         unpause_displays (plugin);
+
+        if (plugin->frame_time_budget > 0) {
+                frame_time = ply_get_timestamp () - start_time;
+                if (frame_time > plugin->frame_time_budget)
+                        plugin->frame_time_debt = frame_time - plugin->frame_time_budget;
+        }
 }
 
 static void
@@ -256,6 +321,9 @@ start_script_animation (ply_boot_splash_plugin_t *plugin)
         assert (plugin != NULL);
 
         plugin->script_state = script_state_new (plugin);
+        script_profile_set_enabled (plugin->profile);
+        plugin->frame_time_debt = 0;
+        plugin->skipped_frames = 0;
 
         for (node = ply_list_get_first_node (plugin->script_env_vars);
              node != NULL;
@@ -269,6 +337,10 @@ start_script_animation (ply_boot_splash_plugin_t *plugin)
 
         plugin->script_image_lib = script_lib_image_setup (plugin->script_state,
                                                            plugin->image_dir);
+        plugin->script_image_lib->rotation_cache_steps = plugin->rotation_cache_steps;
+        if (plugin->image_cache_size >= 0)
+                script_lib_image_set_cache_budget (plugin->script_image_lib,
+                                                   (size_t) plugin->image_cache_size * 1024);
         plugin->script_sprite_lib = script_lib_sprite_setup (plugin->script_state,
                                                              plugin->displays);
         plugin->script_plymouth_lib = script_lib_plymouth_setup (plugin->script_state,
@@ -293,14 +365,29 @@ start_script_animation (ply_boot_splash_plugin_t *plugin)
 static bool
 start_animation (ply_boot_splash_plugin_t *plugin)
 {
+        char *compiled_filename;
+
         assert (plugin != NULL);
         assert (plugin->loop != NULL);
 
         if (plugin->is_animating)
                 return true;
 
-        ply_trace ("parsing script file");
-        plugin->script_main_op = script_parse_file (plugin->script_filename);
+        script_optimize_set_statistics_enabled (plugin->optimizer_statistics);
+
+        compiled_filename = NULL;
+        asprintf (&compiled_filename, "%s%s", plugin->script_filename,
+                  SCRIPT_COMPILE_FILE_SUFFIX);
+        plugin->script_main_op = script_compile_load_file (plugin->script_filename,
+                                                           compiled_filename);
+        free (compiled_filename);
+
+        if (plugin->script_main_op) {
+                ply_trace ("loaded precompiled script file");
+        } else {
+                ply_trace ("parsing script file");
+                plugin->script_main_op = script_parse_file (plugin->script_filename);
+        }
 
         start_script_animation (plugin);
 
@@ -315,6 +402,12 @@ stop_script_animation (ply_boot_splash_plugin_t *plugin)
                                      plugin->script_plymouth_lib);
         script_lib_sprite_refresh (plugin->script_sprite_lib);
 
+        if (plugin->frame_time_budget > 0)
+                ply_trace ("skipped %lu frames that were over the time budget",
+                           plugin->skipped_frames);
+        script_profile_dump ();
+        script_profile_free ();
+
         if (plugin->loop != NULL)
                 ply_event_loop_stop_watching_for_timeout (plugin->loop,
                                                           (ply_event_loop_timeout_handler_t)
@@ -0,0 +1,59 @@
+/* plymouth-compile-script.c - parse a theme script ahead of boot
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ply-logger.h"
+
+#include "script.h"
+#include "script-parse.h"
+#include "script-compile.h"
+
+int
+main (int    argc,
+      char **argv)
+{
+        script_op_t *op;
+        char *filename;
+        bool written;
+
+        if (argc < 2 || argc > 3) {
+                fprintf (stderr, "usage: %s SCRIPT [OUTPUT]\n", argv[0]);
+                return 1;
+        }
+
+        op = script_parse_file (argv[1]);
+        if (!op)
+                return 1;
+
+        if (argc == 3)
+                filename = strdup (argv[2]);
+        else
+                asprintf (&filename, "%s%s", argv[1], SCRIPT_COMPILE_FILE_SUFFIX);
+
+        written = script_compile_write_file (op, argv[1], filename);
+
+        free (filename);
+        script_parse_op_free (op);
+
+        return written ? 0 : 1;
+}
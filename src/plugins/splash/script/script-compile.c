@@ -0,0 +1,653 @@
+/* script-compile.c - precompiled form of parsed scripts
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ply-buffer.h"
+#include "ply-list.h"
+#include "ply-logger.h"
+
+#include "script.h"
+#include "script-debug.h"
+#include "script-parse.h"
+#include "script-compile.h"
+
+/* The file is a header followed by the tree in pre-order.  Every node
+ * starts with a tag byte (0 for a missing node, otherwise its type + 1)
+ * and its source location.  Integers are stored in host byte order; the
+ * byte order marker rejects files written on a different machine.
+ * Bump the version whenever the tree layout changes.
+ */
+#define SCRIPT_COMPILE_MAGIC "PLYSCRC"
+#define SCRIPT_COMPILE_VERSION 1
+#define SCRIPT_COMPILE_BYTE_ORDER 0x01020304
+
+typedef struct
+{
+        char     magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint64_t source_size;
+        uint64_t source_checksum;
+        uint64_t payload_size;
+        uint64_t payload_checksum;
+} script_compile_header_t;
+
+typedef struct
+{
+        const uint8_t *data;
+        size_t         size;
+        size_t         offset;
+        const char    *name;
+        bool           failed;
+} script_compile_reader_t;
+
+static void script_compile_write_op (ply_buffer_t *buffer,
+                                     script_op_t  *op);
+static script_op_t *script_compile_read_op (script_compile_reader_t *reader);
+
+static uint64_t script_compile_checksum (const uint8_t *data,
+                                         size_t         size)
+{
+        uint64_t hash = 14695981039346656037ULL;
+        size_t i;
+
+        for (i = 0; i < size; i++) {
+                hash ^= data[i];
+                hash *= 1099511628211ULL;
+        }
+        return hash;
+}
+
+static const uint8_t *script_compile_map_file (const char *filename,
+                                               size_t     *size)
+{
+        struct stat file_info;
+        void *data;
+        int fd;
+
+        fd = open (filename, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+                return NULL;
+
+        if (fstat (fd, &file_info) < 0 || file_info.st_size <= 0) {
+                close (fd);
+                return NULL;
+        }
+
+        data = mmap (NULL, file_info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close (fd);
+
+        if (data == MAP_FAILED)
+                return NULL;
+
+        *size = file_info.st_size;
+        return data;
+}
+
+static void script_compile_write_uint8 (ply_buffer_t *buffer,
+                                        uint8_t       value)
+{
+        ply_buffer_append_bytes (buffer, &value, sizeof(value));
+}
+
+static void script_compile_write_uint32 (ply_buffer_t *buffer,
+                                         uint32_t      value)
+{
+        ply_buffer_append_bytes (buffer, &value, sizeof(value));
+}
+
+static void script_compile_write_string (ply_buffer_t *buffer,
+                                         const char   *string)
+{
+        uint32_t length = strlen (string);
+
+        script_compile_write_uint32 (buffer, length);
+        ply_buffer_append_bytes (buffer, string, length);
+}
+
+static void script_compile_write_tag (ply_buffer_t *buffer,
+                                      int           type,
+                                      void         *element)
+{
+        script_debug_location_t *location = script_debug_lookup_element (element);
+
+        script_compile_write_uint8 (buffer, type + 1);
+        script_compile_write_uint32 (buffer, location ? location->line_index : 0);
+        script_compile_write_uint32 (buffer, location ? location->column_index : 0);
+}
+
+static void script_compile_write_exp (ply_buffer_t *buffer,
+                                      script_exp_t *exp)
+{
+        ply_list_node_t *node;
+
+        if (!exp) {
+                script_compile_write_uint8 (buffer, 0);
+                return;
+        }
+
+        script_compile_write_tag (buffer, exp->type, exp);
+
+        switch (exp->type) {
+        case SCRIPT_EXP_TYPE_PLUS:
+        case SCRIPT_EXP_TYPE_MINUS:
+        case SCRIPT_EXP_TYPE_MUL:
+        case SCRIPT_EXP_TYPE_DIV:
+        case SCRIPT_EXP_TYPE_MOD:
+        case SCRIPT_EXP_TYPE_EQ:
+        case SCRIPT_EXP_TYPE_NE:
+        case SCRIPT_EXP_TYPE_GT:
+        case SCRIPT_EXP_TYPE_GE:
+        case SCRIPT_EXP_TYPE_LT:
+        case SCRIPT_EXP_TYPE_LE:
+        case SCRIPT_EXP_TYPE_AND:
+        case SCRIPT_EXP_TYPE_OR:
+        case SCRIPT_EXP_TYPE_EXTEND:
+        case SCRIPT_EXP_TYPE_ASSIGN:
+        case SCRIPT_EXP_TYPE_ASSIGN_PLUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MINUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MUL:
+        case SCRIPT_EXP_TYPE_ASSIGN_DIV:
+        case SCRIPT_EXP_TYPE_ASSIGN_MOD:
+        case SCRIPT_EXP_TYPE_ASSIGN_EXTEND:
+        case SCRIPT_EXP_TYPE_HASH:
+                script_compile_write_exp (buffer, exp->data.dual.sub_a);
+                script_compile_write_exp (buffer, exp->data.dual.sub_b);
+                break;
+
+        case SCRIPT_EXP_TYPE_NOT:
+        case SCRIPT_EXP_TYPE_POS:
+        case SCRIPT_EXP_TYPE_NEG:
+        case SCRIPT_EXP_TYPE_PRE_INC:
+        case SCRIPT_EXP_TYPE_PRE_DEC:
+        case SCRIPT_EXP_TYPE_POST_INC:
+        case SCRIPT_EXP_TYPE_POST_DEC:
+                script_compile_write_exp (buffer, exp->data.sub);
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_NUMBER:
+                ply_buffer_append_bytes (buffer, &exp->data.number, sizeof(exp->data.number));
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_STRING:
+        case SCRIPT_EXP_TYPE_TERM_VAR:
+                script_compile_write_string (buffer, exp->data.string);
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_NULL:
+        case SCRIPT_EXP_TYPE_TERM_LOCAL:
+        case SCRIPT_EXP_TYPE_TERM_GLOBAL:
+        case SCRIPT_EXP_TYPE_TERM_THIS:
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_SET:
+                script_compile_write_uint32 (buffer, ply_list_get_length (exp->data.parameters));
+                for (node = ply_list_get_first_node (exp->data.parameters);
+                     node;
+                     node = ply_list_get_next_node (exp->data.parameters, node)) {
+                        script_compile_write_exp (buffer, ply_list_node_get_data (node));
+                }
+                break;
+
+        case SCRIPT_EXP_TYPE_FUNCTION_EXE:
+                script_compile_write_exp (buffer, exp->data.function_exe.name);
+                script_compile_write_uint32 (buffer, ply_list_get_length (exp->data.function_exe.parameters));
+                for (node = ply_list_get_first_node (exp->data.function_exe.parameters);
+                     node;
+                     node = ply_list_get_next_node (exp->data.function_exe.parameters, node)) {
+                        script_compile_write_exp (buffer, ply_list_node_get_data (node));
+                }
+                break;
+
+        case SCRIPT_EXP_TYPE_FUNCTION_DEF:
+                script_compile_write_uint32 (buffer, ply_list_get_length (exp->data.function_def->parameters));
+                for (node = ply_list_get_first_node (exp->data.function_def->parameters);
+                     node;
+                     node = ply_list_get_next_node (exp->data.function_def->parameters, node)) {
+                        script_compile_write_string (buffer, ply_list_node_get_data (node));
+                }
+                script_compile_write_op (buffer, exp->data.function_def->data.script);
+                break;
+        }
+}
+
+static void script_compile_write_op (ply_buffer_t *buffer,
+                                     script_op_t  *op)
+{
+        ply_list_node_t *node;
+
+        if (!op) {
+                script_compile_write_uint8 (buffer, 0);
+                return;
+        }
+
+        script_compile_write_tag (buffer, op->type, op);
+
+        switch (op->type) {
+        case SCRIPT_OP_TYPE_EXPRESSION:
+        case SCRIPT_OP_TYPE_RETURN:
+                script_compile_write_exp (buffer, op->data.exp);
+                break;
+
+        case SCRIPT_OP_TYPE_OP_BLOCK:
+                script_compile_write_uint32 (buffer, ply_list_get_length (op->data.list));
+                for (node = ply_list_get_first_node (op->data.list);
+                     node;
+                     node = ply_list_get_next_node (op->data.list, node)) {
+                        script_compile_write_op (buffer, ply_list_node_get_data (node));
+                }
+                break;
+
+        case SCRIPT_OP_TYPE_IF:
+        case SCRIPT_OP_TYPE_WHILE:
+        case SCRIPT_OP_TYPE_DO_WHILE:
+        case SCRIPT_OP_TYPE_FOR:
+                script_compile_write_exp (buffer, op->data.cond_op.cond);
+                script_compile_write_op (buffer, op->data.cond_op.op1);
+                script_compile_write_op (buffer, op->data.cond_op.op2);
+                break;
+
+        case SCRIPT_OP_TYPE_FAIL:
+        case SCRIPT_OP_TYPE_BREAK:
+        case SCRIPT_OP_TYPE_CONTINUE:
+                break;
+        }
+}
+
+bool script_compile_write_file (script_op_t *op,
+                                const char  *source_filename,
+                                const char  *filename)
+{
+        script_compile_header_t header;
+        const uint8_t *source;
+        size_t source_size;
+        ply_buffer_t *buffer;
+        char *temporary_filename;
+        FILE *fp;
+        bool written;
+        int fd;
+
+        source = script_compile_map_file (source_filename, &source_size);
+        if (!source) {
+                ply_error ("Could not read %s: %m", source_filename);
+                return false;
+        }
+
+        buffer = ply_buffer_new ();
+        script_compile_write_op (buffer, op);
+
+        memset (&header, 0, sizeof(header));
+        memcpy (header.magic, SCRIPT_COMPILE_MAGIC, sizeof(header.magic));
+        header.version = SCRIPT_COMPILE_VERSION;
+        header.byte_order = SCRIPT_COMPILE_BYTE_ORDER;
+        header.source_size = source_size;
+        header.source_checksum = script_compile_checksum (source, source_size);
+        header.payload_size = ply_buffer_get_size (buffer);
+        header.payload_checksum = script_compile_checksum ((const uint8_t *) ply_buffer_get_bytes (buffer),
+                                                           ply_buffer_get_size (buffer));
+        munmap ((void *) source, source_size);
+
+        /* Write next to the target and rename so a half written file is never loaded */
+        asprintf (&temporary_filename, "%s.XXXXXX", filename);
+        fp = NULL;
+        written = false;
+        fd = mkstemp (temporary_filename);
+        if (fd >= 0)
+                fp = fdopen (fd, "w");
+
+        if (fp) {
+                written = fwrite (&header, sizeof(header), 1, fp) == 1 &&
+                          fwrite (ply_buffer_get_bytes (buffer), 1, ply_buffer_get_size (buffer), fp) == ply_buffer_get_size (buffer);
+                if (fclose (fp) != 0)
+                        written = false;
+                if (written && chmod (temporary_filename, 0644) < 0)
+                        written = false;
+                if (written && rename (temporary_filename, filename) < 0)
+                        written = false;
+                if (!written)
+                        unlink (temporary_filename);
+        }
+
+        if (!written)
+                ply_error ("Could not write %s: %m", filename);
+
+        free (temporary_filename);
+        ply_buffer_free (buffer);
+        return written;
+}
+
+static bool script_compile_read_bytes (script_compile_reader_t *reader,
+                                       void                    *bytes,
+                                       size_t                   size)
+{
+        if (reader->failed || size > reader->size - reader->offset) {
+                reader->failed = true;
+                memset (bytes, 0, size);
+                return false;
+        }
+        memcpy (bytes, reader->data + reader->offset, size);
+        reader->offset += size;
+        return true;
+}
+
+static uint8_t script_compile_read_uint8 (script_compile_reader_t *reader)
+{
+        uint8_t value;
+
+        script_compile_read_bytes (reader, &value, sizeof(value));
+        return value;
+}
+
+static uint32_t script_compile_read_uint32 (script_compile_reader_t *reader)
+{
+        uint32_t value;
+
+        script_compile_read_bytes (reader, &value, sizeof(value));
+        return value;
+}
+
+/* A count of nodes which follow.  Every node takes at least one byte, so
+ * anything larger than what is left of the file is corrupt.
+ */
+static uint32_t script_compile_read_count (script_compile_reader_t *reader)
+{
+        uint32_t count = script_compile_read_uint32 (reader);
+
+        if (count > reader->size - reader->offset) {
+                reader->failed = true;
+                return 0;
+        }
+        return count;
+}
+
+static char *script_compile_read_string (script_compile_reader_t *reader)
+{
+        uint32_t length = script_compile_read_count (reader);
+        char *string;
+
+        if (reader->failed)
+                return NULL;
+
+        string = malloc (length + 1);
+        script_compile_read_bytes (reader, string, length);
+        string[length] = '\0';
+        return string;
+}
+
+static int script_compile_read_tag (script_compile_reader_t *reader,
+                                    int                      max_type)
+{
+        uint8_t tag = script_compile_read_uint8 (reader);
+
+        if (reader->failed || tag == 0)
+                return -1;
+        if (tag - 1 > max_type) {
+                reader->failed = true;
+                return -1;
+        }
+        return tag - 1;
+}
+
+static void script_compile_read_location (script_compile_reader_t *reader,
+                                          void                    *element)
+{
+        script_debug_location_t location;
+
+        location.line_index = script_compile_read_uint32 (reader);
+        location.column_index = script_compile_read_uint32 (reader);
+        location.name = (char *) reader->name;
+        script_debug_add_element (element, &location);
+}
+
+static script_exp_t *script_compile_read_exp (script_compile_reader_t *reader)
+{
+        script_exp_t *exp;
+        uint32_t count;
+        int type;
+
+        type = script_compile_read_tag (reader, SCRIPT_EXP_TYPE_ASSIGN_EXTEND);
+        if (type < 0)
+                return NULL;
+
+        exp = malloc (sizeof(script_exp_t));
+        exp->type = type;
+        exp->field_cache.shape_id = 0;
+        exp->field_cache.index = 0;
+        script_compile_read_location (reader, exp);
+
+        /* Every node is left complete, even on failure, so that a partly
+         * read tree can be handed to script_parse_op_free ().
+         */
+        switch (exp->type) {
+        case SCRIPT_EXP_TYPE_PLUS:
+        case SCRIPT_EXP_TYPE_MINUS:
+        case SCRIPT_EXP_TYPE_MUL:
+        case SCRIPT_EXP_TYPE_DIV:
+        case SCRIPT_EXP_TYPE_MOD:
+        case SCRIPT_EXP_TYPE_EQ:
+        case SCRIPT_EXP_TYPE_NE:
+        case SCRIPT_EXP_TYPE_GT:
+        case SCRIPT_EXP_TYPE_GE:
+        case SCRIPT_EXP_TYPE_LT:
+        case SCRIPT_EXP_TYPE_LE:
+        case SCRIPT_EXP_TYPE_AND:
+        case SCRIPT_EXP_TYPE_OR:
+        case SCRIPT_EXP_TYPE_EXTEND:
+        case SCRIPT_EXP_TYPE_ASSIGN:
+        case SCRIPT_EXP_TYPE_ASSIGN_PLUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MINUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MUL:
+        case SCRIPT_EXP_TYPE_ASSIGN_DIV:
+        case SCRIPT_EXP_TYPE_ASSIGN_MOD:
+        case SCRIPT_EXP_TYPE_ASSIGN_EXTEND:
+        case SCRIPT_EXP_TYPE_HASH:
+                exp->data.dual.sub_a = script_compile_read_exp (reader);
+                exp->data.dual.sub_b = script_compile_read_exp (reader);
+                break;
+
+        case SCRIPT_EXP_TYPE_NOT:
+        case SCRIPT_EXP_TYPE_POS:
+        case SCRIPT_EXP_TYPE_NEG:
+        case SCRIPT_EXP_TYPE_PRE_INC:
+        case SCRIPT_EXP_TYPE_PRE_DEC:
+        case SCRIPT_EXP_TYPE_POST_INC:
+        case SCRIPT_EXP_TYPE_POST_DEC:
+                exp->data.sub = script_compile_read_exp (reader);
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_NUMBER:
+                script_compile_read_bytes (reader, &exp->data.number, sizeof(exp->data.number));
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_STRING:
+        case SCRIPT_EXP_TYPE_TERM_VAR:
+                exp->data.string = script_compile_read_string (reader);
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_NULL:
+        case SCRIPT_EXP_TYPE_TERM_LOCAL:
+        case SCRIPT_EXP_TYPE_TERM_GLOBAL:
+        case SCRIPT_EXP_TYPE_TERM_THIS:
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_SET:
+                exp->data.parameters = ply_list_new ();
+                count = script_compile_read_count (reader);
+                while (count-- > 0 && !reader->failed) {
+                        script_exp_t *sub = script_compile_read_exp (reader);
+                        if (!sub)
+                                reader->failed = true;
+                        ply_list_append_data (exp->data.parameters, sub);
+                }
+                break;
+
+        case SCRIPT_EXP_TYPE_FUNCTION_EXE:
+                exp->data.function_exe.name = script_compile_read_exp (reader);
+                exp->data.function_exe.parameters = ply_list_new ();
+                count = script_compile_read_count (reader);
+                while (count-- > 0 && !reader->failed) {
+                        script_exp_t *sub = script_compile_read_exp (reader);
+                        if (!sub)
+                                reader->failed = true;
+                        ply_list_append_data (exp->data.function_exe.parameters, sub);
+                }
+                break;
+
+        case SCRIPT_EXP_TYPE_FUNCTION_DEF:
+                exp->data.function_def = script_function_script_new (NULL, NULL, ply_list_new ());
+                count = script_compile_read_count (reader);
+                while (count-- > 0 && !reader->failed) {
+                        char *parameter = script_compile_read_string (reader);
+                        if (parameter)
+                                ply_list_append_data (exp->data.function_def->parameters, parameter);
+                }
+                exp->data.function_def->data.script = script_compile_read_op (reader);
+                break;
+        }
+
+        return exp;
+}
+
+static script_op_t *script_compile_read_op (script_compile_reader_t *reader)
+{
+        script_op_t *op;
+        uint32_t count;
+        int type;
+
+        type = script_compile_read_tag (reader, SCRIPT_OP_TYPE_CONTINUE);
+        if (type < 0)
+                return NULL;
+
+        op = malloc (sizeof(script_op_t));
+        op->type = type;
+        script_compile_read_location (reader, op);
+
+        switch (op->type) {
+        case SCRIPT_OP_TYPE_EXPRESSION:
+        case SCRIPT_OP_TYPE_RETURN:
+                op->data.exp = script_compile_read_exp (reader);
+                break;
+
+        case SCRIPT_OP_TYPE_OP_BLOCK:
+                op->data.list = ply_list_new ();
+                count = script_compile_read_count (reader);
+                while (count-- > 0 && !reader->failed) {
+                        script_op_t *sub = script_compile_read_op (reader);
+                        if (!sub)
+                                reader->failed = true;
+                        ply_list_append_data (op->data.list, sub);
+                }
+                break;
+
+        case SCRIPT_OP_TYPE_IF:
+        case SCRIPT_OP_TYPE_WHILE:
+        case SCRIPT_OP_TYPE_DO_WHILE:
+        case SCRIPT_OP_TYPE_FOR:
+                op->data.cond_op.cond = script_compile_read_exp (reader);
+                op->data.cond_op.op1 = script_compile_read_op (reader);
+                op->data.cond_op.op2 = script_compile_read_op (reader);
+                break;
+
+        case SCRIPT_OP_TYPE_FAIL:
+        case SCRIPT_OP_TYPE_BREAK:
+        case SCRIPT_OP_TYPE_CONTINUE:
+                break;
+        }
+
+        return op;
+}
+
+script_op_t *script_compile_load_file (const char *source_filename,
+                                       const char *filename)
+{
+        script_compile_header_t header;
+        script_compile_reader_t reader;
+        const uint8_t *data;
+        const uint8_t *source;
+        size_t size;
+        size_t source_size;
+        script_op_t *op;
+
+        data = script_compile_map_file (filename, &size);
+        if (!data)
+                return NULL;
+
+        op = NULL;
+
+        if (size < sizeof(header)) {
+                ply_trace ("%s is truncated", filename);
+                goto out;
+        }
+        memcpy (&header, data, sizeof(header));
+
+        if (memcmp (header.magic, SCRIPT_COMPILE_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != SCRIPT_COMPILE_VERSION ||
+            header.byte_order != SCRIPT_COMPILE_BYTE_ORDER) {
+                ply_trace ("%s was not written by this version of plymouth", filename);
+                goto out;
+        }
+
+        if (header.payload_size != size - sizeof(header) ||
+            header.payload_checksum != script_compile_checksum (data + sizeof(header), header.payload_size)) {
+                ply_trace ("%s is corrupt", filename);
+                goto out;
+        }
+
+        source = script_compile_map_file (source_filename, &source_size);
+        if (!source) {
+                ply_trace ("could not read %s: %m", source_filename);
+                goto out;
+        }
+
+        if (header.source_size != source_size ||
+            header.source_checksum != script_compile_checksum (source, source_size)) {
+                ply_trace ("%s is out of date", filename);
+                munmap ((void *) source, source_size);
+                goto out;
+        }
+        munmap ((void *) source, source_size);
+
+        reader.data = data + sizeof(header);
+        reader.size = header.payload_size;
+        reader.offset = 0;
+        reader.name = source_filename;
+        reader.failed = false;
+
+        op = script_compile_read_op (&reader);
+
+        if (reader.failed || reader.offset != reader.size || !op) {
+                ply_trace ("%s is malformed", filename);
+                script_parse_op_free (op);
+                op = NULL;
+        }
+out:
+        munmap ((void *) data, size);
+        return op;
+}
@@ -0,0 +1,33 @@
+/* script-compile.h - precompiled form of parsed scripts
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifndef SCRIPT_COMPILE_H
+#define SCRIPT_COMPILE_H
+
+#include <stdbool.h>
+
+#include "script.h"
+
+#define SCRIPT_COMPILE_FILE_SUFFIX ".compiled"
+
+bool script_compile_write_file (script_op_t *op,
+                                const char  *source_filename,
+                                const char  *filename);
+script_op_t *script_compile_load_file (const char *source_filename,
+                                       const char *filename);
+
+#endif /* SCRIPT_COMPILE_H */
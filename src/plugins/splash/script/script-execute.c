@@ -27,6 +27,7 @@
 #include "ply-hashtable.h"
 #include "ply-list.h"
 #include "ply-logger.h"
+#include "ply-utils.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
@@ -42,13 +43,168 @@
 #include "script-execute.h"
 #include "script-object.h"
 
+/* Numbers are passed around the evaluator unboxed, and only get an object
+ * once they are stored somewhere or handed to something that wants one.
+ */
+typedef struct
+{
+        script_obj_t   *obj;    /* NULL if the value is just the number */
+        script_number_t number;
+} script_value_t;
+
+static script_value_t script_evaluate_value (script_state_t *state,
+                                             script_exp_t   *exp);
 static script_obj_t *script_evaluate (script_state_t *state,
                                       script_exp_t   *exp);
 static script_return_t script_execute_function_with_parlist (script_state_t    *state,
                                                              script_function_t *function,
+                                                             const char        *name,
                                                              script_obj_t      *this,
                                                              ply_list_t        *parameter_data);
 
+typedef struct
+{
+        const void *key;
+        char       *name;
+        unsigned long call_count;
+        double      inclusive_time;
+        double      exclusive_time;
+        int         depth;
+} script_profile_entry_t;
+
+static bool script_profile_enabled;
+static ply_hashtable_t *script_profile_entries;
+static script_profile_frame_t *script_profile_current_frame;
+
+void script_profile_set_enabled (bool enabled)
+{
+        script_profile_enabled = enabled;
+        if (enabled && !script_profile_entries)
+                script_profile_entries = ply_hashtable_new (NULL, NULL);
+}
+
+bool script_profile_is_enabled (void)
+{
+        return script_profile_enabled;
+}
+
+/* Frames live on the stack of whoever is being timed.  Time spent in a
+ * frame is taken off the exclusive time of the frame it was called from.
+ */
+void script_profile_begin (script_profile_frame_t *frame,
+                           const void             *key,
+                           const char             *name)
+{
+        script_profile_entry_t *entry;
+
+        frame->entry = NULL;
+        if (!script_profile_enabled)
+                return;
+
+        entry = ply_hashtable_lookup (script_profile_entries, (void *) key);
+        if (!entry) {
+                entry = calloc (1, sizeof(script_profile_entry_t));
+                entry->key = key;
+                entry->name = strdup (name ? name : "(anonymous)");
+                ply_hashtable_insert (script_profile_entries, (void *) key, entry);
+        }
+        entry->call_count++;
+        entry->depth++;
+
+        frame->entry = entry;
+        frame->parent = script_profile_current_frame;
+        frame->child_time = 0;
+        frame->start_time = ply_get_timestamp ();
+        script_profile_current_frame = frame;
+}
+
+void script_profile_end (script_profile_frame_t *frame)
+{
+        script_profile_entry_t *entry = frame->entry;
+        double elapsed;
+
+        if (!entry)
+                return;
+
+        elapsed = ply_get_timestamp () - frame->start_time;
+        entry->exclusive_time += elapsed - frame->child_time;
+
+        /* Recursive calls are already inside the outermost one */
+        entry->depth--;
+        if (entry->depth == 0)
+                entry->inclusive_time += elapsed;
+
+        script_profile_current_frame = frame->parent;
+        if (frame->parent)
+                frame->parent->child_time += elapsed;
+}
+
+static void script_profile_collect_entry (void *key,
+                                          void *data,
+                                          void *user_data)
+{
+        ply_list_append_data (user_data, data);
+}
+
+static int script_profile_compare_entries (void *data_a,
+                                           void *data_b)
+{
+        script_profile_entry_t *entry_a = data_a;
+        script_profile_entry_t *entry_b = data_b;
+
+        if (entry_a->exclusive_time > entry_b->exclusive_time)
+                return -1;
+        if (entry_a->exclusive_time < entry_b->exclusive_time)
+                return 1;
+        return 0;
+}
+
+void script_profile_dump (void)
+{
+        ply_list_t *entries;
+        ply_list_node_t *node;
+
+        if (!script_profile_entries)
+                return;
+
+        entries = ply_list_new ();
+        ply_hashtable_foreach (script_profile_entries, script_profile_collect_entry, entries);
+        ply_list_sort_stable (entries, script_profile_compare_entries);
+
+        ply_trace ("script profile: calls, inclusive ms, exclusive ms, name");
+        for (node = ply_list_get_first_node (entries);
+             node;
+             node = ply_list_get_next_node (entries, node)) {
+                script_profile_entry_t *entry = ply_list_node_get_data (node);
+                ply_trace ("%8lu %10.3f %10.3f %s",
+                           entry->call_count,
+                           entry->inclusive_time * 1000,
+                           entry->exclusive_time * 1000,
+                           entry->name);
+        }
+        ply_list_free (entries);
+}
+
+static void script_profile_free_entry (void *key,
+                                       void *data,
+                                       void *user_data)
+{
+        script_profile_entry_t *entry = data;
+
+        free (entry->name);
+        free (entry);
+}
+
+void script_profile_free (void)
+{
+        script_profile_enabled = false;
+        if (!script_profile_entries)
+                return;
+        ply_hashtable_foreach (script_profile_entries, script_profile_free_entry, NULL);
+        ply_hashtable_free (script_profile_entries);
+        script_profile_entries = NULL;
+}
+
 
 static void script_execute_error (void       *element,
                                   const char *message)
@@ -67,42 +223,206 @@ static void script_execute_error (void       *element,
 }
 
 
-static script_obj_t *script_evaluate_apply_function (script_state_t                                                  *state,
-                                                     script_exp_t                                                    *exp,
-                                                     script_obj_t                                                     *(*function)(script_obj_t *,
-                                                                                                         script_obj_t *))
+static script_value_t script_value_number (script_number_t number)
 {
-        script_obj_t *script_obj_a = script_evaluate (state, exp->data.dual.sub_a);
-        script_obj_t *script_obj_b = script_evaluate (state, exp->data.dual.sub_b);
+        script_value_t value = { NULL, number };
+
+        return value;
+}
+
+static script_value_t script_value_obj (script_obj_t *obj)
+{
+        script_value_t value = { obj, 0 };
+
+        return value;
+}
+
+static bool script_value_get_number (script_value_t   value,
+                                     script_number_t *number)
+{
+        script_obj_t *obj;
+
+        if (!value.obj) {
+                *number = value.number;
+                return true;
+        }
+        obj = script_obj_deref_direct (value.obj);
+        if (obj->type != SCRIPT_OBJ_TYPE_NUMBER) {
+                /* Numbers that have been extended are still numbers */
+                obj = script_obj_as_obj_type (value.obj, SCRIPT_OBJ_TYPE_NUMBER);
+                if (!obj)
+                        return false;
+        }
+        *number = obj->data.number;
+        return true;
+}
+
+static bool script_value_as_bool (script_value_t value)
+{                                                 /* Same rules as script_obj_as_bool */
+        int num_type;
+
+        if (value.obj)
+                return script_obj_as_bool (value.obj);
+        num_type = fpclassify (value.number);
+        return num_type != FP_ZERO && num_type != FP_NAN;
+}
+
+static script_obj_t *script_value_box (script_value_t value)
+{
+        if (value.obj)
+                return value.obj;
+        return script_obj_new_number (value.number);
+}
+
+static void script_value_unref (script_value_t value)
+{
+        script_obj_unref (value.obj);
+}
+
+/* Stores a number in a variable, reusing the number object the variable
+ * already points at if nothing else holds it.  Returns a reference to
+ * the stored number.
+ */
+static script_obj_t *script_evaluate_store_number (script_obj_t   *obj,
+                                                   script_number_t number)
+{
+        script_obj_t *number_obj;
+
+        if (obj->type == SCRIPT_OBJ_TYPE_REF &&
+            obj->data.obj->type == SCRIPT_OBJ_TYPE_NUMBER &&
+            obj->data.obj->refcount == 1) {
+                number_obj = obj->data.obj;
+                number_obj->data.number = number;
+                script_obj_ref (number_obj);
+                return number_obj;
+        }
+        number_obj = script_obj_new_number (number);
+        script_obj_assign (obj, number_obj);
+        return number_obj;
+}
+
+static bool script_evaluate_number_operation (script_exp_type_t type,
+                                              script_number_t   number_a,
+                                              script_number_t   number_b,
+                                              script_number_t  *result)
+{
+        switch (type) {
+        case SCRIPT_EXP_TYPE_PLUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_PLUS:
+                *result = number_a + number_b;
+                return true;
+        case SCRIPT_EXP_TYPE_MINUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MINUS:
+                *result = number_a - number_b;
+                return true;
+        case SCRIPT_EXP_TYPE_MUL:
+        case SCRIPT_EXP_TYPE_ASSIGN_MUL:
+                *result = number_a * number_b;
+                return true;
+        case SCRIPT_EXP_TYPE_DIV:
+        case SCRIPT_EXP_TYPE_ASSIGN_DIV:
+                *result = number_a / number_b;
+                return true;
+        case SCRIPT_EXP_TYPE_MOD:
+        case SCRIPT_EXP_TYPE_ASSIGN_MOD:
+                *result = fmodl (number_a, number_b);
+                return true;
+        case SCRIPT_EXP_TYPE_TERM_NULL:
+        case SCRIPT_EXP_TYPE_TERM_NUMBER:
+        case SCRIPT_EXP_TYPE_TERM_STRING:
+        case SCRIPT_EXP_TYPE_TERM_VAR:
+        case SCRIPT_EXP_TYPE_TERM_LOCAL:
+        case SCRIPT_EXP_TYPE_TERM_GLOBAL:
+        case SCRIPT_EXP_TYPE_TERM_THIS:
+        case SCRIPT_EXP_TYPE_TERM_SET:
+        case SCRIPT_EXP_TYPE_GT:
+        case SCRIPT_EXP_TYPE_GE:
+        case SCRIPT_EXP_TYPE_LT:
+        case SCRIPT_EXP_TYPE_LE:
+        case SCRIPT_EXP_TYPE_EQ:
+        case SCRIPT_EXP_TYPE_NE:
+        case SCRIPT_EXP_TYPE_AND:
+        case SCRIPT_EXP_TYPE_OR:
+        case SCRIPT_EXP_TYPE_EXTEND:
+        case SCRIPT_EXP_TYPE_NOT:
+        case SCRIPT_EXP_TYPE_POS:
+        case SCRIPT_EXP_TYPE_NEG:
+        case SCRIPT_EXP_TYPE_PRE_INC:
+        case SCRIPT_EXP_TYPE_PRE_DEC:
+        case SCRIPT_EXP_TYPE_POST_INC:
+        case SCRIPT_EXP_TYPE_POST_DEC:
+        case SCRIPT_EXP_TYPE_HASH:
+        case SCRIPT_EXP_TYPE_FUNCTION_EXE:
+        case SCRIPT_EXP_TYPE_FUNCTION_DEF:
+        case SCRIPT_EXP_TYPE_ASSIGN:
+        case SCRIPT_EXP_TYPE_ASSIGN_EXTEND:
+                break;
+        }
+        return false;
+}
+
+static script_value_t script_evaluate_apply_function (script_state_t                                                  *state,
+                                                      script_exp_t                                                    *exp,
+                                                      script_obj_t                                                     *(*function)(script_obj_t *,
+                                                                                                          script_obj_t *))
+{
+        script_value_t value_a = script_evaluate_value (state, exp->data.dual.sub_a);
+        script_value_t value_b = script_evaluate_value (state, exp->data.dual.sub_b);
+        script_number_t number_a, number_b, result;
+
+        if (script_value_get_number (value_a, &number_a) &&
+            script_value_get_number (value_b, &number_b) &&
+            script_evaluate_number_operation (exp->type, number_a, number_b, &result)) {
+                script_value_unref (value_a);
+                script_value_unref (value_b);
+                return script_value_number (result);
+        }
+
+        script_obj_t *script_obj_a = script_value_box (value_a);
+        script_obj_t *script_obj_b = script_value_box (value_b);
         script_obj_t *obj = function (script_obj_a, script_obj_b);
 
         script_obj_unref (script_obj_a);
         script_obj_unref (script_obj_b);
-        return obj;
+        return script_value_obj (obj);
 }
 
-static script_obj_t *script_evaluate_apply_function_and_assign (script_state_t                                                  *state,
-                                                                script_exp_t                                                    *exp,
-                                                                script_obj_t                                                     *(*function)(script_obj_t *,
-                                                                                                                    script_obj_t *))
+static script_value_t script_evaluate_apply_function_and_assign (script_state_t                                                  *state,
+                                                                 script_exp_t                                                    *exp,
+                                                                 script_obj_t                                                     *(*function)(script_obj_t *,
+                                                                                                                     script_obj_t *))
 {
         script_obj_t *script_obj_a = script_evaluate (state, exp->data.dual.sub_a);
-        script_obj_t *script_obj_b = script_evaluate (state, exp->data.dual.sub_b);
-        script_obj_t *obj = function (script_obj_a, script_obj_b);
+        script_value_t value_b = script_evaluate_value (state, exp->data.dual.sub_b);
+        script_obj_t *target = script_obj_deref_direct (script_obj_a);
+        script_number_t number_b, result;
+        script_obj_t *obj;
+
+        if (target->type == SCRIPT_OBJ_TYPE_NUMBER &&
+            script_value_get_number (value_b, &number_b) &&
+            script_evaluate_number_operation (exp->type, target->data.number, number_b, &result)) {
+                obj = script_evaluate_store_number (script_obj_a, result);
+                script_obj_unref (script_obj_a);
+                script_value_unref (value_b);
+                return script_value_obj (obj);
+        }
+
+        script_obj_t *script_obj_b = script_value_box (value_b);
+        obj = function (script_obj_a, script_obj_b);
 
         script_obj_assign (script_obj_a, obj);
         script_obj_unref (script_obj_a);
         script_obj_unref (script_obj_b);
-        return obj;
+        return script_value_obj (obj);
 }
 
 static script_obj_t *script_evaluate_hash (script_state_t *state,
                                            script_exp_t   *exp)
 {
         script_obj_t *hash = script_evaluate (state, exp->data.dual.sub_a);
-        script_obj_t *key = script_evaluate (state, exp->data.dual.sub_b);
+        script_value_t key;
+        script_number_t index;
         script_obj_t *obj;
-        char *name = script_obj_as_string (key);
 
         if (!script_obj_is_hash (hash)) {
                 script_obj_t *newhash = script_obj_new_hash ();
@@ -110,11 +430,25 @@ static script_obj_t *script_evaluate_hash (script_state_t *state,
                 script_obj_unref (newhash);
         }
 
-        obj = script_obj_hash_get_element (hash, name);
-        free (name);
+        if (exp->data.dual.sub_b->type == SCRIPT_EXP_TYPE_TERM_STRING) {
+                obj = script_obj_hash_get_field (hash,
+                                                 exp->data.dual.sub_b->data.string,
+                                                 &exp->field_cache);
+                script_obj_unref (hash);
+                return obj;
+        }
+
+        key = script_evaluate_value (state, exp->data.dual.sub_b);
+        if (script_value_get_number (key, &index)) {
+                obj = script_obj_hash_get_index (hash, index);
+        } else {
+                char *name = script_obj_as_string (key.obj);
+                obj = script_obj_hash_get_element (hash, name);
+                free (name);
+        }
 
         script_obj_unref (hash);
-        script_obj_unref (key);
+        script_value_unref (key);
         return obj;
 }
 
@@ -122,12 +456,12 @@ static script_obj_t *script_evaluate_var (script_state_t *state,
                                           script_exp_t   *exp)
 {
         char *name = exp->data.string;
-        script_obj_t *obj = script_obj_hash_peek_element (state->local, name);
+        script_obj_t *obj = script_obj_hash_peek_field (state->local, name, &exp->field_cache);
 
         if (obj) return obj;
-        obj = script_obj_hash_peek_element (state->this, name);
+        obj = script_obj_hash_peek_field (state->this, name, &exp->field_cache);
         if (obj) return obj;
-        obj = script_obj_hash_peek_element (state->global, name);
+        obj = script_obj_hash_peek_field (state->global, name, &exp->field_cache);
         if (obj) return obj;
         obj = script_obj_hash_get_element (state->local, name);
         return obj;
@@ -144,11 +478,11 @@ static script_obj_t *script_evaluate_set (script_state_t *state,
         while (node_data) {
                 script_exp_t *data_exp = ply_list_node_get_data (node_data);
                 script_obj_t *data_obj = script_evaluate (state, data_exp);
-                char *name;
-                asprintf (&name, "%d", index);
+                script_obj_t *element = script_obj_hash_get_index (obj, index);
                 index++;
-                script_obj_hash_add_element (obj, data_obj, name);
-                free (name);
+                script_obj_assign (element, data_obj);
+                script_obj_unref (element);
+                script_obj_unref (data_obj);
 
                 node_data = ply_list_get_next_node (parameter_data, node_data);
         }
@@ -159,66 +493,86 @@ static script_obj_t *script_evaluate_assign (script_state_t *state,
                                              script_exp_t   *exp)
 {
         script_obj_t *script_obj_a = script_evaluate (state, exp->data.dual.sub_a);
-        script_obj_t *script_obj_b = script_evaluate (state, exp->data.dual.sub_b);
+        script_value_t value_b = script_evaluate_value (state, exp->data.dual.sub_b);
 
-        script_obj_assign (script_obj_a, script_obj_b);
+        if (!value_b.obj) {
+                script_obj_unref (script_evaluate_store_number (script_obj_a, value_b.number));
+                return script_obj_a;
+        }
+        script_obj_assign (script_obj_a, value_b.obj);
 
-        script_obj_unref (script_obj_b);
+        script_obj_unref (value_b.obj);
         return script_obj_a;
 }
 
-static script_obj_t *script_evaluate_cmp (script_state_t         *state,
-                                          script_exp_t           *exp,
-                                          script_obj_cmp_result_t condition)
+static script_value_t script_evaluate_cmp (script_state_t         *state,
+                                           script_exp_t           *exp,
+                                           script_obj_cmp_result_t condition)
 {
-        script_obj_t *script_obj_a = script_evaluate (state, exp->data.dual.sub_a);
-        script_obj_t *script_obj_b = script_evaluate (state, exp->data.dual.sub_b);
-        script_obj_cmp_result_t cmp_result = script_obj_cmp (script_obj_a, script_obj_b);
-
-        script_obj_unref (script_obj_a);
-        script_obj_unref (script_obj_b);
+        script_value_t value_a = script_evaluate_value (state, exp->data.dual.sub_a);
+        script_value_t value_b = script_evaluate_value (state, exp->data.dual.sub_b);
+        script_number_t number_a, number_b;
+        script_obj_cmp_result_t cmp_result;
+
+        if (script_value_get_number (value_a, &number_a) &&
+            script_value_get_number (value_b, &number_b)) {
+                if (number_a < number_b) cmp_result = SCRIPT_OBJ_CMP_RESULT_LT;
+                else if (number_a > number_b) cmp_result = SCRIPT_OBJ_CMP_RESULT_GT;
+                else if (number_a == number_b) cmp_result = SCRIPT_OBJ_CMP_RESULT_EQ;
+                else cmp_result = SCRIPT_OBJ_CMP_RESULT_NE;
+                script_value_unref (value_a);
+                script_value_unref (value_b);
+        } else {
+                script_obj_t *script_obj_a = script_value_box (value_a);
+                script_obj_t *script_obj_b = script_value_box (value_b);
+                cmp_result = script_obj_cmp (script_obj_a, script_obj_b);
+                script_obj_unref (script_obj_a);
+                script_obj_unref (script_obj_b);
+        }
 
         if (cmp_result & condition)
-                return script_obj_new_number (1);
-        return script_obj_new_number (0);
+                return script_value_number (1);
+        return script_value_number (0);
 }
 
-static script_obj_t *script_evaluate_logic (script_state_t *state,
-                                            script_exp_t   *exp)
+static script_value_t script_evaluate_logic (script_state_t *state,
+                                             script_exp_t   *exp)
 {
-        script_obj_t *obj = script_evaluate (state, exp->data.dual.sub_a);
-
-        if ((exp->type == SCRIPT_EXP_TYPE_AND) && !script_obj_as_bool (obj))
-                return obj;
-        else if (exp->type == SCRIPT_EXP_TYPE_OR && script_obj_as_bool (obj))
-                return obj;
-        script_obj_unref (obj);
-        obj = script_evaluate (state, exp->data.dual.sub_b);
-        return obj;
+        script_value_t value = script_evaluate_value (state, exp->data.dual.sub_a);
+
+        if ((exp->type == SCRIPT_EXP_TYPE_AND) && !script_value_as_bool (value))
+                return value;
+        else if (exp->type == SCRIPT_EXP_TYPE_OR && script_value_as_bool (value))
+                return value;
+        script_value_unref (value);
+        return script_evaluate_value (state, exp->data.dual.sub_b);
 }
 
-static script_obj_t *script_evaluate_unary (script_state_t *state,
-                                            script_exp_t   *exp)
+static script_value_t script_evaluate_unary (script_state_t *state,
+                                             script_exp_t   *exp)
 {
-        script_obj_t *obj = script_evaluate (state, exp->data.sub);
+        script_value_t value;
+        script_number_t number;
+        script_obj_t *obj;
         script_obj_t *new_obj;
 
         if (exp->type == SCRIPT_EXP_TYPE_NOT) {
-                new_obj = script_obj_new_number (!script_obj_as_bool (obj));
-                script_obj_unref (obj);
-                return new_obj;
+                value = script_evaluate_value (state, exp->data.sub);
+                bool truth = script_value_as_bool (value);
+                script_value_unref (value);
+                return script_value_number (!truth);
         }
         if (exp->type == SCRIPT_EXP_TYPE_POS) /* FIXME what should happen on non number operands? */
-                return obj;                   /* Does nothing, maybe just remove at parse stage */
+                return script_evaluate_value (state, exp->data.sub); /* Does nothing, maybe just remove at parse stage */
         if (exp->type == SCRIPT_EXP_TYPE_NEG) {
-                if (script_obj_is_number (obj)) {
-                        new_obj = script_obj_new_number (-script_obj_as_number (obj));
-                } else {
-                        script_execute_error (exp, "Cannot negate non number objects");
-                        new_obj = script_obj_new_null ();
+                value = script_evaluate_value (state, exp->data.sub);
+                if (script_value_get_number (value, &number)) {
+                        script_value_unref (value);
+                        return script_value_number (-number);
                 }
-                script_obj_unref (obj);
-                return new_obj;
+                script_execute_error (exp, "Cannot negate non number objects");
+                script_value_unref (value);
+                return script_value_obj (script_obj_new_null ());
         }
         int change_pre = 0;
         int change = -1;
@@ -230,6 +584,18 @@ static script_obj_t *script_evaluate_unary (script_state_t *state,
             (exp->type == SCRIPT_EXP_TYPE_PRE_DEC))
                 change_pre = 1;
 
+        obj = script_evaluate (state, exp->data.sub);
+        new_obj = script_obj_deref_direct (obj);
+        if (new_obj->type == SCRIPT_OBJ_TYPE_NUMBER) {
+                number = new_obj->data.number;
+                new_obj = script_evaluate_store_number (obj, number + change);
+                script_obj_unref (obj);
+                if (change_pre)
+                        return script_value_obj (new_obj);
+                script_obj_unref (new_obj);
+                return script_value_number (number);
+        }
+
         if (script_obj_is_number (obj)) {
                 if (change_pre) {
                         new_obj = script_obj_new_number (script_obj_as_number (obj) + change);
@@ -247,11 +613,12 @@ static script_obj_t *script_evaluate_unary (script_state_t *state,
                 script_obj_reset (obj);
         }
         script_obj_unref (obj);
-        return new_obj;
+        return script_value_obj (new_obj);
 }
 typedef struct
 {
         script_state_t *state;
+        const char     *name;
         script_obj_t   *this;
         ply_list_t     *parameter_data;
 } script_obj_execute_data_t;
@@ -265,6 +632,7 @@ static void *script_obj_execute (script_obj_t *obj,
                 script_function_t *function = obj->data.function;
                 script_return_t reply = script_execute_function_with_parlist (execute_data->state,
                                                                               function,
+                                                                              execute_data->name,
                                                                               execute_data->this,
                                                                               execute_data->parameter_data);
                 if (reply.type != SCRIPT_RETURN_TYPE_FAIL)
@@ -275,12 +643,14 @@ static void *script_obj_execute (script_obj_t *obj,
 
 static script_return_t script_execute_object_with_parlist (script_state_t *state,
                                                            script_obj_t   *obj,
+                                                           const char     *name,
                                                            script_obj_t   *this,
                                                            ply_list_t     *parameter_data)
 {
         script_obj_execute_data_t execute_data;
 
         execute_data.state = state;
+        execute_data.name = name;
         execute_data.this = this;
         execute_data.parameter_data = parameter_data;
 
@@ -296,26 +666,36 @@ static script_obj_t *script_evaluate_func (script_state_t *state,
         script_obj_t *this_obj = NULL;
         script_obj_t *func_obj;
         script_exp_t *name_exp = exp->data.function_exe.name;
+        char *this_key_name = NULL;
+        const char *func_name = NULL;
 
         if (name_exp->type == SCRIPT_EXP_TYPE_HASH) {
                 script_obj_t *this_key = script_evaluate (state, name_exp->data.dual.sub_b);
                 this_obj = script_evaluate (state, name_exp->data.dual.sub_a);
-                char *this_key_name = script_obj_as_string (this_key);
+                this_key_name = script_obj_as_string (this_key);
                 script_obj_unref (this_key);
-                func_obj = script_obj_hash_peek_element (this_obj, this_key_name);
+                if (name_exp->data.dual.sub_b->type == SCRIPT_EXP_TYPE_TERM_STRING)
+                        func_obj = script_obj_hash_peek_field (this_obj, this_key_name, &name_exp->field_cache);
+                else
+                        func_obj = script_obj_hash_peek_element (this_obj, this_key_name);
 
                 if (!func_obj && script_obj_is_string (this_obj)) {
                         script_obj_t *string_hash = script_obj_hash_peek_element (state->global, "String");
                         func_obj = script_obj_hash_peek_element (string_hash, this_key_name);
                         script_obj_unref (string_hash);
+                } else if (!func_obj && script_obj_is_hash (this_obj)) {
+                        script_obj_t *array_hash = script_obj_hash_peek_element (state->global, "Array");
+                        func_obj = script_obj_hash_peek_element (array_hash, this_key_name);
+                        script_obj_unref (array_hash);
                 }
 
                 if (!func_obj)
                         func_obj = script_obj_hash_get_element (this_obj, this_key_name);
 
-                free (this_key_name);
+                func_name = this_key_name;
         } else if (name_exp->type == SCRIPT_EXP_TYPE_TERM_VAR) {
                 char *name = name_exp->data.string;
+                func_name = name;
                 func_obj = script_obj_hash_peek_element (state->local, name);
                 if (!func_obj) {
                         func_obj = script_obj_hash_peek_element (state->this, name);
@@ -343,7 +723,8 @@ static script_obj_t *script_evaluate_func (script_state_t *state,
                                                           node_expression);
         }
 
-        script_return_t reply = script_execute_object_with_parlist (state, func_obj, this_obj, parameter_data);
+        script_return_t reply = script_execute_object_with_parlist (state, func_obj, func_name, this_obj, parameter_data);
+        free (this_key_name);
 
         ply_list_node_t *node_data = ply_list_get_first_node (parameter_data);
         while (node_data) {
@@ -359,8 +740,8 @@ static script_obj_t *script_evaluate_func (script_state_t *state,
         return reply.object ? reply.object : script_obj_new_null ();
 }
 
-static script_obj_t *script_evaluate (script_state_t *state,
-                                      script_exp_t   *exp)
+static script_value_t script_evaluate_value (script_state_t *state,
+                                             script_exp_t   *exp)
 {
         switch (exp->type) {
         case SCRIPT_EXP_TYPE_PLUS:
@@ -438,50 +819,50 @@ static script_obj_t *script_evaluate (script_state_t *state,
 
         case SCRIPT_EXP_TYPE_TERM_NUMBER:
         {
-                return script_obj_new_number (exp->data.number);
+                return script_value_number (exp->data.number);
         }
 
         case SCRIPT_EXP_TYPE_TERM_STRING:
         {
-                return script_obj_new_string (exp->data.string);
+                return script_value_obj (script_obj_new_string (exp->data.string));
         }
 
         case SCRIPT_EXP_TYPE_TERM_NULL:
         {
-                return script_obj_new_null ();
+                return script_value_obj (script_obj_new_null ());
         }
 
         case SCRIPT_EXP_TYPE_TERM_LOCAL:
         {
                 script_obj_ref (state->local);
-                return state->local;
+                return script_value_obj (state->local);
         }
 
         case SCRIPT_EXP_TYPE_TERM_GLOBAL:
         {
                 script_obj_ref (state->global);
-                return state->global;
+                return script_value_obj (state->global);
         }
 
         case SCRIPT_EXP_TYPE_TERM_THIS:
         {
                 script_obj_ref (state->this);
-                return state->this;
+                return script_value_obj (state->this);
         }
 
         case SCRIPT_EXP_TYPE_TERM_SET:
         {
-                return script_evaluate_set (state, exp);
+                return script_value_obj (script_evaluate_set (state, exp));
         }
 
         case SCRIPT_EXP_TYPE_TERM_VAR:
         {
-                return script_evaluate_var (state, exp);
+                return script_value_obj (script_evaluate_var (state, exp));
         }
 
         case SCRIPT_EXP_TYPE_ASSIGN:
         {
-                return script_evaluate_assign (state, exp);
+                return script_value_obj (script_evaluate_assign (state, exp));
         }
 
         case SCRIPT_EXP_TYPE_ASSIGN_PLUS:
@@ -528,19 +909,25 @@ static script_obj_t *script_evaluate (script_state_t *state,
 
         case SCRIPT_EXP_TYPE_HASH:
         {
-                return script_evaluate_hash (state, exp);
+                return script_value_obj (script_evaluate_hash (state, exp));
         }
 
         case SCRIPT_EXP_TYPE_FUNCTION_EXE:
         {
-                return script_evaluate_func (state, exp);
+                return script_value_obj (script_evaluate_func (state, exp));
         }
         case SCRIPT_EXP_TYPE_FUNCTION_DEF:
         {
-                return script_obj_new_function (exp->data.function_def);
+                return script_value_obj (script_obj_new_function (exp->data.function_def));
         }
         }
-        return script_obj_new_null ();
+        return script_value_obj (script_obj_new_null ());
+}
+
+static script_obj_t *script_evaluate (script_state_t *state,
+                                      script_exp_t   *exp)
+{
+        return script_value_box (script_evaluate_value (state, exp));
 }
 
 static script_return_t script_execute_list (script_state_t *state,
@@ -571,9 +958,12 @@ static script_return_t script_execute_list (script_state_t *state,
 /* parameter_data list should be freed by caller */
 static script_return_t script_execute_function_with_parlist (script_state_t    *state,
                                                              script_function_t *function,
+                                                             const char        *name,
                                                              script_obj_t      *this,
                                                              ply_list_t        *parameter_data)
 {
+        script_profile_frame_t profile_frame;
+
         script_state_t *sub_state = script_state_init_sub (state, this);
         ply_list_t *parameter_names = function->parameters;
         ply_list_node_t *node_name = ply_list_get_first_node (parameter_names);
@@ -606,6 +996,26 @@ static script_return_t script_execute_function_with_parlist (script_state_t    *
         if (this)
                 script_obj_hash_add_element (sub_state->local, this, "this");
 
+        if (script_profile_enabled) {
+                script_debug_location_t *location = NULL;
+                char *profile_name = NULL;
+
+                /* Functions are named after whatever they were first called as */
+                if (!ply_hashtable_lookup (script_profile_entries, function)) {
+                        if (function->type == SCRIPT_FUNCTION_TYPE_SCRIPT)
+                                location = script_debug_lookup_element (function->data.script);
+                        if (location)
+                                asprintf (&profile_name, "%s (%s L:%d)",
+                                          name ? name : "(anonymous)", location->name, location->line_index);
+                        else
+                                asprintf (&profile_name, "%s (native)", name ? name : "(anonymous)");
+                }
+                script_profile_begin (&profile_frame, function, profile_name);
+                free (profile_name);
+        } else {
+                profile_frame.entry = NULL;
+        }
+
         script_return_t reply;
         switch (function->type) {
         case SCRIPT_FUNCTION_TYPE_SCRIPT:
@@ -621,6 +1031,7 @@ static script_return_t script_execute_function_with_parlist (script_state_t    *
                 break;
         }
         }
+        script_profile_end (&profile_frame);
         script_state_destroy (sub_state);
         if (reply.type != SCRIPT_RETURN_TYPE_FAIL)
                 reply.type = SCRIPT_RETURN_TYPE_RETURN;
@@ -646,7 +1057,7 @@ script_return_t script_execute_object (script_state_t *state,
         }
         va_end (args);
 
-        reply = script_execute_object_with_parlist (state, function, this, parameter_data);
+        reply = script_execute_object_with_parlist (state, function, NULL, this, parameter_data);
         ply_list_free (parameter_data);
 
         return reply;
@@ -673,12 +1084,12 @@ script_return_t script_execute (script_state_t *state,
 
         case SCRIPT_OP_TYPE_IF:
         {
-                script_obj_t *obj = script_evaluate (state, op->data.cond_op.cond);
-                if (script_obj_as_bool (obj))
+                script_value_t value = script_evaluate_value (state, op->data.cond_op.cond);
+                if (script_value_as_bool (value))
                         reply = script_execute (state, op->data.cond_op.op1);
                 else
                         reply = script_execute (state, op->data.cond_op.op2);
-                script_obj_unref (obj);
+                script_value_unref (value);
                 break;
         }
 
@@ -686,14 +1097,14 @@ script_return_t script_execute (script_state_t *state,
         case SCRIPT_OP_TYPE_WHILE:
         case SCRIPT_OP_TYPE_FOR:
         {
-                script_obj_t *obj = NULL;
+                script_value_t value;
                 bool cond = false;
                 if (op->type == SCRIPT_OP_TYPE_DO_WHILE) cond = true;
                 while (1) {
                         if (!cond) {
-                                obj = script_evaluate (state, op->data.cond_op.cond);
-                                cond = script_obj_as_bool (obj);
-                                script_obj_unref (obj);
+                                value = script_evaluate_value (state, op->data.cond_op.cond);
+                                cond = script_value_as_bool (value);
+                                script_value_unref (value);
                         }
 
                         if (cond) {
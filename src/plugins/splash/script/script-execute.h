@@ -24,6 +24,14 @@
 
 #include "script.h"
 
+typedef struct script_profile_frame_t
+{
+        struct script_profile_frame_t *parent;
+        void                          *entry;
+        double                         start_time;
+        double                         child_time;
+} script_profile_frame_t;
+
 script_return_t script_execute (script_state_t *state,
                                 script_op_t    *op);
 script_return_t script_execute_object (script_state_t * state,
@@ -32,4 +40,13 @@ script_return_t script_execute_object (script_state_t * state,
                                        script_obj_t * first_arg,
                                        ...);
 
+void script_profile_set_enabled (bool enabled);
+bool script_profile_is_enabled (void);
+void script_profile_begin (script_profile_frame_t *frame,
+                           const void             *key,
+                           const char             *name);
+void script_profile_end (script_profile_frame_t *frame);
+void script_profile_dump (void);
+void script_profile_free (void);
+
 #endif /* SCRIPT_EXECUTE_H */
@@ -34,17 +34,179 @@
 #include "script-execute.h"
 #include "script-lib-image.h"
 #include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "script-lib-image.script.h"
 
+#define DEFAULT_CACHE_BUDGET (8 * 1024 * 1024)
+
+/* Scripts tend to build the same text, or rotate an image to the same
+ * few angles, over and over.  Transformed images are kept around keyed
+ * by their source and parameters, and handed out again for as long as
+ * they fit in the budget.  Image objects are immutable, so several can
+ * share one buffer.
+ */
+typedef struct
+{
+        char               *key;
+        ply_pixel_buffer_t *source;
+        ply_pixel_buffer_t *buffer;
+        size_t              size;
+        int                 reference_count;
+        ply_list_node_t    *node;
+} image_cache_entry_t;
+
+static void image_buffer_free (script_lib_image_data_t *data,
+                               ply_pixel_buffer_t      *buffer);
+
+static void image_cache_entry_free (script_lib_image_data_t *data,
+                                    image_cache_entry_t     *entry)
+{
+        ply_hashtable_remove (data->cache_entries_by_buffer, entry->buffer);
+        image_buffer_free (data, entry->buffer);
+        free (entry);
+}
+
+static void image_cache_evict (script_lib_image_data_t *data,
+                               image_cache_entry_t     *entry)
+{
+        ply_hashtable_remove (data->cache_entries_by_key, entry->key);
+        free (entry->key);
+        entry->key = NULL;
+
+        ply_list_remove_node (data->cache_lru, entry->node);
+        entry->node = NULL;
+
+        if (entry->source != NULL) {
+                ply_list_t *entries = ply_hashtable_lookup (data->cache_entries_by_source,
+                                                            entry->source);
+
+                ply_list_remove_data (entries, entry);
+                if (ply_list_get_length (entries) == 0) {
+                        ply_hashtable_remove (data->cache_entries_by_source, entry->source);
+                        ply_list_free (entries);
+                }
+        }
+
+        data->cache_size -= entry->size;
+        data->cache_evictions++;
+
+        /* Images still held by the script go when their last object does */
+        if (entry->reference_count == 0)
+                image_cache_entry_free (data, entry);
+}
+
+/* Buffer addresses get reused, so anything derived from a buffer has to
+ * be dropped along with it
+ */
+static void image_buffer_free (script_lib_image_data_t *data,
+                               ply_pixel_buffer_t      *buffer)
+{
+        ply_list_t *entries;
+
+        while ((entries = ply_hashtable_lookup (data->cache_entries_by_source, buffer)) != NULL) {
+                image_cache_evict (data,
+                                   ply_list_node_get_data (ply_list_get_first_node (entries)));
+        }
+
+        ply_pixel_buffer_free (buffer);
+}
+
+static script_obj_t *image_cache_new_object (script_lib_image_data_t *data,
+                                             image_cache_entry_t     *entry)
+{
+        entry->reference_count++;
+        return script_obj_new_native (entry->buffer, data->class);
+}
+
+static image_cache_entry_t *image_cache_lookup (script_lib_image_data_t *data,
+                                                const char              *key)
+{
+        image_cache_entry_t *entry;
+
+        entry = ply_hashtable_lookup (data->cache_entries_by_key, (void *) key);
+
+        if (entry == NULL) {
+                data->cache_misses++;
+                return NULL;
+        }
+
+        data->cache_hits++;
+        ply_list_remove_node (data->cache_lru, entry->node);
+        entry->node = ply_list_append_data (data->cache_lru, entry);
+
+        return entry;
+}
+
+/* Takes ownership of key and buffer, and returns a new image object for
+ * the buffer
+ */
+static script_obj_t *image_cache_add (script_lib_image_data_t *data,
+                                      char                    *key,
+                                      ply_pixel_buffer_t      *source,
+                                      ply_pixel_buffer_t      *buffer)
+{
+        image_cache_entry_t *entry;
+        ply_list_t *entries;
+        size_t size;
+
+        size = (size_t) ply_pixel_buffer_get_width (buffer) *
+               ply_pixel_buffer_get_height (buffer) * sizeof(uint32_t);
+
+        if (size > data->cache_budget) {
+                free (key);
+                return script_obj_new_native (buffer, data->class);
+        }
+
+        while (data->cache_size + size > data->cache_budget) {
+                image_cache_evict (data,
+                                   ply_list_node_get_data (ply_list_get_first_node (data->cache_lru)));
+        }
+
+        entry = calloc (1, sizeof(image_cache_entry_t));
+        entry->key = key;
+        entry->source = source;
+        entry->buffer = buffer;
+        entry->size = size;
+        entry->node = ply_list_append_data (data->cache_lru, entry);
+
+        ply_hashtable_insert (data->cache_entries_by_key, entry->key, entry);
+        ply_hashtable_insert (data->cache_entries_by_buffer, entry->buffer, entry);
+
+        if (source != NULL) {
+                entries = ply_hashtable_lookup (data->cache_entries_by_source, source);
+                if (entries == NULL) {
+                        entries = ply_list_new ();
+                        ply_hashtable_insert (data->cache_entries_by_source, source, entries);
+                }
+                ply_list_append_data (entries, entry);
+        }
+
+        data->cache_size += size;
+
+        return image_cache_new_object (data, entry);
+}
+
 static void image_free (script_obj_t *obj)
 {
+        script_lib_image_data_t *data = obj->data.native.class->user_data;
         ply_pixel_buffer_t *image = obj->data.native.object_data;
+        image_cache_entry_t *entry;
+
+        entry = ply_hashtable_lookup (data->cache_entries_by_buffer, image);
+
+        if (entry == NULL) {
+                image_buffer_free (data, image);
+                return;
+        }
+
+        entry->reference_count--;
 
-        ply_pixel_buffer_free (image);
+        if (entry->reference_count == 0 && entry->node == NULL)
+                image_cache_entry_free (data, entry);
 }
 
 static script_return_t image_new (script_state_t *state,
@@ -118,15 +280,27 @@ static script_return_t image_rotate (script_state_t *state,
         script_lib_image_data_t *data = user_data;
         ply_pixel_buffer_t *image = script_obj_as_native_of_class (state->this, data->class);
         float angle = script_obj_hash_get_number (state->local, "angle");
+        image_cache_entry_t *entry;
         ply_rectangle_t size;
+        char *key;
 
         if (image) {
+                asprintf (&key, "rotate %p %a", image, angle);
+                entry = image_cache_lookup (data, key);
+                if (entry != NULL) {
+                        free (key);
+                        return script_return_obj (image_cache_new_object (data, entry));
+                }
+
+                if (data->rotation_cache_steps > 0)
+                        ply_pixel_buffer_enable_rotation_cache (image, data->rotation_cache_steps);
+
                 ply_pixel_buffer_get_size (image, &size);
                 ply_pixel_buffer_t *new_image = ply_pixel_buffer_rotate (image,
                                                                          size.width / 2,
                                                                          size.height / 2,
                                                                          angle);
-                return script_return_obj (script_obj_new_native (new_image, data->class));
+                return script_return_obj (image_cache_add (data, key, image, new_image));
         }
         return script_return_obj_null ();
 }
@@ -138,10 +312,19 @@ static script_return_t image_scale (script_state_t *state,
         ply_pixel_buffer_t *image = script_obj_as_native_of_class (state->this, data->class);
         int width = script_obj_hash_get_number (state->local, "width");
         int height = script_obj_hash_get_number (state->local, "height");
+        image_cache_entry_t *entry;
+        char *key;
 
         if (image) {
+                asprintf (&key, "scale %p %d %d", image, width, height);
+                entry = image_cache_lookup (data, key);
+                if (entry != NULL) {
+                        free (key);
+                        return script_return_obj (image_cache_new_object (data, entry));
+                }
+
                 ply_pixel_buffer_t *new_image = ply_pixel_buffer_resize (image, width, height);
-                return script_return_obj (script_obj_new_native (new_image, data->class));
+                return script_return_obj (image_cache_add (data, key, image, new_image));
         }
         return script_return_obj_null ();
 }
@@ -153,9 +336,11 @@ static script_return_t image_text (script_state_t *state,
         ply_pixel_buffer_t *image;
         ply_label_t *label;
         script_obj_t *alpha_obj, *font_obj, *align_obj;
+        image_cache_entry_t *entry;
         int width, height;
         int align = PLY_LABEL_ALIGN_LEFT;
         char *font;
+        char *key;
 
         char *text = script_obj_hash_get_string (state->local, "text");
 
@@ -205,6 +390,21 @@ static script_return_t image_text (script_state_t *state,
                 return script_return_obj_null ();
         }
 
+        /* The font goes in with its length and the text goes last, so
+         * no two different requests can end up with the same key
+         */
+        asprintf (&key, "text %a %a %a %a %d %d:%s %s",
+                  red, green, blue, alpha, align,
+                  font ? (int) strlen (font) : -1, font ? font : "",
+                  text);
+        entry = image_cache_lookup (data, key);
+        if (entry != NULL) {
+                free (key);
+                free (text);
+                free (font);
+                return script_return_obj (image_cache_new_object (data, entry));
+        }
+
         label = ply_label_new ();
         ply_label_set_text (label, text);
         if (font)
@@ -223,7 +423,7 @@ static script_return_t image_text (script_state_t *state,
         free (font);
         ply_label_free (label);
 
-        return script_return_obj (script_obj_new_native (image, data->class));
+        return script_return_obj (image_cache_add (data, key, NULL, image));
 }
 
 script_lib_image_data_t *script_lib_image_setup (script_state_t *state,
@@ -233,6 +433,20 @@ script_lib_image_data_t *script_lib_image_setup (script_state_t *state,
 
         data->class = script_obj_native_class_new (image_free, "image", data);
         data->image_dir = strdup (image_dir);
+        data->rotation_cache_steps = 0;
+
+        data->cache_lru = ply_list_new ();
+        data->cache_entries_by_key = ply_hashtable_new (ply_hashtable_string_hash,
+                                                        ply_hashtable_string_compare);
+        data->cache_entries_by_buffer = ply_hashtable_new (ply_hashtable_direct_hash,
+                                                           ply_hashtable_direct_compare);
+        data->cache_entries_by_source = ply_hashtable_new (ply_hashtable_direct_hash,
+                                                           ply_hashtable_direct_compare);
+        data->cache_size = 0;
+        data->cache_budget = DEFAULT_CACHE_BUDGET;
+        data->cache_hits = 0;
+        data->cache_misses = 0;
+        data->cache_evictions = 0;
 
         script_obj_t *image_hash = script_obj_hash_get_element (state->global, "Image");
 
@@ -285,8 +499,33 @@ script_lib_image_data_t *script_lib_image_setup (script_state_t *state,
         return data;
 }
 
+void script_lib_image_set_cache_budget (script_lib_image_data_t *data,
+                                        size_t                   budget)
+{
+        data->cache_budget = budget;
+
+        while (data->cache_size > data->cache_budget) {
+                image_cache_evict (data,
+                                   ply_list_node_get_data (ply_list_get_first_node (data->cache_lru)));
+        }
+}
+
 void script_lib_image_destroy (script_lib_image_data_t *data)
 {
+        ply_list_node_t *node;
+
+        ply_trace ("image cache: %lu hits, %lu misses, %lu evictions, %zu bytes in use",
+                   data->cache_hits, data->cache_misses, data->cache_evictions,
+                   data->cache_size);
+
+        while ((node = ply_list_get_first_node (data->cache_lru)) != NULL) {
+                image_cache_evict (data, ply_list_node_get_data (node));
+        }
+        ply_list_free (data->cache_lru);
+        ply_hashtable_free (data->cache_entries_by_key);
+        ply_hashtable_free (data->cache_entries_by_buffer);
+        ply_hashtable_free (data->cache_entries_by_source);
+
         script_obj_native_class_destroy (data->class);
         free (data->image_dir);
         script_parse_op_free (data->script_main_op);
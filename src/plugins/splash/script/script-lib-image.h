@@ -22,6 +22,10 @@
 #ifndef SCRIPT_LIB_IMAGE_H
 #define SCRIPT_LIB_IMAGE_H
 
+#include <stddef.h>
+
+#include "ply-hashtable.h"
+#include "ply-list.h"
 #include "script.h"
 
 typedef struct
@@ -29,10 +33,24 @@ typedef struct
         script_obj_native_class_t *class;
         script_op_t               *script_main_op;
         char                      *image_dir;
+        int                        rotation_cache_steps;
+
+        /* Results of Rotate, Scale and Text, least recently used first */
+        ply_list_t                *cache_lru;
+        ply_hashtable_t           *cache_entries_by_key;
+        ply_hashtable_t           *cache_entries_by_buffer;
+        ply_hashtable_t           *cache_entries_by_source;
+        size_t                     cache_size;
+        size_t                     cache_budget;
+        unsigned long              cache_hits;
+        unsigned long              cache_misses;
+        unsigned long              cache_evictions;
 } script_lib_image_data_t;
 
 script_lib_image_data_t *script_lib_image_setup (script_state_t *state,
                                                  char           *image_dir);
+void script_lib_image_set_cache_budget (script_lib_image_data_t *data,
+                                        size_t                   budget);
 void script_lib_image_destroy (script_lib_image_data_t *data);
 
 #endif /* SCRIPT_LIB_IMAGE_H */
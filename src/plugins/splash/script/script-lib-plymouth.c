@@ -57,6 +57,13 @@ static script_return_t plymouth_set_refresh_rate (script_state_t *state,
       return script_return_obj_null ();
 }
 
+static script_return_t plymouth_dump_profile (script_state_t *state,
+                                              void           *user_data)
+{
+        script_profile_dump ();
+        return script_return_obj_null ();
+}
+
 static script_return_t plymouth_get_mode (script_state_t *state,
                                           void           *user_data)
 {
@@ -180,6 +187,11 @@ script_lib_plymouth_data_t *script_lib_plymouth_setup (script_state_t        *st
                                     plymouth_get_mode,
                                     data,
                                     NULL);
+        script_add_native_function (plymouth_hash,
+                                    "DumpProfile",
+                                    plymouth_dump_profile,
+                                    NULL,
+                                    NULL);
         script_add_native_function (plymouth_hash,
                                     "SetSystemUpdateFunction",
                                     plymouth_set_function,
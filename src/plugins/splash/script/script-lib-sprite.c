@@ -33,16 +33,304 @@
 #include "script-lib-image.h"
 #include "script-lib-sprite.h"
 #include <assert.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <math.h>
 
 #include "script-lib-sprite.script.h"
 
+/* Side of the square cells the displays are split into for finding
+ * the sprites that overlap an area
+ */
+#define GRID_CELL_SIZE 128
+
+static int
+sprite_compare_z (void *data_a, void *data_b)
+{
+        sprite_t *sprite_a = data_a;
+        sprite_t *sprite_b = data_b;
+
+        if (sprite_a->z != sprite_b->z)
+                return sprite_a->z < sprite_b->z ? -1 : 1;
+
+        if (sprite_a->serial != sprite_b->serial)
+                return sprite_a->serial < sprite_b->serial ? -1 : 1;
+
+        return 0;
+}
+
+static int
+sprite_compare_z_indirect (const void *element_a, const void *element_b)
+{
+        return sprite_compare_z (*(sprite_t **) element_a, *(sprite_t **) element_b);
+}
+
+static void sprite_mark_dirty (sprite_t *sprite)
+{
+        if (sprite->is_dirty)
+                return;
+
+        sprite->is_dirty = true;
+        ply_list_append_data (sprite->data->dirty_sprites, sprite);
+}
+
+/* Moves a sprite whose z changed to its place in the sorted list, only
+ * looking as far as it has to go
+ */
+static void sprite_update_z_order (sprite_t *sprite)
+{
+        ply_list_t *sprite_list = sprite->data->sprite_list;
+        ply_list_node_t *node, *next_node;
+
+        node = ply_list_get_previous_node (sprite_list, sprite->node);
+
+        if (node != NULL && sprite_compare_z (ply_list_node_get_data (node), sprite) > 0) {
+                do {
+                        node = ply_list_get_previous_node (sprite_list, node);
+                } while (node != NULL && sprite_compare_z (ply_list_node_get_data (node), sprite) > 0);
+        } else {
+                node = ply_list_get_next_node (sprite_list, sprite->node);
+
+                if (node == NULL || sprite_compare_z (sprite, ply_list_node_get_data (node)) < 0)
+                        return;
+
+                while ((next_node = ply_list_get_next_node (sprite_list, node)) != NULL &&
+                       sprite_compare_z (sprite, ply_list_node_get_data (next_node)) > 0) {
+                        node = next_node;
+                }
+        }
+
+        ply_list_remove_node (sprite_list, sprite->node);
+        sprite->node = ply_list_insert_data (sprite_list, sprite, node);
+}
+
+static void sprite_grid_remove (sprite_t *sprite)
+{
+        script_lib_sprite_data_t *data = sprite->data;
+        int column, row;
+
+        if (!sprite->is_in_grid)
+                return;
+
+        for (row = sprite->grid_top; row <= sprite->grid_bottom; row++) {
+                for (column = sprite->grid_left; column <= sprite->grid_right; column++) {
+                        ply_list_remove_data (data->grid_cells[row * data->grid_columns + column],
+                                              sprite);
+                }
+        }
+
+        sprite->is_in_grid = false;
+}
+
+static void sprite_grid_add (sprite_t *sprite,
+                             int       left,
+                             int       top,
+                             int       right,
+                             int       bottom)
+{
+        script_lib_sprite_data_t *data = sprite->data;
+        int column, row;
+
+        for (row = top; row <= bottom; row++) {
+                for (column = left; column <= right; column++) {
+                        ply_list_append_data (data->grid_cells[row * data->grid_columns + column],
+                                              sprite);
+                }
+        }
+
+        sprite->grid_left = left;
+        sprite->grid_top = top;
+        sprite->grid_right = right;
+        sprite->grid_bottom = bottom;
+        sprite->is_in_grid = true;
+}
+
+/* Finds the cells overlapped by an area, returning false if it misses
+ * the grid entirely
+ */
+static bool grid_get_cells (script_lib_sprite_data_t *data,
+                            long                      x,
+                            long                      y,
+                            unsigned long             width,
+                            unsigned long             height,
+                            int                      *left,
+                            int                      *top,
+                            int                      *right,
+                            int                      *bottom)
+{
+        x -= data->grid_area.x;
+        y -= data->grid_area.y;
+
+        if (width == 0 || height == 0 ||
+            x >= (long) data->grid_area.width || y >= (long) data->grid_area.height ||
+            x + (long) width <= 0 || y + (long) height <= 0)
+                return false;
+
+        *left = MAX (x, 0) / GRID_CELL_SIZE;
+        *top = MAX (y, 0) / GRID_CELL_SIZE;
+        *right = MIN (x + (long) width, (long) data->grid_area.width) - 1;
+        *bottom = MIN (y + (long) height, (long) data->grid_area.height) - 1;
+        *right /= GRID_CELL_SIZE;
+        *bottom /= GRID_CELL_SIZE;
+
+        return true;
+}
+
+static void grid_rebuild (script_lib_sprite_data_t *data);
+
+static void sprite_grid_update (sprite_t *sprite)
+{
+        script_lib_sprite_data_t *data = sprite->data;
+        int left, top, right, bottom;
+
+        if (data->grid_is_stale) {
+                grid_rebuild (data);
+                return;
+        }
+
+        if (sprite->image == NULL || sprite->remove_me ||
+            !grid_get_cells (data, sprite->x, sprite->y,
+                             ply_pixel_buffer_get_width (sprite->image),
+                             ply_pixel_buffer_get_height (sprite->image),
+                             &left, &top, &right, &bottom)) {
+                sprite_grid_remove (sprite);
+                return;
+        }
+
+        if (sprite->is_in_grid &&
+            sprite->grid_left == left && sprite->grid_top == top &&
+            sprite->grid_right == right && sprite->grid_bottom == bottom)
+                return;
+
+        sprite_grid_remove (sprite);
+        sprite_grid_add (sprite, left, top, right, bottom);
+}
+
+static void grid_free_cells (script_lib_sprite_data_t *data)
+{
+        int i;
+
+        for (i = 0; i < data->grid_columns * data->grid_rows; i++) {
+                ply_list_free (data->grid_cells[i]);
+        }
+        free (data->grid_cells);
+
+        data->grid_cells = NULL;
+        data->grid_columns = 0;
+        data->grid_rows = 0;
+}
+
+static void grid_rebuild (script_lib_sprite_data_t *data)
+{
+        ply_list_node_t *node;
+        long left, top, right, bottom;
+        int i;
+
+        grid_free_cells (data);
+
+        left = top = LONG_MAX;
+        right = bottom = LONG_MIN;
+        for (node = ply_list_get_first_node (data->displays);
+             node;
+             node = ply_list_get_next_node (data->displays, node)) {
+                script_lib_display_t *display = ply_list_node_get_data (node);
+
+                left = MIN (left, display->x);
+                top = MIN (top, display->y);
+                right = MAX (right, display->x + (long) ply_pixel_display_get_width (display->pixel_display));
+                bottom = MAX (bottom, display->y + (long) ply_pixel_display_get_height (display->pixel_display));
+        }
+
+        if (right <= left || bottom <= top) {
+                data->grid_area.x = 0;
+                data->grid_area.y = 0;
+                data->grid_area.width = 0;
+                data->grid_area.height = 0;
+        } else {
+                data->grid_area.x = left;
+                data->grid_area.y = top;
+                data->grid_area.width = right - left;
+                data->grid_area.height = bottom - top;
+        }
+
+        data->grid_columns = (data->grid_area.width + GRID_CELL_SIZE - 1) / GRID_CELL_SIZE;
+        data->grid_rows = (data->grid_area.height + GRID_CELL_SIZE - 1) / GRID_CELL_SIZE;
+        data->grid_cells = calloc (MAX (data->grid_columns * data->grid_rows, 1), sizeof(ply_list_t *));
+        for (i = 0; i < data->grid_columns * data->grid_rows; i++) {
+                data->grid_cells[i] = ply_list_new ();
+        }
+
+        data->grid_is_stale = false;
+
+        for (node = ply_list_get_first_node (data->sprite_list);
+             node;
+             node = ply_list_get_next_node (data->sprite_list, node)) {
+                sprite_t *sprite = ply_list_node_get_data (node);
+
+                sprite->is_in_grid = false;
+                sprite_grid_update (sprite);
+        }
+}
+
+/* Collects the sprites that might overlap an area, bottom to top, into
+ * a newly allocated array
+ */
+static int grid_find_sprites (script_lib_sprite_data_t *data,
+                              long                      x,
+                              long                      y,
+                              unsigned long             width,
+                              unsigned long             height,
+                              sprite_t               ***sprites)
+{
+        int left, top, right, bottom, column, row;
+        int number_of_sprites = 0, capacity = 16;
+
+        if (data->grid_is_stale)
+                grid_rebuild (data);
+
+        *sprites = malloc (capacity * sizeof(sprite_t *));
+
+        if (!grid_get_cells (data, x, y, width, height, &left, &top, &right, &bottom))
+                return 0;
+
+        /* Big sprites sit in many cells, so mark the ones already seen */
+        data->grid_query_stamp++;
+
+        for (row = top; row <= bottom; row++) {
+                for (column = left; column <= right; column++) {
+                        ply_list_t *cell = data->grid_cells[row * data->grid_columns + column];
+                        ply_list_node_t *node;
+
+                        for (node = ply_list_get_first_node (cell);
+                             node;
+                             node = ply_list_get_next_node (cell, node)) {
+                                sprite_t *sprite = ply_list_node_get_data (node);
+
+                                if (sprite->grid_query_stamp == data->grid_query_stamp)
+                                        continue;
+                                sprite->grid_query_stamp = data->grid_query_stamp;
+
+                                if (number_of_sprites == capacity) {
+                                        capacity *= 2;
+                                        *sprites = realloc (*sprites, capacity * sizeof(sprite_t *));
+                                }
+                                (*sprites)[number_of_sprites++] = sprite;
+                        }
+                }
+        }
+
+        qsort (*sprites, number_of_sprites, sizeof(sprite_t *), sprite_compare_z_indirect);
+
+        return number_of_sprites;
+}
+
 static void sprite_free (script_obj_t *obj)
 {
         sprite_t *sprite = obj->data.native.object_data;
 
         sprite->remove_me = true;
+        sprite_grid_remove (sprite);
+        sprite_mark_dirty (sprite);
 }
 
 static script_return_t sprite_new (script_state_t *state,
@@ -67,7 +355,10 @@ static script_return_t sprite_new (script_state_t *state,
         sprite->remove_me = false;
         sprite->image = NULL;
         sprite->image_obj = NULL;
-        ply_list_append_data (data->sprite_list, sprite);
+        sprite->data = data;
+        sprite->serial = data->next_sprite_serial++;
+        sprite->node = ply_list_append_data (data->sprite_list, sprite);
+        sprite_update_z_order (sprite);
 
         reply = script_obj_new_native (sprite, data->class);
         return script_return_obj (reply);
@@ -104,6 +395,8 @@ static script_return_t sprite_set_image (script_state_t *state,
                 sprite->image = image;
                 sprite->image_obj = script_obj_image;
                 sprite->refresh_me = true;
+                sprite_grid_update (sprite);
+                sprite_mark_dirty (sprite);
         }
         script_obj_unref (script_obj_image);
 
@@ -160,8 +453,11 @@ static script_return_t sprite_set_x (script_state_t *state,
         script_lib_sprite_data_t *data = user_data;
         sprite_t *sprite = script_obj_as_native_of_class (state->this, data->class);
 
-        if (sprite)
+        if (sprite) {
                 sprite->x = script_obj_hash_get_number (state->local, "value");
+                sprite_grid_update (sprite);
+                sprite_mark_dirty (sprite);
+        }
         return script_return_obj_null ();
 }
 
@@ -171,8 +467,11 @@ static script_return_t sprite_set_y (script_state_t *state,
         script_lib_sprite_data_t *data = user_data;
         sprite_t *sprite = script_obj_as_native_of_class (state->this, data->class);
 
-        if (sprite)
+        if (sprite) {
                 sprite->y = script_obj_hash_get_number (state->local, "value");
+                sprite_grid_update (sprite);
+                sprite_mark_dirty (sprite);
+        }
         return script_return_obj_null ();
 }
 
@@ -182,8 +481,15 @@ static script_return_t sprite_set_z (script_state_t *state,
         script_lib_sprite_data_t *data = user_data;
         sprite_t *sprite = script_obj_as_native_of_class (state->this, data->class);
 
-        if (sprite)
-                sprite->z = script_obj_hash_get_number (state->local, "value");
+        if (sprite) {
+                int z = script_obj_hash_get_number (state->local, "value");
+
+                if (sprite->z != z) {
+                        sprite->z = z;
+                        sprite_update_z_order (sprite);
+                        sprite_mark_dirty (sprite);
+                }
+        }
         return script_return_obj_null ();
 }
 
@@ -193,11 +499,94 @@ static script_return_t sprite_set_opacity (script_state_t *state,
         script_lib_sprite_data_t *data = user_data;
         sprite_t *sprite = script_obj_as_native_of_class (state->this, data->class);
 
-        if (sprite)
+        if (sprite) {
                 sprite->opacity = script_obj_hash_get_number (state->local, "value");
+                sprite_mark_dirty (sprite);
+        }
         return script_return_obj_null ();
 }
 
+/* Gets the value for the index-th sprite of a batch from an argument that
+ * is either an array with a value per sprite or a single value for all
+ */
+static bool sprite_batch_get_value (script_obj_t *values,
+                                    int           index,
+                                    double       *value)
+{
+        script_obj_t *obj;
+        bool found;
+
+        if (script_obj_is_number (values)) {
+                *value = script_obj_as_number (values);
+                return true;
+        }
+
+        obj = script_obj_hash_peek_index (values, index);
+        found = obj && script_obj_is_number (obj);
+        if (found)
+                *value = script_obj_as_number (obj);
+        return found;
+}
+
+/* Sets any of the position, z and opacity of a whole array of sprites in
+ * one call.  Arguments left out, or array entries that are not numbers,
+ * leave that property of the sprite as it is.
+ */
+static script_return_t sprite_set_many (script_state_t *state,
+                                        void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        script_obj_t *sprites = script_obj_hash_get_element (state->local, "sprites");
+        script_obj_t *x_values = script_obj_hash_get_element (state->local, "x");
+        script_obj_t *y_values = script_obj_hash_get_element (state->local, "y");
+        script_obj_t *z_values = script_obj_hash_get_element (state->local, "z");
+        script_obj_t *opacity_values = script_obj_hash_get_element (state->local, "opacity");
+        int count = script_obj_hash_get_length (sprites);
+        int updated = 0;
+        int i;
+
+        for (i = 0; i < count; i++) {
+                script_obj_t *sprite_obj = script_obj_hash_peek_index (sprites, i);
+                sprite_t *sprite = script_obj_as_native_of_class (sprite_obj, data->class);
+                bool moved = false, changed = false;
+                double value;
+
+                if (!sprite)
+                        continue;
+
+                if (sprite_batch_get_value (x_values, i, &value) && sprite->x != (int) value) {
+                        sprite->x = value;
+                        moved = true;
+                }
+                if (sprite_batch_get_value (y_values, i, &value) && sprite->y != (int) value) {
+                        sprite->y = value;
+                        moved = true;
+                }
+                if (sprite_batch_get_value (z_values, i, &value) && sprite->z != (int) value) {
+                        sprite->z = value;
+                        sprite_update_z_order (sprite);
+                        changed = true;
+                }
+                if (sprite_batch_get_value (opacity_values, i, &value) && sprite->opacity != value) {
+                        sprite->opacity = value;
+                        changed = true;
+                }
+
+                if (moved)
+                        sprite_grid_update (sprite);
+                if (moved || changed)
+                        sprite_mark_dirty (sprite);
+                updated++;
+        }
+
+        script_obj_unref (sprites);
+        script_obj_unref (x_values);
+        script_obj_unref (y_values);
+        script_obj_unref (z_values);
+        script_obj_unref (opacity_values);
+        return script_return_obj (script_obj_new_number (updated));
+}
+
 static script_return_t sprite_window_get_width (script_state_t *state,
                                                 void           *user_data)
 {
@@ -360,6 +749,7 @@ static script_return_t sprite_window_set_x (script_state_t *state,
                 if (display->x != x) {
                         display->x = x;
                         data->full_refresh = true;
+                        data->grid_is_stale = true;
                 }
         }
         return script_return_obj_null ();
@@ -382,6 +772,7 @@ static script_return_t sprite_window_set_y (script_state_t *state,
                 if (display->y != y) {
                         display->y = y;
                         data->full_refresh = true;
+                        data->grid_is_stale = true;
                 }
         }
         return script_return_obj_null ();
@@ -432,6 +823,68 @@ static void script_lib_draw_brackground (ply_pixel_buffer_t *pixel_buffer,
         }
 }
 
+/* Sprites drawn on top of an opaque one are the only thing that can
+ * show through it, so sprites (and background) fully behind one can be
+ * skipped.  Only a handful of the topmost opaque sprites are tracked,
+ * which covers the usual case of a few big panels.
+ */
+#define MAX_OCCLUDERS 8
+
+typedef struct
+{
+        sprite_t       *sprite;
+        int             x;
+        int             y;
+        ply_rectangle_t area; /* the part of the sprite inside the clip area */
+        bool            is_hidden;
+} visible_sprite_t;
+
+static bool rectangle_contains (ply_rectangle_t *outer,
+                                ply_rectangle_t *inner)
+{
+        return inner->x >= outer->x &&
+               inner->y >= outer->y &&
+               inner->x + (long) inner->width <= outer->x + (long) outer->width &&
+               inner->y + (long) inner->height <= outer->y + (long) outer->height;
+}
+
+/* Draws the background everywhere in clip_area except for hole, which
+ * has to lie within clip_area
+ */
+static void script_lib_draw_background_around (ply_pixel_buffer_t       *pixel_buffer,
+                                                ply_rectangle_t          *clip_area,
+                                                ply_rectangle_t          *hole,
+                                                script_lib_sprite_data_t *data)
+{
+        ply_rectangle_t piece;
+
+        if (hole->width == 0 || hole->height == 0) {
+                script_lib_draw_brackground (pixel_buffer, clip_area, data);
+                return;
+        }
+
+        piece = *clip_area;
+        piece.height = hole->y - clip_area->y;
+        if (piece.height > 0)
+                script_lib_draw_brackground (pixel_buffer, &piece, data);
+
+        piece.y = hole->y + hole->height;
+        piece.height = clip_area->y + clip_area->height - piece.y;
+        if (piece.height > 0)
+                script_lib_draw_brackground (pixel_buffer, &piece, data);
+
+        piece.y = hole->y;
+        piece.height = hole->height;
+        piece.width = hole->x - clip_area->x;
+        if (piece.width > 0)
+                script_lib_draw_brackground (pixel_buffer, &piece, data);
+
+        piece.x = hole->x + hole->width;
+        piece.width = clip_area->x + clip_area->width - piece.x;
+        if (piece.width > 0)
+                script_lib_draw_brackground (pixel_buffer, &piece, data);
+}
+
 static void script_lib_sprite_draw_area (script_lib_display_t *display,
                                          ply_pixel_buffer_t   *pixel_buffer,
                                          int                   x,
@@ -440,41 +893,33 @@ static void script_lib_sprite_draw_area (script_lib_display_t *display,
                                          int                   height)
 {
         ply_rectangle_t clip_area;
-        ply_list_node_t *node;
+        ply_rectangle_t occluders[MAX_OCCLUDERS];
         sprite_t *sprite;
+        sprite_t **candidates;
+        int number_of_candidates;
         script_lib_sprite_data_t *data = display->data;
+        visible_sprite_t *visible_sprites;
+        int number_of_visible_sprites = 0;
+        int number_of_occluders = 0;
+        int first_drawn_sprite = 0;
+        int i, j, k;
 
         clip_area.x = x;
         clip_area.y = y;
         clip_area.width = width;
         clip_area.height = height;
 
+        number_of_candidates = grid_find_sprites (data,
+                                                  x + display->x, y + display->y,
+                                                  width, height,
+                                                  &candidates);
+        visible_sprites = malloc (MAX (number_of_candidates, 1) * sizeof(visible_sprite_t));
 
-        node = ply_list_get_first_node (data->sprite_list);
-        sprite = ply_list_node_get_data (node);
-
-        /* Check If the first sprite should be rendered opaque */
-        if (sprite->image && !sprite->remove_me &&
-            ply_pixel_buffer_is_opaque (sprite->image) && sprite->opacity == 1.0)  {
-                int position_x = sprite->x - display->x;
-                int position_y = sprite->y - display->y;
-
-                /* In that case only draw the background if the sprite doesn't
-                 * cover the complete area */
-                if (position_x > x || position_y > y ||
-                    ((int)ply_pixel_buffer_get_width (sprite->image) + position_x) < (x + width) ||
-                    ((int)ply_pixel_buffer_get_height (sprite->image) + position_y) < (y + height))
-                        script_lib_draw_brackground (pixel_buffer, &clip_area, data);
-        } else {
-                script_lib_draw_brackground (pixel_buffer, &clip_area, data);
-        }
-
-        for (node = ply_list_get_first_node (data->sprite_list);
-             node;
-             node = ply_list_get_next_node (data->sprite_list, node)) {
+        for (k = 0; k < number_of_candidates; k++) {
+                visible_sprite_t *visible_sprite;
                 int position_x, position_y;
 
-                sprite = ply_list_node_get_data (node);
+                sprite = candidates[k];
 
                 if (!sprite->image) continue;
                 if (sprite->remove_me) continue;
@@ -488,13 +933,101 @@ static void script_lib_sprite_draw_area (script_lib_display_t *display,
 
                 if ((position_x + (int) ply_pixel_buffer_get_width (sprite->image)) <= x) continue;
                 if ((position_y + (int) ply_pixel_buffer_get_height (sprite->image)) <= y) continue;
+
+                visible_sprite = &visible_sprites[number_of_visible_sprites++];
+                visible_sprite->sprite = sprite;
+                visible_sprite->x = position_x;
+                visible_sprite->y = position_y;
+                visible_sprite->area.x = position_x;
+                visible_sprite->area.y = position_y;
+                visible_sprite->area.width = ply_pixel_buffer_get_width (sprite->image);
+                visible_sprite->area.height = ply_pixel_buffer_get_height (sprite->image);
+                ply_rectangle_intersect (&visible_sprite->area, &clip_area, &visible_sprite->area);
+                visible_sprite->is_hidden = false;
+        }
+
+        /* Walk from the top down, collecting opaque areas and hiding
+         * whatever falls completely behind one of them
+         */
+        for (i = number_of_visible_sprites - 1; i >= 0; i--) {
+                visible_sprite_t *visible_sprite = &visible_sprites[i];
+                ply_rectangle_t opaque_area;
+
+                for (j = 0; j < number_of_occluders; j++) {
+                        if (rectangle_contains (&occluders[j], &visible_sprite->area)) {
+                                visible_sprite->is_hidden = true;
+                                break;
+                        }
+                }
+
+                if (visible_sprite->is_hidden)
+                        continue;
+
+                if (visible_sprite->sprite->opacity < 1.0 ||
+                    !ply_pixel_buffer_get_opaque_area (visible_sprite->sprite->image, &opaque_area))
+                        continue;
+
+                opaque_area.x += visible_sprite->x;
+                opaque_area.y += visible_sprite->y;
+                ply_rectangle_intersect (&opaque_area, &clip_area, &opaque_area);
+
+                if (opaque_area.width == 0 || opaque_area.height == 0)
+                        continue;
+
+                /* Nothing below this sprite shows, background included */
+                if (rectangle_contains (&opaque_area, &clip_area)) {
+                        first_drawn_sprite = i;
+                        break;
+                }
+
+                if (number_of_occluders < MAX_OCCLUDERS) {
+                        occluders[number_of_occluders++] = opaque_area;
+                        continue;
+                }
+
+                /* Make room by dropping the smallest one */
+                k = 0;
+                for (j = 1; j < MAX_OCCLUDERS; j++) {
+                        if (occluders[j].width * occluders[j].height <
+                            occluders[k].width * occluders[k].height)
+                                k = j;
+                }
+
+                if (occluders[k].width * occluders[k].height <
+                    opaque_area.width * opaque_area.height)
+                        occluders[k] = opaque_area;
+        }
+
+        /* The background is behind everything, so it can skip the
+         * biggest opaque area
+         */
+        if (i < 0) {
+                ply_rectangle_t hole = { 0, 0, 0, 0 };
+
+                for (j = 0; j < number_of_occluders; j++) {
+                        if (hole.width * hole.height < occluders[j].width * occluders[j].height)
+                                hole = occluders[j];
+                }
+
+                script_lib_draw_background_around (pixel_buffer, &clip_area, &hole, data);
+        }
+
+        for (i = first_drawn_sprite; i < number_of_visible_sprites; i++) {
+                visible_sprite_t *visible_sprite = &visible_sprites[i];
+
+                if (visible_sprite->is_hidden)
+                        continue;
+
                 ply_pixel_buffer_fill_with_buffer_at_opacity_with_clip (pixel_buffer,
-                                                                        sprite->image,
-                                                                        position_x,
-                                                                        position_y,
+                                                                        visible_sprite->sprite->image,
+                                                                        visible_sprite->x,
+                                                                        visible_sprite->y,
                                                                         &clip_area,
-                                                                        sprite->opacity);
+                                                                        visible_sprite->sprite->opacity);
         }
+
+        free (visible_sprites);
+        free (candidates);
 }
 
 static void
@@ -528,7 +1061,14 @@ script_lib_sprite_data_t *script_lib_sprite_setup (script_state_t *state,
 
         data->class = script_obj_native_class_new (sprite_free, "sprite", data);
         data->sprite_list = ply_list_new ();
+        data->dirty_sprites = ply_list_new ();
         data->displays = ply_list_new ();
+        data->next_sprite_serial = 0;
+        data->grid_cells = NULL;
+        data->grid_columns = 0;
+        data->grid_rows = 0;
+        data->grid_is_stale = true;
+        data->grid_query_stamp = 0;
 
         max_width = 0;
         max_height = 0;
@@ -620,6 +1160,16 @@ script_lib_sprite_data_t *script_lib_sprite_setup (script_state_t *state,
                                     data,
                                     "value",
                                     NULL);
+        script_add_native_function (sprite_hash,
+                                    "SetMany",
+                                    sprite_set_many,
+                                    data,
+                                    "sprites",
+                                    "x",
+                                    "y",
+                                    "z",
+                                    "opacity",
+                                    NULL);
         script_obj_unref (sprite_hash);
 
 
@@ -689,15 +1239,6 @@ script_lib_sprite_data_t *script_lib_sprite_setup (script_state_t *state,
         return data;
 }
 
-static int
-sprite_compare_z (void *data_a, void *data_b)
-{
-        sprite_t *sprite_a = data_a;
-        sprite_t *sprite_b = data_b;
-
-        return sprite_a->z - sprite_b->z;
-}
-
 static void
 region_add_area (ply_region_t *region,
                  long          x,
@@ -732,6 +1273,7 @@ void script_lib_sprite_pixel_display_removed (script_lib_sprite_data_t *data, pl
         if (display->pixel_display == pixel_display)
         {
             ply_list_remove_node (data->displays, node);
+            data->grid_is_stale = true;
         }
         node = next_node;
     }
@@ -749,11 +1291,6 @@ script_lib_sprite_refresh (script_lib_sprite_data_t *data)
 
         region = ply_region_new ();
 
-        ply_list_sort_stable (data->sprite_list, &sprite_compare_z);
-
-        node = ply_list_get_first_node (data->sprite_list);
-
-
         if (data->full_refresh) {
                 for (node = ply_list_get_first_node (data->displays);
                      node;
@@ -769,10 +1306,14 @@ script_lib_sprite_refresh (script_lib_sprite_data_t *data)
                 data->full_refresh = false;
         }
 
-        while (node) {
+        /* Only sprites touched since the last refresh can have moved */
+        for (node = ply_list_get_first_node (data->dirty_sprites);
+             node;
+             node = ply_list_get_next_node (data->dirty_sprites, node)) {
                 sprite_t *sprite = ply_list_node_get_data (node);
-                ply_list_node_t *next_node = ply_list_get_next_node (data->sprite_list,
-                                                                     node);
+
+                sprite->is_dirty = false;
+
                 if (sprite->remove_me) {
                         if (sprite->image) {
                                 region_add_area (region,
@@ -781,17 +1322,12 @@ script_lib_sprite_refresh (script_lib_sprite_data_t *data)
                                                  sprite->old_width,
                                                  sprite->old_height);
                         }
-                        ply_list_remove_node (data->sprite_list, node);
+                        ply_list_remove_node (data->sprite_list, sprite->node);
                         script_obj_unref (sprite->image_obj);
                         free (sprite);
+                        continue;
                 }
-                node = next_node;
-        }
 
-        for (node = ply_list_get_first_node (data->sprite_list);
-             node;
-             node = ply_list_get_next_node (data->sprite_list, node)) {
-                sprite_t *sprite = ply_list_node_get_data (node);
                 if (!sprite->image) continue;
                 if ((sprite->x != sprite->old_x)
                     || (sprite->y != sprite->old_y)
@@ -820,6 +1356,7 @@ script_lib_sprite_refresh (script_lib_sprite_data_t *data)
                         sprite->refresh_me = false;
                 }
         }
+        ply_list_remove_all_nodes (data->dirty_sprites);
 
         rectable_list = ply_region_get_rectangle_list (region);
 
@@ -861,6 +1398,8 @@ void script_lib_sprite_destroy (script_lib_sprite_data_t *data)
         }
 
         ply_list_free (data->sprite_list);
+        ply_list_free (data->dirty_sprites);
+        grid_free_cells (data);
         script_parse_op_free (data->script_main_op);
         script_obj_native_class_destroy (data->class);
         free (data);
@@ -29,12 +29,24 @@
 typedef struct
 {
         ply_list_t                *displays;
-        ply_list_t                *sprite_list;
+        ply_list_t                *sprite_list; /* kept sorted by z */
+        ply_list_t                *dirty_sprites;
         script_obj_native_class_t *class;
         script_op_t               *script_main_op;
         uint32_t                   background_color_start;
         uint32_t                   background_color_end;
         bool                       full_refresh;
+        unsigned long              next_sprite_serial;
+
+        /* uniform grid over the area covered by the displays, each cell
+         * listing the sprites that overlap it
+         */
+        ply_list_t               **grid_cells;
+        ply_rectangle_t            grid_area;
+        int                        grid_columns;
+        int                        grid_rows;
+        bool                       grid_is_stale;
+        unsigned long              grid_query_stamp;
 } script_lib_sprite_data_t;
 
 typedef struct
@@ -61,6 +73,15 @@ typedef struct
         bool                remove_me;
         ply_pixel_buffer_t *image;
         script_obj_t       *image_obj;
+
+        script_lib_sprite_data_t *data;
+        ply_list_node_t    *node;
+        unsigned long       serial; /* breaks ties between equal z */
+        bool                is_dirty;
+
+        bool                is_in_grid;
+        int                 grid_left, grid_top, grid_right, grid_bottom; /* cells, inclusive */
+        unsigned long       grid_query_stamp;
 } sprite_t;
 
 script_lib_sprite_data_t *script_lib_sprite_setup (script_state_t *state,
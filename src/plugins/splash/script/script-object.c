@@ -27,6 +27,7 @@
 #include "ply-hashtable.h"
 #include "ply-list.h"
 #include "ply-bitarray.h"
+#include "ply-utils.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
@@ -42,6 +43,179 @@
 
 void script_obj_reset (script_obj_t *obj);
 
+/* Numbers are turned into names with "%g", which only prints integers
+ * up to six digits long in plain decimal
+ */
+#define SCRIPT_OBJ_HASH_MAX_INDEX 999999
+
+/* Hashes with more fields than this, like the global one, are better
+ * off with a real table
+ */
+#define SCRIPT_OBJ_SHAPE_MAX_FIELDS 16
+
+typedef struct script_obj_shape_t
+{
+        struct script_obj_shape_t *parent;
+        struct script_obj_shape_t *children;
+        struct script_obj_shape_t *next_sibling;
+        char                     **names;
+        int                        field_count;
+        unsigned int               id;
+        int                        refcount;
+} script_obj_shape_t;
+
+static script_obj_shape_t *script_obj_shape_root;
+static unsigned int script_obj_shape_next_id = 1;
+
+static script_obj_shape_t *script_obj_shape_get_root (void)
+{
+        if (!script_obj_shape_root) {
+                script_obj_shape_root = calloc (1, sizeof(script_obj_shape_t));
+                script_obj_shape_root->id = script_obj_shape_next_id++;
+        }
+        script_obj_shape_root->refcount++;
+        return script_obj_shape_root;
+}
+
+static void script_obj_shape_unref (script_obj_shape_t *shape)
+{
+        script_obj_shape_t *parent = shape->parent;
+        script_obj_shape_t **link;
+
+        shape->refcount--;
+        if (shape->refcount > 0)
+                return;
+
+        if (!parent) {
+                script_obj_shape_root = NULL;
+                free (shape);
+                return;
+        }
+
+        for (link = &parent->children; *link != shape; link = &(*link)->next_sibling) {
+        }
+        *link = shape->next_sibling;
+
+        free (shape->names[shape->field_count - 1]);
+        free (shape->names);
+        free (shape);
+        script_obj_shape_unref (parent);
+}
+
+/* Returns the shape with name added after the fields of shape, shared
+ * with any other hash that got there the same way
+ */
+static script_obj_shape_t *script_obj_shape_add_field (script_obj_shape_t *shape,
+                                                       const char         *name)
+{
+        script_obj_shape_t *child;
+
+        for (child = shape->children; child; child = child->next_sibling) {
+                if (!strcmp (child->names[shape->field_count], name)) {
+                        child->refcount++;
+                        return child;
+                }
+        }
+
+        child = calloc (1, sizeof(script_obj_shape_t));
+        child->parent = shape;
+        shape->refcount++;
+        child->field_count = shape->field_count + 1;
+        child->names = malloc (child->field_count * sizeof(char *));
+        memcpy (child->names, shape->names, shape->field_count * sizeof(char *));
+        child->names[shape->field_count] = strdup (name);
+        child->id = script_obj_shape_next_id++;
+        child->refcount = 1;
+        child->next_sibling = shape->children;
+        shape->children = child;
+        return child;
+}
+
+static int script_obj_shape_find_field (script_obj_shape_t *shape,
+                                        const char         *name)
+{
+        int i;
+
+        for (i = shape->field_count - 1; i >= 0; i--) {
+                if (!strcmp (shape->names[i], name))
+                        return i;
+        }
+        return -1;
+}
+
+static script_obj_string_buffer_t *script_obj_string_buffer_new (size_t capacity)
+{
+        script_obj_string_buffer_t *buffer = malloc (sizeof(script_obj_string_buffer_t));
+
+        buffer->refcount = 1;
+        buffer->data = malloc (capacity);
+        buffer->size = 0;
+        buffer->capacity = capacity;
+        return buffer;
+}
+
+static void script_obj_string_buffer_unref (script_obj_string_buffer_t *buffer)
+{
+        buffer->refcount--;
+        if (buffer->refcount > 0)
+                return;
+        free (buffer->data);
+        free (buffer);
+}
+
+static script_obj_t *script_obj_new_string_from_buffer (script_obj_string_buffer_t *buffer,
+                                                        size_t                      length)
+{
+        script_obj_t *obj = malloc (sizeof(script_obj_t));
+
+        obj->type = SCRIPT_OBJ_TYPE_STRING;
+        obj->refcount = 1;
+        obj->data.string.buffer = buffer;
+        obj->data.string.length = length;
+        buffer->refcount++;
+        return obj;
+}
+
+/* Returns a new string of string_obj followed by bytes.  When string_obj
+ * is the longest string in its buffer the bytes are appended in place,
+ * growing the buffer geometrically, so building a string up piece by
+ * piece does not copy it over and over.
+ */
+static script_obj_t *script_obj_string_append (script_obj_t *string_obj,
+                                               const char   *bytes,
+                                               size_t        length)
+{
+        script_obj_string_t *string = &string_obj->data.string;
+        script_obj_string_buffer_t *buffer = string->buffer;
+        size_t new_length = string->length + length;
+        script_obj_t *obj;
+
+        if (string->length == buffer->size) {
+                if (new_length + 1 > buffer->capacity) {
+                        /* As in s + s, where bytes is the start of this buffer */
+                        bool is_same_buffer = bytes == buffer->data;
+
+                        buffer->capacity = MAX (new_length + 1, buffer->capacity * 2);
+                        buffer->data = realloc (buffer->data, buffer->capacity);
+                        if (is_same_buffer)
+                                bytes = buffer->data;
+                }
+                memcpy (buffer->data + buffer->size, bytes, length);
+                buffer->size = new_length;
+                buffer->data[new_length] = '\0';
+                return script_obj_new_string_from_buffer (buffer, new_length);
+        }
+
+        buffer = script_obj_string_buffer_new (new_length + 1);
+        memcpy (buffer->data, string->buffer->data, string->length);
+        memcpy (buffer->data + string->length, bytes, length);
+        buffer->data[new_length] = '\0';
+        buffer->size = new_length;
+        obj = script_obj_new_string_from_buffer (buffer, new_length);
+        script_obj_string_buffer_unref (buffer);
+        return obj;
+}
+
 void script_obj_free (script_obj_t *obj)
 {
         assert (!obj->refcount);
@@ -90,13 +264,31 @@ void script_obj_reset (script_obj_t *obj)
                 break;
 
         case SCRIPT_OBJ_TYPE_STRING:
-                free (obj->data.string);
+                script_obj_string_buffer_unref (obj->data.string.buffer);
                 break;
 
         case SCRIPT_OBJ_TYPE_HASH:              /* FIXME nightmare */
-                ply_hashtable_foreach (obj->data.hash, foreach_free_variable, NULL);
-                ply_hashtable_free (obj->data.hash);
-                break;
+        {
+                script_obj_hash_t *hash = obj->data.hash;
+                int i;
+                if (hash->table) {
+                        ply_hashtable_foreach (hash->table, foreach_free_variable, NULL);
+                        ply_hashtable_free (hash->table);
+                }
+                for (i = 0; i < hash->length; i++) {
+                        script_obj_unref (hash->elements[i]);
+                }
+                free (hash->elements);
+                if (hash->shape) {
+                        for (i = 0; i < hash->shape->field_count; i++) {
+                                script_obj_unref (hash->slots[i]);
+                        }
+                        free (hash->slots);
+                        script_obj_shape_unref (hash->shape);
+                }
+                free (hash);
+        }
+        break;
 
         case SCRIPT_OBJ_TYPE_FUNCTION:
         {
@@ -167,11 +359,17 @@ script_obj_t *script_obj_new_number (script_number_t number)
 
 script_obj_t *script_obj_new_string (const char *string)
 {
+        script_obj_string_buffer_t *buffer;
+        script_obj_t *obj;
+        size_t length;
+
         if (!string) return script_obj_new_null ();
-        script_obj_t *obj = malloc (sizeof(script_obj_t));
-        obj->type = SCRIPT_OBJ_TYPE_STRING;
-        obj->refcount = 1;
-        obj->data.string = strdup (string);
+        length = strlen (string);
+        buffer = script_obj_string_buffer_new (length + 1);
+        memcpy (buffer->data, string, length + 1);
+        buffer->size = length;
+        obj = script_obj_new_string_from_buffer (buffer, length);
+        script_obj_string_buffer_unref (buffer);
         return obj;
 }
 
@@ -180,8 +378,8 @@ script_obj_t *script_obj_new_hash (void)
         script_obj_t *obj = malloc (sizeof(script_obj_t));
 
         obj->type = SCRIPT_OBJ_TYPE_HASH;
-        obj->data.hash = ply_hashtable_new (ply_hashtable_string_hash,
-                                            ply_hashtable_string_compare);
+        obj->data.hash = calloc (1, sizeof(script_obj_hash_t));
+        obj->data.hash->shape = script_obj_shape_get_root ();
         obj->refcount = 1;
         return obj;
 }
@@ -292,7 +490,7 @@ static void *script_obj_direct_as_bool (script_obj_t *obj,
         case SCRIPT_OBJ_TYPE_NATIVE:
                 return obj;
         case SCRIPT_OBJ_TYPE_STRING:
-                if (*obj->data.string) return obj;
+                if (obj->data.string.length > 0) return obj;
                 return NULL;
         }
         return NULL;
@@ -308,7 +506,9 @@ char *script_obj_as_string (script_obj_t *obj)              /* reply is strduppe
         char *reply;
         script_obj_t *string_obj = script_obj_as_obj_type (obj, SCRIPT_OBJ_TYPE_STRING);
 
-        if (string_obj) return strdup (string_obj->data.string);
+        if (string_obj)
+                return strndup (string_obj->data.string.buffer->data,
+                                string_obj->data.string.length);
         string_obj = script_obj_as_obj_type (obj, SCRIPT_OBJ_TYPE_NUMBER);
         if (string_obj) {
                 asprintf (&reply, "%g", string_obj->data.number);
@@ -406,13 +606,217 @@ void script_obj_assign (script_obj_t *obj_a,
         obj_a->data.obj = obj_b;
 }
 
+static bool script_obj_hash_name_to_index (const char *name,
+                                           int        *index)
+{
+        const char *c;
+        int value = 0;
+
+        if (name[0] == '\0' || (name[0] == '0' && name[1] != '\0'))
+                return false;
+
+        for (c = name; *c; c++) {
+                if (*c < '0' || *c > '9' || c - name >= 6)
+                        return false;
+                value = value * 10 + (*c - '0');
+        }
+        *index = value;
+        return true;
+}
+
+static bool script_obj_hash_number_to_index (script_number_t number,
+                                             int            *index)
+{
+        if (!(number >= 0 && number <= SCRIPT_OBJ_HASH_MAX_INDEX) ||
+            number != floor (number) || signbit (number))
+                return false;
+        *index = number;
+        return true;
+}
+
+static script_variable_t *script_obj_hash_lookup_variable (script_obj_hash_t *hash,
+                                                           int                index)
+{
+        char name[16];
+
+        if (!hash->table || ply_hashtable_get_size (hash->table) == 0)
+                return NULL;
+
+        snprintf (name, sizeof(name), "%d", index);
+        return ply_hashtable_lookup (hash->table, name);
+}
+
+static void script_obj_hash_push (script_obj_hash_t *hash,
+                                  script_obj_t      *element)
+{
+        if (hash->length == hash->capacity) {
+                hash->capacity = MAX (hash->capacity * 2, 8);
+                hash->elements = realloc (hash->elements,
+                                          hash->capacity * sizeof(script_obj_t *));
+        }
+        hash->elements[hash->length++] = element;
+}
+
+static void script_obj_hash_append (script_obj_hash_t *hash,
+                                    script_obj_t      *element)
+{
+        script_variable_t *variable;
+
+        script_obj_hash_push (hash, element);
+
+        /* Filling a gap joins whatever followed it on to the array */
+        while (hash->length <= SCRIPT_OBJ_HASH_MAX_INDEX &&
+               (variable = script_obj_hash_lookup_variable (hash, hash->length)) != NULL) {
+                ply_hashtable_remove (hash->table, variable->name);
+                script_obj_hash_push (hash, variable->object);
+                free (variable->name);
+                free (variable);
+        }
+}
+
+static void script_obj_hash_insert_variable (script_obj_hash_t *hash,
+                                             char              *name,
+                                             script_obj_t      *element)
+{
+        script_variable_t *variable = malloc (sizeof(script_variable_t));
+
+        if (!hash->table)
+                hash->table = ply_hashtable_new (ply_hashtable_string_hash,
+                                                 ply_hashtable_string_compare);
+        variable->name = name;
+        variable->object = element;
+        ply_hashtable_insert (hash->table, variable->name, variable);
+}
+
+static void script_obj_hash_add_field (script_obj_hash_t *hash,
+                                       const char        *name,
+                                       script_obj_t      *element)
+{
+        script_obj_shape_t *shape = hash->shape;
+        int i;
+
+        if (shape && shape->field_count < SCRIPT_OBJ_SHAPE_MAX_FIELDS) {
+                hash->shape = script_obj_shape_add_field (shape, name);
+                script_obj_shape_unref (shape);
+                hash->slots = realloc (hash->slots,
+                                       hash->shape->field_count * sizeof(script_obj_t *));
+                hash->slots[hash->shape->field_count - 1] = element;
+                return;
+        }
+
+        if (shape) {
+                for (i = 0; i < shape->field_count; i++) {
+                        script_obj_hash_insert_variable (hash,
+                                                         strdup (shape->names[i]),
+                                                         hash->slots[i]);
+                }
+                free (hash->slots);
+                hash->slots = NULL;
+                hash->shape = NULL;
+                script_obj_shape_unref (shape);
+        }
+        script_obj_hash_insert_variable (hash, strdup (name), element);
+}
+
+static script_obj_t *script_obj_hash_new_element (script_obj_t *hash,
+                                                  const char   *name,
+                                                  int           index)
+{
+        script_obj_t *realhash = script_obj_as_obj_type (hash, SCRIPT_OBJ_TYPE_HASH);
+        script_obj_t *element = script_obj_new_null ();
+
+        if (!realhash) {
+                realhash = script_obj_new_hash (); /* If it wasn't a hash then make it into one */
+                script_obj_assign (hash, realhash);
+                script_obj_unref (realhash);
+        }
+
+        if (index < 0) {
+                script_obj_hash_add_field (realhash->data.hash, name, element);
+        } else if (index == realhash->data.hash->length) {
+                script_obj_hash_append (realhash->data.hash, element);
+        } else {
+                char *index_name;
+                if (name)
+                        index_name = strdup (name);
+                else
+                        asprintf (&index_name, "%d", index);
+                script_obj_hash_insert_variable (realhash->data.hash, index_name, element);
+        }
+        script_obj_ref (element);
+        return element;
+}
+
 static void *script_obj_direct_as_hash_element (script_obj_t *obj,
                                                 void         *user_data)
 {
         const char *name = user_data;
+        int index;
+
+        if (obj->type == SCRIPT_OBJ_TYPE_HASH) {
+                script_obj_hash_t *hash = obj->data.hash;
+                script_variable_t *variable;
+                if (script_obj_hash_name_to_index (name, &index)) {
+                        if (index < hash->length)
+                                return hash->elements[index];
+                } else if (hash->shape) {
+                        index = script_obj_shape_find_field (hash->shape, name);
+                        return index >= 0 ? hash->slots[index] : NULL;
+                }
+                if (!hash->table)
+                        return NULL;
+                variable = ply_hashtable_lookup (hash->table, (void *) name);
+                if (variable)
+                        return variable->object;
+        }
+        return NULL;
+}
+
+typedef struct
+{
+        const char               *name;
+        script_obj_field_cache_t *cache;
+} script_obj_field_lookup_t;
+
+static void *script_obj_direct_as_hash_field (script_obj_t *obj,
+                                              void         *user_data)
+{
+        script_obj_field_lookup_t *lookup = user_data;
+        script_obj_hash_t *hash;
+        int index;
+
+        if (obj->type != SCRIPT_OBJ_TYPE_HASH)
+                return NULL;
+
+        hash = obj->data.hash;
+        if (!hash->shape)
+                return script_obj_direct_as_hash_element (obj, (void *) lookup->name);
+
+        if (hash->shape->id == lookup->cache->shape_id)
+                return hash->slots[lookup->cache->index];
+
+        if (script_obj_hash_name_to_index (lookup->name, &index))
+                return script_obj_direct_as_hash_element (obj, (void *) lookup->name);
+
+        index = script_obj_shape_find_field (hash->shape, lookup->name);
+        if (index < 0)
+                return NULL;
+
+        lookup->cache->shape_id = hash->shape->id;
+        lookup->cache->index = index;
+        return hash->slots[index];
+}
+
+static void *script_obj_direct_as_hash_index (script_obj_t *obj,
+                                              void         *user_data)
+{
+        int index = *(int *) user_data;
 
         if (obj->type == SCRIPT_OBJ_TYPE_HASH) {
-                script_variable_t *variable = ply_hashtable_lookup (obj->data.hash, (void *) name);
+                script_variable_t *variable;
+                if (index < obj->data.hash->length)
+                        return obj->data.hash->elements[index];
+                variable = script_obj_hash_lookup_variable (obj->data.hash, index);
                 if (variable)
                         return variable->object;
         }
@@ -436,19 +840,79 @@ script_obj_t *script_obj_hash_get_element (script_obj_t *hash,
                                            const char   *name)
 {
         script_obj_t *obj = script_obj_hash_peek_element (hash, name);
+        int index;
 
         if (obj) return obj;
-        script_obj_t *realhash = script_obj_as_obj_type (hash, SCRIPT_OBJ_TYPE_HASH);
-        if (!realhash) {
-                realhash = script_obj_new_hash (); /* If it wasn't a hash then make it into one */
-                script_obj_assign (hash, realhash);
+        if (!script_obj_hash_name_to_index (name, &index))
+                index = -1;
+        return script_obj_hash_new_element (hash, name, index);
+}
+
+/* Same as script_obj_hash_peek_element, for names that stay the same
+ * each time the lookup is made, such as the "x" in "sprite.x"
+ */
+script_obj_t *script_obj_hash_peek_field (script_obj_t             *hash,
+                                          const char               *name,
+                                          script_obj_field_cache_t *cache)
+{
+        script_obj_field_lookup_t lookup = { name, cache };
+        script_obj_t *object;
+
+        object = script_obj_as_custom (hash, script_obj_direct_as_hash_field, &lookup);
+        if (object) script_obj_ref (object);
+        return object;
+}
+
+script_obj_t *script_obj_hash_get_field (script_obj_t             *hash,
+                                         const char               *name,
+                                         script_obj_field_cache_t *cache)
+{
+        script_obj_t *obj = script_obj_hash_peek_field (hash, name, cache);
+        int index;
+
+        if (obj) return obj;
+        if (!script_obj_hash_name_to_index (name, &index))
+                index = -1;
+        return script_obj_hash_new_element (hash, name, index);
+}
+
+/* Returns the element without creating it or taking a reference */
+script_obj_t *script_obj_hash_peek_index (script_obj_t *hash,
+                                          int           index)
+{
+        if (index < 0) return NULL;
+        return script_obj_as_custom (hash, script_obj_direct_as_hash_index, &index);
+}
+
+/* Same as looking up the number as a string, without having to print it */
+script_obj_t *script_obj_hash_get_index (script_obj_t   *hash,
+                                         script_number_t number)
+{
+        script_obj_t *obj;
+        int index;
+
+        if (!script_obj_hash_number_to_index (number, &index)) {
+                char *name;
+                asprintf (&name, "%g", number);
+                obj = script_obj_hash_get_element (hash, name);
+                free (name);
+                return obj;
         }
-        script_variable_t *variable = malloc (sizeof(script_variable_t));
-        variable->name = strdup (name);
-        variable->object = script_obj_new_null ();
-        ply_hashtable_insert (realhash->data.hash, variable->name, variable);
-        script_obj_ref (variable->object);
-        return variable->object;
+
+        obj = script_obj_as_custom (hash, script_obj_direct_as_hash_index, &index);
+        if (obj) {
+                script_obj_ref (obj);
+                return obj;
+        }
+        return script_obj_hash_new_element (hash, NULL, index);
+}
+
+/* Number of elements running on from "0" without a gap */
+int script_obj_hash_get_length (script_obj_t *hash)
+{
+        hash = script_obj_as_obj_type (hash, SCRIPT_OBJ_TYPE_HASH);
+        if (!hash) return 0;
+        return hash->data.hash->length;
 }
 
 script_number_t script_obj_hash_get_number (script_obj_t *hash,
@@ -521,19 +985,30 @@ script_obj_t *script_obj_plus (script_obj_t *script_obj_a,
                 return script_obj_new_number (value);
         }
         if (script_obj_is_string (script_obj_a) || script_obj_is_string (script_obj_b)) {
+                script_obj_t *string_a = script_obj_as_obj_type (script_obj_a, SCRIPT_OBJ_TYPE_STRING);
+                script_obj_t *string_b = script_obj_as_obj_type (script_obj_b, SCRIPT_OBJ_TYPE_STRING);
                 script_obj_t *obj;
-                char *string_a = script_obj_as_string (script_obj_a);
-                char *string_b = script_obj_as_string (script_obj_b);
-                if (string_a && string_b) {
-                        char *newstring;
-                        asprintf (&newstring, "%s%s", string_a, string_b);
-                        obj = script_obj_new_string (newstring);
-                        free (newstring);
+                char *text = NULL;
+
+                if (!string_a) {
+                        text = script_obj_as_string (script_obj_a);
+                        string_a = script_obj_new_string (text);
+                        free (text);
+                        text = NULL;
+                } else {
+                        script_obj_ref (string_a);
+                }
+
+                if (string_b) {
+                        obj = script_obj_string_append (string_a,
+                                                        string_b->data.string.buffer->data,
+                                                        string_b->data.string.length);
                 } else {
-                        obj = script_obj_new_null ();
+                        text = script_obj_as_string (script_obj_b);
+                        obj = script_obj_string_append (string_a, text, strlen (text));
+                        free (text);
                 }
-                free (string_a);
-                free (string_b);
+                script_obj_unref (string_a);
                 return obj;
         }
         return script_obj_new_null ();
@@ -597,11 +1072,12 @@ script_obj_cmp_result_t script_obj_cmp (script_obj_t *script_obj_a,
                 }
         } else if (script_obj_is_string (script_obj_a)) {
                 if (script_obj_is_string (script_obj_b)) {
-                        char *string_a = script_obj_as_string (script_obj_a);
-                        char *string_b = script_obj_as_string (script_obj_b);
-                        int diff = strcmp (string_a, string_b);
-                        free (string_a);
-                        free (string_b);
+                        script_obj_string_t *string_a = &script_obj_as_obj_type (script_obj_a, SCRIPT_OBJ_TYPE_STRING)->data.string;
+                        script_obj_string_t *string_b = &script_obj_as_obj_type (script_obj_b, SCRIPT_OBJ_TYPE_STRING)->data.string;
+                        int diff = memcmp (string_a->buffer->data, string_b->buffer->data,
+                                           MIN (string_a->length, string_b->length));
+                        if (diff == 0 && string_a->length != string_b->length)
+                                diff = string_a->length < string_b->length ? -1 : 1;
                         if (diff < 0) return SCRIPT_OBJ_CMP_RESULT_LT;
                         if (diff > 0) return SCRIPT_OBJ_CMP_RESULT_GT;
                         return SCRIPT_OBJ_CMP_RESULT_EQ;
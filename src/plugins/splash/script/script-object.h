@@ -84,6 +84,17 @@ script_obj_t *script_obj_hash_peek_element (script_obj_t *hash,
                                             const char   *name);
 script_obj_t *script_obj_hash_get_element (script_obj_t *hash,
                                            const char   *name);
+script_obj_t *script_obj_hash_peek_field (script_obj_t             *hash,
+                                          const char               *name,
+                                          script_obj_field_cache_t *cache);
+script_obj_t *script_obj_hash_get_field (script_obj_t             *hash,
+                                         const char               *name,
+                                         script_obj_field_cache_t *cache);
+script_obj_t *script_obj_hash_peek_index (script_obj_t *hash,
+                                          int           index);
+script_obj_t *script_obj_hash_get_index (script_obj_t   *hash,
+                                         script_number_t number);
+int script_obj_hash_get_length (script_obj_t *hash);
 script_number_t script_obj_hash_get_number (script_obj_t *hash,
                                             const char   *name);
 bool script_obj_hash_get_bool (script_obj_t *hash,
@@ -0,0 +1,637 @@
+/* script-optimize.c - simplify parsed scripts before they are run
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "ply-list.h"
+#include "ply-logger.h"
+
+#include "script.h"
+#include "script-object.h"
+#include "script-parse.h"
+#include "script-optimize.h"
+
+/* Only rewrites that cannot change what a script does are made.  Any
+ * variable, hash or function may be replaced by the script at run time,
+ * so only literals are treated as constant, and folding is done with the
+ * same object operations the interpreter uses.
+ */
+
+typedef struct
+{
+        int folded_expressions;
+        int simplified_conditions;
+        int removed_branches;
+        int removed_ops;
+} script_optimize_statistics_t;
+
+typedef script_obj_t *(*script_optimize_function_t)(script_obj_t *,
+                                                    script_obj_t *);
+
+static bool script_optimize_statistics_enabled;
+static script_optimize_statistics_t script_optimize_statistics;
+
+static void script_optimize_op_internal (script_op_t *op);
+
+void script_optimize_set_statistics_enabled (bool enabled)
+{
+        script_optimize_statistics_enabled = enabled;
+}
+
+static int script_optimize_count_op (script_op_t *op);
+
+static int script_optimize_count_exp (script_exp_t *exp)
+{
+        ply_list_node_t *node;
+        int count;
+
+        if (!exp) return 0;
+        count = 1;
+        switch (exp->type) {
+        case SCRIPT_EXP_TYPE_PLUS:
+        case SCRIPT_EXP_TYPE_MINUS:
+        case SCRIPT_EXP_TYPE_MUL:
+        case SCRIPT_EXP_TYPE_DIV:
+        case SCRIPT_EXP_TYPE_MOD:
+        case SCRIPT_EXP_TYPE_EQ:
+        case SCRIPT_EXP_TYPE_NE:
+        case SCRIPT_EXP_TYPE_GT:
+        case SCRIPT_EXP_TYPE_GE:
+        case SCRIPT_EXP_TYPE_LT:
+        case SCRIPT_EXP_TYPE_LE:
+        case SCRIPT_EXP_TYPE_AND:
+        case SCRIPT_EXP_TYPE_OR:
+        case SCRIPT_EXP_TYPE_EXTEND:
+        case SCRIPT_EXP_TYPE_ASSIGN:
+        case SCRIPT_EXP_TYPE_ASSIGN_PLUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MINUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MUL:
+        case SCRIPT_EXP_TYPE_ASSIGN_DIV:
+        case SCRIPT_EXP_TYPE_ASSIGN_MOD:
+        case SCRIPT_EXP_TYPE_ASSIGN_EXTEND:
+        case SCRIPT_EXP_TYPE_HASH:
+                count += script_optimize_count_exp (exp->data.dual.sub_a);
+                count += script_optimize_count_exp (exp->data.dual.sub_b);
+                break;
+
+        case SCRIPT_EXP_TYPE_NOT:
+        case SCRIPT_EXP_TYPE_POS:
+        case SCRIPT_EXP_TYPE_NEG:
+        case SCRIPT_EXP_TYPE_PRE_INC:
+        case SCRIPT_EXP_TYPE_PRE_DEC:
+        case SCRIPT_EXP_TYPE_POST_INC:
+        case SCRIPT_EXP_TYPE_POST_DEC:
+                count += script_optimize_count_exp (exp->data.sub);
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_NUMBER:
+        case SCRIPT_EXP_TYPE_TERM_STRING:
+        case SCRIPT_EXP_TYPE_TERM_VAR:
+        case SCRIPT_EXP_TYPE_TERM_NULL:
+        case SCRIPT_EXP_TYPE_TERM_LOCAL:
+        case SCRIPT_EXP_TYPE_TERM_GLOBAL:
+        case SCRIPT_EXP_TYPE_TERM_THIS:
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_SET:
+                for (node = ply_list_get_first_node (exp->data.parameters);
+                     node;
+                     node = ply_list_get_next_node (exp->data.parameters, node)) {
+                        count += script_optimize_count_exp (ply_list_node_get_data (node));
+                }
+                break;
+
+        case SCRIPT_EXP_TYPE_FUNCTION_EXE:
+                count += script_optimize_count_exp (exp->data.function_exe.name);
+                for (node = ply_list_get_first_node (exp->data.function_exe.parameters);
+                     node;
+                     node = ply_list_get_next_node (exp->data.function_exe.parameters, node)) {
+                        count += script_optimize_count_exp (ply_list_node_get_data (node));
+                }
+                break;
+
+        case SCRIPT_EXP_TYPE_FUNCTION_DEF:
+                if (exp->data.function_def->type == SCRIPT_FUNCTION_TYPE_SCRIPT)
+                        count += script_optimize_count_op (exp->data.function_def->data.script);
+                break;
+        }
+        return count;
+}
+
+static int script_optimize_count_op (script_op_t *op)
+{
+        ply_list_node_t *node;
+        int count;
+
+        if (!op) return 0;
+        count = 1;
+        switch (op->type) {
+        case SCRIPT_OP_TYPE_EXPRESSION:
+        case SCRIPT_OP_TYPE_RETURN:
+                count += script_optimize_count_exp (op->data.exp);
+                break;
+
+        case SCRIPT_OP_TYPE_OP_BLOCK:
+                for (node = ply_list_get_first_node (op->data.list);
+                     node;
+                     node = ply_list_get_next_node (op->data.list, node)) {
+                        count += script_optimize_count_op (ply_list_node_get_data (node));
+                }
+                break;
+
+        case SCRIPT_OP_TYPE_IF:
+        case SCRIPT_OP_TYPE_WHILE:
+        case SCRIPT_OP_TYPE_DO_WHILE:
+        case SCRIPT_OP_TYPE_FOR:
+                count += script_optimize_count_exp (op->data.cond_op.cond);
+                count += script_optimize_count_op (op->data.cond_op.op1);
+                count += script_optimize_count_op (op->data.cond_op.op2);
+                break;
+
+        case SCRIPT_OP_TYPE_FAIL:
+        case SCRIPT_OP_TYPE_BREAK:
+        case SCRIPT_OP_TYPE_CONTINUE:
+                break;
+        }
+        return count;
+}
+
+static bool script_optimize_exp_is_constant (script_exp_t *exp)
+{
+        return exp &&
+               (exp->type == SCRIPT_EXP_TYPE_TERM_NUMBER ||
+                exp->type == SCRIPT_EXP_TYPE_TERM_STRING ||
+                exp->type == SCRIPT_EXP_TYPE_TERM_NULL);
+}
+
+static script_obj_t *script_optimize_exp_to_obj (script_exp_t *exp)
+{
+        switch (exp->type) {
+        case SCRIPT_EXP_TYPE_TERM_NUMBER:
+                return script_obj_new_number (exp->data.number);
+        case SCRIPT_EXP_TYPE_TERM_STRING:
+                return script_obj_new_string (exp->data.string);
+        case SCRIPT_EXP_TYPE_TERM_NULL:
+        case SCRIPT_EXP_TYPE_TERM_VAR:
+        case SCRIPT_EXP_TYPE_TERM_LOCAL:
+        case SCRIPT_EXP_TYPE_TERM_GLOBAL:
+        case SCRIPT_EXP_TYPE_TERM_THIS:
+        case SCRIPT_EXP_TYPE_TERM_SET:
+        case SCRIPT_EXP_TYPE_PLUS:
+        case SCRIPT_EXP_TYPE_MINUS:
+        case SCRIPT_EXP_TYPE_MUL:
+        case SCRIPT_EXP_TYPE_DIV:
+        case SCRIPT_EXP_TYPE_MOD:
+        case SCRIPT_EXP_TYPE_GT:
+        case SCRIPT_EXP_TYPE_GE:
+        case SCRIPT_EXP_TYPE_LT:
+        case SCRIPT_EXP_TYPE_LE:
+        case SCRIPT_EXP_TYPE_EQ:
+        case SCRIPT_EXP_TYPE_NE:
+        case SCRIPT_EXP_TYPE_AND:
+        case SCRIPT_EXP_TYPE_OR:
+        case SCRIPT_EXP_TYPE_EXTEND:
+        case SCRIPT_EXP_TYPE_NOT:
+        case SCRIPT_EXP_TYPE_POS:
+        case SCRIPT_EXP_TYPE_NEG:
+        case SCRIPT_EXP_TYPE_PRE_INC:
+        case SCRIPT_EXP_TYPE_PRE_DEC:
+        case SCRIPT_EXP_TYPE_POST_INC:
+        case SCRIPT_EXP_TYPE_POST_DEC:
+        case SCRIPT_EXP_TYPE_HASH:
+        case SCRIPT_EXP_TYPE_FUNCTION_EXE:
+        case SCRIPT_EXP_TYPE_FUNCTION_DEF:
+        case SCRIPT_EXP_TYPE_ASSIGN:
+        case SCRIPT_EXP_TYPE_ASSIGN_PLUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MINUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MUL:
+        case SCRIPT_EXP_TYPE_ASSIGN_DIV:
+        case SCRIPT_EXP_TYPE_ASSIGN_MOD:
+        case SCRIPT_EXP_TYPE_ASSIGN_EXTEND:
+                break;
+        }
+        return script_obj_new_null ();
+}
+
+/* The replaced node keeps its address and debug location; its old
+ * contents are freed along with any children not detached beforehand.
+ */
+static void script_optimize_replace_exp (script_exp_t *exp,
+                                         script_exp_t *replacement)
+{
+        script_exp_t old = *exp;
+
+        *exp = *replacement;
+        *replacement = old;
+        script_parse_exp_free (replacement);
+}
+
+static void script_optimize_replace_op (script_op_t *op,
+                                        script_op_t *replacement)
+{
+        script_op_t old = *op;
+
+        *op = *replacement;
+        *replacement = old;
+        script_parse_op_free (replacement);
+}
+
+static bool script_optimize_replace_exp_with_obj (script_exp_t *exp,
+                                                  script_obj_t *obj)
+{
+        script_exp_t *constant;
+
+        if (!script_obj_is_number (obj) &&
+            !script_obj_is_string (obj) &&
+            !script_obj_is_null (obj))
+                return false;
+
+        constant = calloc (1, sizeof(script_exp_t));
+        if (script_obj_is_number (obj)) {
+                constant->type = SCRIPT_EXP_TYPE_TERM_NUMBER;
+                constant->data.number = script_obj_as_number (obj);
+        } else if (script_obj_is_string (obj)) {
+                constant->type = SCRIPT_EXP_TYPE_TERM_STRING;
+                constant->data.string = script_obj_as_string (obj);
+        } else {
+                constant->type = SCRIPT_EXP_TYPE_TERM_NULL;
+        }
+        script_optimize_replace_exp (exp, constant);
+        script_optimize_statistics.folded_expressions++;
+        return true;
+}
+
+static void script_optimize_hoist_exp (script_exp_t  *exp,
+                                       script_exp_t **sub)
+{
+        script_exp_t *child = *sub;
+
+        *sub = NULL;
+        script_optimize_replace_exp (exp, child);
+}
+
+static void script_optimize_fold_dual (script_exp_t              *exp,
+                                       script_optimize_function_t function)
+{
+        script_obj_t *obj_a, *obj_b, *result;
+
+        if (!script_optimize_exp_is_constant (exp->data.dual.sub_a) ||
+            !script_optimize_exp_is_constant (exp->data.dual.sub_b))
+                return;
+
+        obj_a = script_optimize_exp_to_obj (exp->data.dual.sub_a);
+        obj_b = script_optimize_exp_to_obj (exp->data.dual.sub_b);
+        result = function (obj_a, obj_b);
+        script_optimize_replace_exp_with_obj (exp, result);
+        script_obj_unref (result);
+        script_obj_unref (obj_a);
+        script_obj_unref (obj_b);
+}
+
+static void script_optimize_fold_cmp (script_exp_t           *exp,
+                                      script_obj_cmp_result_t condition)
+{
+        script_obj_t *obj_a, *obj_b, *result;
+
+        if (!script_optimize_exp_is_constant (exp->data.dual.sub_a) ||
+            !script_optimize_exp_is_constant (exp->data.dual.sub_b))
+                return;
+
+        obj_a = script_optimize_exp_to_obj (exp->data.dual.sub_a);
+        obj_b = script_optimize_exp_to_obj (exp->data.dual.sub_b);
+        result = script_obj_new_number ((script_obj_cmp (obj_a, obj_b) & condition) ? 1 : 0);
+        script_optimize_replace_exp_with_obj (exp, result);
+        script_obj_unref (result);
+        script_obj_unref (obj_a);
+        script_obj_unref (obj_b);
+}
+
+static bool script_optimize_exp_as_bool (script_exp_t *exp)
+{
+        script_obj_t *obj = script_optimize_exp_to_obj (exp);
+        bool value = script_obj_as_bool (obj);
+
+        script_obj_unref (obj);
+        return value;
+}
+
+static void script_optimize_exp (script_exp_t *exp)
+{
+        ply_list_node_t *node;
+        script_obj_t *obj, *result;
+
+        if (!exp) return;
+        switch (exp->type) {
+        case SCRIPT_EXP_TYPE_EXTEND:
+        case SCRIPT_EXP_TYPE_ASSIGN:
+        case SCRIPT_EXP_TYPE_ASSIGN_PLUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MINUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MUL:
+        case SCRIPT_EXP_TYPE_ASSIGN_DIV:
+        case SCRIPT_EXP_TYPE_ASSIGN_MOD:
+        case SCRIPT_EXP_TYPE_ASSIGN_EXTEND:
+        case SCRIPT_EXP_TYPE_HASH:
+                script_optimize_exp (exp->data.dual.sub_a);
+                script_optimize_exp (exp->data.dual.sub_b);
+                break;
+
+        case SCRIPT_EXP_TYPE_PLUS:
+        case SCRIPT_EXP_TYPE_MINUS:
+        case SCRIPT_EXP_TYPE_MUL:
+        case SCRIPT_EXP_TYPE_DIV:
+        case SCRIPT_EXP_TYPE_MOD:
+                script_optimize_exp (exp->data.dual.sub_a);
+                script_optimize_exp (exp->data.dual.sub_b);
+                if (exp->type == SCRIPT_EXP_TYPE_PLUS)
+                        script_optimize_fold_dual (exp, script_obj_plus);
+                else if (exp->type == SCRIPT_EXP_TYPE_MINUS)
+                        script_optimize_fold_dual (exp, script_obj_minus);
+                else if (exp->type == SCRIPT_EXP_TYPE_MUL)
+                        script_optimize_fold_dual (exp, script_obj_mul);
+                else if (exp->type == SCRIPT_EXP_TYPE_DIV)
+                        script_optimize_fold_dual (exp, script_obj_div);
+                else
+                        script_optimize_fold_dual (exp, script_obj_mod);
+                break;
+
+        case SCRIPT_EXP_TYPE_EQ:
+        case SCRIPT_EXP_TYPE_NE:
+        case SCRIPT_EXP_TYPE_GT:
+        case SCRIPT_EXP_TYPE_GE:
+        case SCRIPT_EXP_TYPE_LT:
+        case SCRIPT_EXP_TYPE_LE:
+                script_optimize_exp (exp->data.dual.sub_a);
+                script_optimize_exp (exp->data.dual.sub_b);
+                /* Same conditions as script_evaluate () */
+                if (exp->type == SCRIPT_EXP_TYPE_EQ)
+                        script_optimize_fold_cmp (exp, SCRIPT_OBJ_CMP_RESULT_EQ);
+                else if (exp->type == SCRIPT_EXP_TYPE_NE)
+                        script_optimize_fold_cmp (exp, SCRIPT_OBJ_CMP_RESULT_NE |
+                                                  SCRIPT_OBJ_CMP_RESULT_LT |
+                                                  SCRIPT_OBJ_CMP_RESULT_GT);
+                else if (exp->type == SCRIPT_EXP_TYPE_GT)
+                        script_optimize_fold_cmp (exp, SCRIPT_OBJ_CMP_RESULT_GT);
+                else if (exp->type == SCRIPT_EXP_TYPE_GE)
+                        script_optimize_fold_cmp (exp, SCRIPT_OBJ_CMP_RESULT_GT |
+                                                  SCRIPT_OBJ_CMP_RESULT_EQ);
+                else if (exp->type == SCRIPT_EXP_TYPE_LT)
+                        script_optimize_fold_cmp (exp, SCRIPT_OBJ_CMP_RESULT_LT);
+                else
+                        script_optimize_fold_cmp (exp, SCRIPT_OBJ_CMP_RESULT_LT |
+                                                  SCRIPT_OBJ_CMP_RESULT_EQ);
+                break;
+
+        case SCRIPT_EXP_TYPE_AND:
+        case SCRIPT_EXP_TYPE_OR:
+                script_optimize_exp (exp->data.dual.sub_a);
+                script_optimize_exp (exp->data.dual.sub_b);
+                /* A constant left side decides which side is the result */
+                if (script_optimize_exp_is_constant (exp->data.dual.sub_a)) {
+                        bool value = script_optimize_exp_as_bool (exp->data.dual.sub_a);
+                        if (value == (exp->type == SCRIPT_EXP_TYPE_OR))
+                                script_optimize_hoist_exp (exp, &exp->data.dual.sub_a);
+                        else
+                                script_optimize_hoist_exp (exp, &exp->data.dual.sub_b);
+                        script_optimize_statistics.folded_expressions++;
+                }
+                break;
+
+        case SCRIPT_EXP_TYPE_NOT:
+        case SCRIPT_EXP_TYPE_NEG:
+                script_optimize_exp (exp->data.sub);
+                if (!script_optimize_exp_is_constant (exp->data.sub))
+                        break;
+                obj = script_optimize_exp_to_obj (exp->data.sub);
+                if (exp->type == SCRIPT_EXP_TYPE_NOT)
+                        result = script_obj_new_number (!script_obj_as_bool (obj));
+                else if (script_obj_is_number (obj))
+                        result = script_obj_new_number (-script_obj_as_number (obj));
+                else
+                        result = NULL; /* Left for the interpreter to report */
+                if (result)
+                        script_optimize_replace_exp_with_obj (exp, result);
+                script_obj_unref (result);
+                script_obj_unref (obj);
+                break;
+
+        case SCRIPT_EXP_TYPE_POS:
+                script_optimize_exp (exp->data.sub);
+                script_optimize_hoist_exp (exp, &exp->data.sub);
+                script_optimize_statistics.folded_expressions++;
+                break;
+
+        case SCRIPT_EXP_TYPE_PRE_INC:
+        case SCRIPT_EXP_TYPE_PRE_DEC:
+        case SCRIPT_EXP_TYPE_POST_INC:
+        case SCRIPT_EXP_TYPE_POST_DEC:
+                script_optimize_exp (exp->data.sub);
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_NUMBER:
+        case SCRIPT_EXP_TYPE_TERM_STRING:
+        case SCRIPT_EXP_TYPE_TERM_VAR:
+        case SCRIPT_EXP_TYPE_TERM_NULL:
+        case SCRIPT_EXP_TYPE_TERM_LOCAL:
+        case SCRIPT_EXP_TYPE_TERM_GLOBAL:
+        case SCRIPT_EXP_TYPE_TERM_THIS:
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_SET:
+                for (node = ply_list_get_first_node (exp->data.parameters);
+                     node;
+                     node = ply_list_get_next_node (exp->data.parameters, node)) {
+                        script_optimize_exp (ply_list_node_get_data (node));
+                }
+                break;
+
+        case SCRIPT_EXP_TYPE_FUNCTION_EXE:
+                script_optimize_exp (exp->data.function_exe.name);
+                for (node = ply_list_get_first_node (exp->data.function_exe.parameters);
+                     node;
+                     node = ply_list_get_next_node (exp->data.function_exe.parameters, node)) {
+                        script_optimize_exp (ply_list_node_get_data (node));
+                }
+                break;
+
+        case SCRIPT_EXP_TYPE_FUNCTION_DEF:
+                if (exp->data.function_def->type == SCRIPT_FUNCTION_TYPE_SCRIPT)
+                        script_optimize_op_internal (exp->data.function_def->data.script);
+                break;
+        }
+}
+
+/* Conditions are only tested for truth, so more can be dropped there */
+static void script_optimize_condition (script_exp_t *exp)
+{
+        script_optimize_exp (exp);
+
+        while (exp) {
+                if (exp->type == SCRIPT_EXP_TYPE_NOT &&
+                    exp->data.sub->type == SCRIPT_EXP_TYPE_NOT) {
+                        script_optimize_hoist_exp (exp->data.sub, &exp->data.sub->data.sub);
+                        script_optimize_hoist_exp (exp, &exp->data.sub);
+                } else if (exp->type == SCRIPT_EXP_TYPE_AND &&
+                           script_optimize_exp_is_constant (exp->data.dual.sub_b) &&
+                           script_optimize_exp_as_bool (exp->data.dual.sub_b)) {
+                        script_optimize_hoist_exp (exp, &exp->data.dual.sub_a);
+                } else if (exp->type == SCRIPT_EXP_TYPE_OR &&
+                           script_optimize_exp_is_constant (exp->data.dual.sub_b) &&
+                           !script_optimize_exp_as_bool (exp->data.dual.sub_b)) {
+                        script_optimize_hoist_exp (exp, &exp->data.dual.sub_a);
+                } else {
+                        break;
+                }
+                script_optimize_statistics.simplified_conditions++;
+        }
+}
+
+static script_op_t *script_optimize_new_empty_op (void)
+{
+        script_op_t *op = malloc (sizeof(script_op_t));
+
+        op->type = SCRIPT_OP_TYPE_OP_BLOCK;
+        op->data.list = ply_list_new ();
+        return op;
+}
+
+static bool script_optimize_op_is_empty (script_op_t *op)
+{
+        if (op->type == SCRIPT_OP_TYPE_OP_BLOCK)
+                return ply_list_get_length (op->data.list) == 0;
+        if (op->type == SCRIPT_OP_TYPE_EXPRESSION)
+                return script_optimize_exp_is_constant (op->data.exp);
+        return false;
+}
+
+static void script_optimize_op_list (ply_list_t *op_list)
+{
+        ply_list_node_t *node;
+        ply_list_node_t *next_node;
+        bool reachable = true;
+
+        for (node = ply_list_get_first_node (op_list);
+             node;
+             node = next_node) {
+                script_op_t *op = ply_list_node_get_data (node);
+                next_node = ply_list_get_next_node (op_list, node);
+
+                if (reachable)
+                        script_optimize_op_internal (op);
+
+                /* The last op of a function body gives its return value, so
+                 * it stays even when it does nothing.
+                 */
+                if (!reachable || (next_node && script_optimize_op_is_empty (op))) {
+                        ply_list_remove_node (op_list, node);
+                        script_parse_op_free (op);
+                        script_optimize_statistics.removed_ops++;
+                        continue;
+                }
+
+                if (op->type == SCRIPT_OP_TYPE_RETURN ||
+                    op->type == SCRIPT_OP_TYPE_FAIL ||
+                    op->type == SCRIPT_OP_TYPE_BREAK ||
+                    op->type == SCRIPT_OP_TYPE_CONTINUE)
+                        reachable = false;
+        }
+}
+
+static void script_optimize_op_internal (script_op_t *op)
+{
+        script_op_t *branch;
+
+        if (!op) return;
+        switch (op->type) {
+        case SCRIPT_OP_TYPE_EXPRESSION:
+        case SCRIPT_OP_TYPE_RETURN:
+                script_optimize_exp (op->data.exp);
+                break;
+
+        case SCRIPT_OP_TYPE_OP_BLOCK:
+                script_optimize_op_list (op->data.list);
+                break;
+
+        case SCRIPT_OP_TYPE_IF:
+                script_optimize_condition (op->data.cond_op.cond);
+                script_optimize_op_internal (op->data.cond_op.op1);
+                script_optimize_op_internal (op->data.cond_op.op2);
+                if (!script_optimize_exp_is_constant (op->data.cond_op.cond))
+                        break;
+                if (script_optimize_exp_as_bool (op->data.cond_op.cond)) {
+                        branch = op->data.cond_op.op1;
+                        op->data.cond_op.op1 = NULL;
+                } else {
+                        branch = op->data.cond_op.op2;
+                        op->data.cond_op.op2 = NULL;
+                }
+                if (!branch)
+                        branch = script_optimize_new_empty_op ();
+                script_optimize_replace_op (op, branch);
+                script_optimize_statistics.removed_branches++;
+                break;
+
+        case SCRIPT_OP_TYPE_WHILE:
+        case SCRIPT_OP_TYPE_FOR:
+                script_optimize_condition (op->data.cond_op.cond);
+                script_optimize_op_internal (op->data.cond_op.op1);
+                script_optimize_op_internal (op->data.cond_op.op2);
+                if (script_optimize_exp_is_constant (op->data.cond_op.cond) &&
+                    !script_optimize_exp_as_bool (op->data.cond_op.cond)) {
+                        script_optimize_replace_op (op, script_optimize_new_empty_op ());
+                        script_optimize_statistics.removed_branches++;
+                }
+                break;
+
+        case SCRIPT_OP_TYPE_DO_WHILE:
+                script_optimize_condition (op->data.cond_op.cond);
+                script_optimize_op_internal (op->data.cond_op.op1);
+                break;
+
+        case SCRIPT_OP_TYPE_FAIL:
+        case SCRIPT_OP_TYPE_BREAK:
+        case SCRIPT_OP_TYPE_CONTINUE:
+                break;
+        }
+}
+
+void script_optimize_op (script_op_t *op,
+                         const char  *name)
+{
+        script_optimize_statistics_t *statistics = &script_optimize_statistics;
+        int nodes_before = 0;
+
+        *statistics = (script_optimize_statistics_t) { 0 };
+        if (script_optimize_statistics_enabled)
+                nodes_before = script_optimize_count_op (op);
+
+        script_optimize_op_internal (op);
+
+        if (!script_optimize_statistics_enabled)
+                return;
+
+        ply_trace ("%s: %d nodes before optimizing, %d after; "
+                   "%d expressions folded, %d conditions simplified, "
+                   "%d branches and %d statements removed",
+                   name, nodes_before, script_optimize_count_op (op),
+                   statistics->folded_expressions, statistics->simplified_conditions,
+                   statistics->removed_branches, statistics->removed_ops);
+}
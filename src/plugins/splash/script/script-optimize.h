@@ -0,0 +1,29 @@
+/* script-optimize.h - simplify parsed scripts before they are run
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifndef SCRIPT_OPTIMIZE_H
+#define SCRIPT_OPTIMIZE_H
+
+#include <stdbool.h>
+
+#include "script.h"
+
+void script_optimize_set_statistics_enabled (bool enabled);
+void script_optimize_op (script_op_t *op,
+                         const char  *name);
+
+#endif /* SCRIPT_OPTIMIZE_H */
@@ -40,6 +40,7 @@
 #include "script-debug.h"
 #include "script-scan.h"
 #include "script-parse.h"
+#include "script-optimize.h"
 
 #define WITH_SEMIES
 
@@ -54,7 +55,6 @@ static script_op_t *script_parse_op (script_scan_t *scan);
 static script_exp_t *script_parse_exp (script_scan_t *scan);
 static ply_list_t *script_parse_op_list (script_scan_t *scan);
 static void script_parse_op_list_free (ply_list_t *op_list);
-static void script_parse_exp_free (script_exp_t *exp);
 
 static script_exp_t *script_parse_new_exp (script_exp_type_t        type,
                                            script_debug_location_t *location)
@@ -62,6 +62,8 @@ static script_exp_t *script_parse_new_exp (script_exp_type_t        type,
         script_exp_t *exp = malloc (sizeof(script_exp_t));
 
         exp->type = type;
+        exp->field_cache.shape_id = 0;
+        exp->field_cache.index = 0;
         script_debug_add_element (exp, location);
         return exp;
 }
@@ -880,7 +882,7 @@ static ply_list_t *script_parse_op_list (script_scan_t *scan)
         return op_list;
 }
 
-static void script_parse_exp_free (script_exp_t *exp)
+void script_parse_exp_free (script_exp_t *exp)
 {
         if (!exp) return;
         switch (exp->type) {
@@ -1044,6 +1046,7 @@ script_op_t *script_parse_file (const char *filename)
         }
         script_op_t *op = script_parse_new_op_block (list, &location);
         script_scan_free (scan);
+        script_optimize_op (op, filename);
         return op;
 }
 
@@ -1068,5 +1071,6 @@ script_op_t *script_parse_string (const char *string,
         }
         script_op_t *op = script_parse_new_op_block (list, &location);
         script_scan_free (scan);
+        script_optimize_op (op, name);
         return op;
 }
@@ -27,6 +27,7 @@
 script_op_t *script_parse_file (const char *filename);
 script_op_t *script_parse_string (const char *string,
                                   const char *name);
+void script_parse_exp_free (script_exp_t *exp);
 void script_parse_op_free (script_op_t *op);
 
 #endif /* SCRIPT_PARSE_H */
@@ -114,16 +114,32 @@ void script_obj_native_class_destroy (script_obj_native_class_t *class)
         return;
 }
 
+static script_return_t script_array_get_length (script_state_t *state,
+                                                void           *user_data)
+{
+        return script_return_obj (script_obj_new_number (script_obj_hash_get_length (state->this)));
+}
+
 script_state_t *script_state_new (void *user_data)
 {
         script_state_t *state = malloc (sizeof(script_state_t));
         script_obj_t *global_hash = script_obj_new_hash ();
+        script_obj_t *array_hash;
 
         state->global = script_obj_new_ref (global_hash);
         script_obj_unref (global_hash);
         state->local = script_obj_new_ref (global_hash);
         state->this = script_obj_new_null ();
         state->user_data = user_data;
+
+        /* Methods any hash falls back on, as strings do with String */
+        array_hash = script_obj_hash_get_element (state->global, "Array");
+        script_add_native_function (array_hash,
+                                    "GetLength",
+                                    script_array_get_length,
+                                    NULL,
+                                    NULL);
+        script_obj_unref (array_hash);
         return state;
 }
 
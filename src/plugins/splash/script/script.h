@@ -25,6 +25,7 @@
 #include "ply-hashtable.h"
 #include "ply-list.h"
 #include <stdbool.h>
+#include <stddef.h>
 
 typedef enum                        /* FIXME add _t to all types */
 {
@@ -102,6 +103,49 @@ typedef enum
         SCRIPT_OBJ_TYPE_NATIVE,
 } script_obj_type_t;
 
+/* Elements "0", "1", "2"... are kept in a plain array for as long as
+ * they run on from the start without gaps.  Other fields sit in slots
+ * laid out by a shape shared with every hash that gained the same
+ * fields in the same order, until there are too many of them and they
+ * move to the table.
+ */
+typedef struct
+{
+        ply_hashtable_t            *table;
+        struct script_obj_t       **elements;
+        int                         length;
+        int                         capacity;
+        struct script_obj_shape_t  *shape;
+        struct script_obj_t       **slots;
+} script_obj_hash_t;
+
+/* Strings share a buffer with the strings they were built from, each
+ * seeing only its own leading length bytes, so that appending to the
+ * longest of them can be done in place rather than by copying.
+ */
+typedef struct
+{
+        int    refcount;
+        char  *data;
+        size_t size;
+        size_t capacity;
+} script_obj_string_buffer_t;
+
+typedef struct
+{
+        script_obj_string_buffer_t *buffer;
+        size_t                      length;
+} script_obj_string_t;
+
+/* Remembers where a field was found last time, so that looking it up
+ * again in a hash of the same shape does not need to search
+ */
+typedef struct
+{
+        unsigned int shape_id;
+        int          index;
+} script_obj_field_cache_t;
+
 typedef struct script_obj_t
 {
         script_obj_type_t type;
@@ -109,7 +153,7 @@ typedef struct script_obj_t
         union
         {
                 script_number_t      number;
-                char                *string;
+                script_obj_string_t  string;
                 struct script_obj_t *obj;
                 struct
                 {
@@ -117,7 +161,7 @@ typedef struct script_obj_t
                         struct script_obj_t *obj_b;
                 } dual_obj;
                 script_function_t   *function;
-                ply_hashtable_t     *hash;
+                script_obj_hash_t   *hash;
                 script_obj_native_t  native;
         } data;
 } script_obj_t;
@@ -167,7 +211,8 @@ typedef enum
 
 typedef struct script_exp_t
 {
-        script_exp_type_t type;
+        script_exp_type_t        type;
+        script_obj_field_cache_t field_cache;
         union
         {
                 struct
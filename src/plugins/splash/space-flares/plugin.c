@@ -52,6 +52,7 @@
 #include "ply-image.h"
 #include "ply-pixel-buffer.h"
 #include "ply-pixel-display.h"
+#include "ply-static-layer.h"
 #include "ply-trigger.h"
 #include "ply-utils.h"
 
@@ -168,6 +169,7 @@ typedef struct
         ply_list_t               *sprites;
         ply_rectangle_t           box_area, lock_area, logo_area;
         ply_image_t              *scaled_background_image;
+        ply_static_layer_t       *background_layer;
 } view_t;
 
 struct _ply_boot_splash_plugin
@@ -206,6 +208,12 @@ struct _ply_boot_splash_plugin
 
 ply_boot_splash_plugin_interface_t *ply_boot_splash_plugin_get_interface (void);
 static void detach_from_event_loop (ply_boot_splash_plugin_t *plugin);
+static void draw_background (view_t             *view,
+                             ply_pixel_buffer_t *pixel_buffer,
+                             int                 x,
+                             int                 y,
+                             int                 width,
+                             int                 height);
 
 static view_t *
 view_new (ply_boot_splash_plugin_t *plugin,
@@ -223,6 +231,9 @@ view_new (ply_boot_splash_plugin_t *plugin,
 
         view->sprites = ply_list_new ();
 
+        view->background_layer = ply_static_layer_new ((ply_static_layer_draw_handler_t)
+                                                       draw_background, view);
+
         return view;
 }
 
@@ -238,6 +249,7 @@ view_free (view_t *view)
         ply_list_free (view->sprites);
 
         ply_image_free (view->scaled_background_image);
+        ply_static_layer_free (view->background_layer);
 
         free (view);
 }
@@ -1222,6 +1234,11 @@ stop_animation (ply_boot_splash_plugin_t *plugin)
         for (node = ply_list_get_first_node (plugin->views); node; node = ply_list_get_next_node (plugin->views, node)) {
                 view_t *view = ply_list_node_get_data (node);
                 view_free_sprites (view);
+
+                /* The stars in the background stop twinkling here, so
+                 * the cached copy needs to catch up with them
+                 */
+                ply_static_layer_invalidate (view->background_layer);
         }
 }
 
@@ -1231,13 +1248,6 @@ detach_from_event_loop (ply_boot_splash_plugin_t *plugin)
         plugin->loop = NULL;
 }
 
-static void
-draw_background (view_t             *view,
-                 ply_pixel_buffer_t *pixel_buffer,
-                 int                 x,
-                 int                 y,
-                 int                 width,
-                 int                 height);
 static void
 on_draw (view_t             *view,
          ply_pixel_buffer_t *pixel_buffer,
@@ -1268,7 +1278,8 @@ on_draw (view_t             *view,
             plugin->state == PLY_BOOT_SPLASH_DISPLAY_PASSWORD_ENTRY) {
                 uint32_t *box_data, *lock_data;
 
-                draw_background (view, pixel_buffer, x, y, width, height);
+                ply_static_layer_draw_area (view->background_layer, pixel_buffer,
+                                            x, y, width, height);
 
                 box_data = ply_image_get_data (plugin->box_image);
                 ply_pixel_buffer_fill_with_argb32_data (pixel_buffer,
@@ -1283,7 +1294,8 @@ on_draw (view_t             *view,
         } else {
                 ply_list_node_t *node;
 
-                draw_background (view, pixel_buffer, x, y, width, height);
+                ply_static_layer_draw_area (view->background_layer, pixel_buffer,
+                                            x, y, width, height);
 
                 for (node = ply_list_get_first_node (view->sprites); node; node = ply_list_get_next_node (view->sprites, node)) {
                         sprite_t *sprite = ply_list_node_get_data (node);
@@ -1443,6 +1455,7 @@ view_setup_scene (view_t *view)
                 if (view->scaled_background_image)
                         ply_image_free (view->scaled_background_image);
                 view->scaled_background_image = ply_image_resize (plugin->logo_image, screen_width, screen_height);
+                ply_static_layer_invalidate (view->background_layer);
                 star_bg = malloc (sizeof(star_bg_t));
                 star_bg->star_count = (screen_width * screen_height) / 400;
                 star_bg->star_x = malloc (sizeof(int) * star_bg->star_count);
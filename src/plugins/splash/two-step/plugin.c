@@ -56,6 +56,7 @@
 
 #include "ply-animation.h"
 #include "ply-progress-animation.h"
+#include "ply-static-layer.h"
 #include "ply-throbber.h"
 
 #include <linux/kd.h>
@@ -91,9 +92,9 @@ typedef struct
         ply_throbber_t           *throbber;
         ply_label_t              *label;
         ply_label_t              *message_label;
+        ply_static_layer_t       *background_layer;
         ply_rectangle_t           box_area, lock_area, watermark_area;
         ply_trigger_t            *end_trigger;
-        ply_image_t              *background_image;
 } view_t;
 
 struct _ply_boot_splash_plugin
@@ -144,6 +145,12 @@ static void display_message (ply_boot_splash_plugin_t *plugin,
                              const char               *message);
 static void become_idle (ply_boot_splash_plugin_t *plugin,
                          ply_trigger_t            *idle_trigger);
+static void draw_background (view_t             *view,
+                             ply_pixel_buffer_t *pixel_buffer,
+                             int                 x,
+                             int                 y,
+                             int                 width,
+                             int                 height);
 
 static view_t *
 view_new (ply_boot_splash_plugin_t *plugin,
@@ -168,6 +175,9 @@ view_new (ply_boot_splash_plugin_t *plugin,
         view->label = ply_label_new ();
         view->message_label = ply_label_new ();
 
+        view->background_layer = ply_static_layer_new ((ply_static_layer_draw_handler_t)
+                                                       draw_background, view);
+
         return view;
 }
 
@@ -180,9 +190,7 @@ view_free (view_t *view)
         ply_throbber_free (view->throbber);
         ply_label_free (view->label);
         ply_label_free (view->message_label);
-
-        if (view->background_image != NULL)
-                ply_image_free (view->background_image);
+        ply_static_layer_free (view->background_layer);
 
         free (view);
 }
@@ -253,11 +261,6 @@ view_load (view_t *view)
         screen_width = ply_pixel_display_get_width (view->display);
         screen_height = ply_pixel_display_get_height (view->display);
 
-        if (plugin->background_tile_image != NULL) {
-                ply_trace ("tiling background to %lux%lu", screen_width, screen_height);
-                view->background_image = ply_image_tile (plugin->background_tile_image, screen_width, screen_height);
-        }
-
         if (plugin->watermark_image != NULL) {
                 view->watermark_area.width = ply_image_get_width (plugin->watermark_image);
                 view->watermark_area.height = ply_image_get_height (plugin->watermark_image);
@@ -882,16 +885,12 @@ draw_background (view_t             *view,
                 ply_pixel_buffer_fill_with_hex_color (pixel_buffer, &area,
                                                       plugin->background_start_color);
 
-        if (view->background_image != NULL) {
-                uint32_t *data;
-                data = ply_image_get_data (view->background_image);
-
-                /* We must pass NULL as fill area, because the fill area
-                   must be sized as the image we're sourcing from, otherwise
-                   sampling does not work
-                */
-                ply_pixel_buffer_fill_with_argb32_data_with_clip (pixel_buffer, NULL, NULL, data);
-        }
+        /* The tile is repeated on the fly rather than expanded to a
+         * screen sized image up front
+         */
+        if (plugin->background_tile_image != NULL)
+                ply_pixel_buffer_fill_with_tiled_buffer (pixel_buffer, &area,
+                                                         ply_image_get_buffer (plugin->background_tile_image));
 
         if (plugin->watermark_image != NULL) {
                 uint32_t *data;
@@ -915,7 +914,8 @@ on_draw (view_t             *view,
 
         plugin = view->plugin;
 
-        draw_background (view, pixel_buffer, x, y, width, height);
+        ply_static_layer_draw_area (view->background_layer, pixel_buffer,
+                                    x, y, width, height);
 
         ply_pixel_buffer_get_size (pixel_buffer, &screen_area);
 
@@ -24,6 +24,28 @@
 
 #define PLY_BOOT_PROTOCOL_TRIMMED_ABSTRACT_SOCKET_PATH "/org/freedesktop/plymouthd"
 #define PLY_BOOT_PROTOCOL_OLD_ABSTRACT_SOCKET_PATH "/ply-boot-protocol"
+
+/* Connections start out speaking version 1: one request at a time, made of
+ * a command byte, an optional argument of at most 255 bytes, and untagged
+ * replies sent back in request order.
+ *
+ * A client may send a NEGOTIATE_VERSION request with the version number as
+ * argument.  If the daemon acknowledges it, every following request on that
+ * connection is wrapped in a version 2 message:
+ *
+ *   uint32 message size, followed by one or more commands, each made of
+ *   uint32 request id, command byte, uint32 argument size, argument
+ *
+ * Argument sizes include the terminating NUL, 0 means no argument.  Replies
+ * are prefixed with the uint32 id of the request they answer and may arrive
+ * in any order.  All integers are little endian.
+ */
+#define PLY_BOOT_PROTOCOL_VERSION 2
+#define PLY_BOOT_PROTOCOL_VERSION_STRING "2"
+#define PLY_BOOT_PROTOCOL_MESSAGE_HEADER_SIZE 4
+#define PLY_BOOT_PROTOCOL_COMMAND_HEADER_SIZE 9
+#define PLY_BOOT_PROTOCOL_MAX_MESSAGE_SIZE (512 * 1024)
+
 #define PLY_BOOT_PROTOCOL_REQUEST_TYPE_PING "P"
 #define PLY_BOOT_PROTOCOL_REQUEST_TYPE_UPDATE "U"
 #define PLY_BOOT_PROTOCOL_REQUEST_TYPE_CHANGE_MODE "C"
@@ -46,6 +68,7 @@
 #define PLY_BOOT_PROTOCOL_REQUEST_TYPE_NEWROOT "R"
 #define PLY_BOOT_PROTOCOL_REQUEST_TYPE_HAS_ACTIVE_VT "V"
 #define PLY_BOOT_PROTOCOL_REQUEST_TYPE_ERROR "!"
+#define PLY_BOOT_PROTOCOL_REQUEST_TYPE_NEGOTIATE_VERSION "#"
 
 #define PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK "\x6"
 #define PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NAK "\x15"
@@ -44,12 +44,22 @@ typedef struct
         int                fd;
         ply_fd_watch_t    *watch;
         ply_boot_server_t *server;
+        ply_buffer_t      *buffer;
+        ply_buffer_t      *reply_buffer;
+        ply_fd_watch_t    *reply_watch;
         uid_t              uid;
         pid_t              pid;
+        int                protocol_version;
 
         uint32_t           credentials_read : 1;
 } ply_boot_connection_t;
 
+typedef struct
+{
+        ply_boot_connection_t *connection;
+        uint32_t               request_id;
+} ply_boot_pending_reply_t;
+
 struct _ply_boot_server
 {
         ply_event_loop_t                             *loop;
@@ -161,10 +171,13 @@ ply_boot_connection_new (ply_boot_server_t *server,
 {
         ply_boot_connection_t *connection;
 
-        connection = calloc (1, sizeof(ply_boot_server_t));
+        connection = calloc (1, sizeof(ply_boot_connection_t));
         connection->fd = fd;
         connection->server = server;
         connection->watch = NULL;
+        connection->buffer = ply_buffer_new ();
+        connection->reply_buffer = ply_buffer_new ();
+        connection->protocol_version = 1;
 
         return connection;
 }
@@ -175,10 +188,29 @@ ply_boot_connection_free (ply_boot_connection_t *connection)
         if (connection == NULL)
                 return;
 
+        if (connection->reply_watch != NULL)
+                ply_event_loop_stop_watching_fd (connection->server->loop,
+                                                 connection->reply_watch);
+
         close (connection->fd);
+        ply_buffer_free (connection->buffer);
+        ply_buffer_free (connection->reply_buffer);
         free (connection);
 }
 
+static ply_boot_pending_reply_t *
+ply_boot_pending_reply_new (ply_boot_connection_t *connection,
+                            uint32_t               request_id)
+{
+        ply_boot_pending_reply_t *pending_reply;
+
+        pending_reply = calloc (1, sizeof(ply_boot_pending_reply_t));
+        pending_reply->connection = connection;
+        pending_reply->request_id = request_id;
+
+        return pending_reply;
+}
+
 bool
 ply_boot_server_listen (ply_boot_server_t *server)
 {
@@ -200,6 +232,50 @@ ply_boot_server_stop_listening (ply_boot_server_t *server)
         assert (server != NULL);
 }
 
+static void
+print_connection_process_identity (ply_boot_connection_t *connection)
+{
+        char *command_line, *parent_command_line;
+        pid_t parent_pid;
+
+        command_line = ply_get_process_command_line (connection->pid);
+
+        if (connection->pid == 1) {
+                ply_trace ("connection is from toplevel init process (%s)", command_line);
+        } else {
+                parent_pid = ply_get_process_parent_pid (connection->pid); parent_command_line = ply_get_process_command_line (parent_pid);
+
+                ply_trace ("connection is from pid %ld (%s) with parent pid %ld (%s)",
+                           (long) connection->pid, command_line,
+                           (long) parent_pid, parent_command_line);
+
+                free (parent_command_line);
+        }
+
+        free (command_line);
+}
+
+static bool
+ply_boot_connection_read_credentials (ply_boot_connection_t *connection)
+{
+        /* The peer credentials are fixed when the connection is
+         * established, so only ask the kernel for them once
+         */
+        if (connection->credentials_read)
+                return true;
+
+        if (!ply_get_credentials_from_fd (connection->fd, &connection->pid, &connection->uid, NULL)) {
+                ply_trace ("couldn't read credentials from connection: %m");
+                return false;
+        }
+        connection->credentials_read = true;
+
+        if (ply_is_tracing ())
+                print_connection_process_identity (connection);
+
+        return true;
+}
+
 static bool
 ply_boot_connection_read_request (ply_boot_connection_t *connection,
                                   char                 **command,
@@ -210,8 +286,6 @@ ply_boot_connection_read_request (ply_boot_connection_t *connection,
         assert (connection != NULL);
         assert (connection->fd >= 0);
 
-        connection->credentials_read = false;
-
         if (!ply_read (connection->fd, header, sizeof(header)))
                 return false;
 
@@ -236,14 +310,6 @@ ply_boot_connection_read_request (ply_boot_connection_t *connection,
                 }
         }
 
-        if (!ply_get_credentials_from_fd (connection->fd, &connection->pid, &connection->uid, NULL)) {
-                ply_trace ("couldn't read credentials from connection: %m");
-                free (*argument);
-                free (*command);
-                return false;
-        }
-        connection->credentials_read = true;
-
         return true;
 }
 
@@ -258,132 +324,214 @@ ply_boot_connection_is_from_root (ply_boot_connection_t *connection)
         return connection->uid == 0;
 }
 
+static void
+append_uint32 (ply_buffer_t *buffer,
+               uint32_t      value)
+{
+        uint8_t bytes[4];
+
+        bytes[0] = (value >> 0) & 0xFF;
+        bytes[1] = (value >> 8) & 0xFF;
+        bytes[2] = (value >> 16) & 0xFF;
+        bytes[3] = (value >> 24) & 0xFF;
+
+        ply_buffer_append_bytes (buffer, bytes, sizeof(bytes));
+}
+
+static uint32_t
+get_uint32 (const char *bytes)
+{
+        const uint8_t *data = (const uint8_t *) bytes;
+
+        return (data[0] << 0) |
+               (data[1] << 8) |
+               (data[2] << 16) |
+               ((uint32_t) data[3] << 24);
+}
+
+static bool ply_boot_connection_flush_replies (ply_boot_connection_t *connection);
+
+static void
+ply_boot_connection_on_writable (ply_boot_connection_t *connection)
+{
+        if (!ply_boot_connection_flush_replies (connection))
+                ply_trace ("could not finish writing replies: %m");
+
+        /* Only drop the watch from its own handler, the event loop may be
+         * about to dispatch to it when some other handler sends a reply
+         */
+        if (ply_buffer_get_size (connection->reply_buffer) == 0) {
+                ply_event_loop_stop_watching_fd (connection->server->loop,
+                                                 connection->reply_watch);
+                connection->reply_watch = NULL;
+        }
+}
+
+static bool
+ply_boot_connection_flush_replies (ply_boot_connection_t *connection)
+{
+        ssize_t bytes_written;
+
+        /* Never block on a client that isn't reading its replies, it may
+         * itself be blocked sending us more requests
+         */
+        while (ply_buffer_get_size (connection->reply_buffer) > 0) {
+                bytes_written = send (connection->fd,
+                                      ply_buffer_get_bytes (connection->reply_buffer),
+                                      ply_buffer_get_size (connection->reply_buffer),
+                                      MSG_DONTWAIT | MSG_NOSIGNAL);
+
+                if (bytes_written > 0) {
+                        ply_buffer_remove_bytes (connection->reply_buffer, bytes_written);
+                        continue;
+                }
+
+                if (bytes_written < 0 && errno == EINTR)
+                        continue;
+
+                if (bytes_written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                        if (connection->reply_watch == NULL)
+                                connection->reply_watch =
+                                        ply_event_loop_watch_fd (connection->server->loop,
+                                                                 connection->fd,
+                                                                 PLY_EVENT_LOOP_FD_STATUS_CAN_TAKE_DATA,
+                                                                 (ply_event_handler_t)
+                                                                 ply_boot_connection_on_writable,
+                                                                 NULL, connection);
+                        return true;
+                }
+
+                ply_buffer_clear (connection->reply_buffer);
+                return false;
+        }
+
+        return true;
+}
+
+static bool
+ply_boot_connection_send_reply (ply_boot_connection_t *connection,
+                                uint32_t               request_id,
+                                const char            *response_type,
+                                const char            *data,
+                                uint32_t               size)
+{
+        ply_buffer_t *reply = connection->reply_buffer;
+
+        /* Version 1 replies are not tagged, and come back in the same order
+         * as the requests.  Version 2 replies are prefixed with the id of the
+         * request they answer, so they can be sent as soon as they're ready.
+         */
+        if (connection->protocol_version >= 2)
+                append_uint32 (reply, request_id);
+
+        ply_buffer_append_bytes (reply, response_type, strlen (response_type));
+
+        if (data != NULL) {
+                append_uint32 (reply, size);
+
+                if (size > 0)
+                        ply_buffer_append_bytes (reply, data, size);
+        }
+
+        return ply_boot_connection_flush_replies (connection);
+}
+
 static void
 ply_boot_connection_send_answer (ply_boot_connection_t *connection,
+                                 uint32_t               request_id,
                                  const char            *answer)
 {
-        uint32_t size;
-
         /* splash plugin isn't able to ask for password,
          * punt to client
          */
         if (answer == NULL) {
-                if (!ply_write (connection->fd,
-                                PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NO_ANSWER,
-                                strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NO_ANSWER)))
+                if (!ply_boot_connection_send_reply (connection, request_id,
+                                                     PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NO_ANSWER,
+                                                     NULL, 0))
                         ply_trace ("could not finish writing no answer reply: %m");
         } else {
-                size = strlen (answer);
-
-                if (!ply_write (connection->fd,
-                                PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ANSWER,
-                                strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ANSWER)) ||
-                    !ply_write_uint32 (connection->fd,
-                                       size) ||
-                    !ply_write (connection->fd,
-                                answer, size))
+                if (!ply_boot_connection_send_reply (connection, request_id,
+                                                     PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ANSWER,
+                                                     answer, strlen (answer)))
                         ply_trace ("could not finish writing answer: %m");
         }
 }
 
 static void
-ply_boot_connection_on_password_answer (ply_boot_connection_t *connection,
-                                        const char            *password)
+ply_boot_connection_on_password_answer (ply_boot_pending_reply_t *pending_reply,
+                                        const char               *password)
 {
+        ply_boot_connection_t *connection = pending_reply->connection;
+
         ply_trace ("got password answer");
 
-        ply_boot_connection_send_answer (connection, password);
+        ply_boot_connection_send_answer (connection, pending_reply->request_id, password);
         if (password != NULL)
                 ply_list_append_data (connection->server->cached_passwords,
                                       strdup (password));
+        free (pending_reply);
 }
 
 static void
-ply_boot_connection_on_deactivated (ply_boot_connection_t *connection)
+ply_boot_connection_on_deactivated (ply_boot_pending_reply_t *pending_reply)
 {
         ply_trace ("deactivated");
-        if (!ply_write (connection->fd,
-                        PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK,
-                        strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK)))
+        if (!ply_boot_connection_send_reply (pending_reply->connection,
+                                             pending_reply->request_id,
+                                             PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK,
+                                             NULL, 0))
                 ply_trace ("could not finish writing deactivate reply: %m");
+        free (pending_reply);
 }
 
 static void
-ply_boot_connection_on_quit_complete (ply_boot_connection_t *connection)
+ply_boot_connection_on_quit_complete (ply_boot_pending_reply_t *pending_reply)
 {
         ply_trace ("quit complete");
-        if (!ply_write (connection->fd,
-                        PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK,
-                        strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK)))
+        if (!ply_boot_connection_send_reply (pending_reply->connection,
+                                             pending_reply->request_id,
+                                             PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK,
+                                             NULL, 0))
                 ply_trace ("could not finish writing quit reply: %m");
+        free (pending_reply);
 }
 
 static void
-ply_boot_connection_on_question_answer (ply_boot_connection_t *connection,
-                                        const char            *answer)
+ply_boot_connection_on_question_answer (ply_boot_pending_reply_t *pending_reply,
+                                        const char               *answer)
 {
         ply_trace ("got question answer: %s", answer);
-        ply_boot_connection_send_answer (connection, answer);
+        ply_boot_connection_send_answer (pending_reply->connection,
+                                         pending_reply->request_id, answer);
+        free (pending_reply);
 }
 
 static void
-ply_boot_connection_on_keystroke_answer (ply_boot_connection_t *connection,
-                                         const char            *key)
+ply_boot_connection_on_keystroke_answer (ply_boot_pending_reply_t *pending_reply,
+                                         const char               *key)
 {
         ply_trace ("got key: %s", key);
-        ply_boot_connection_send_answer (connection, key);
+        ply_boot_connection_send_answer (pending_reply->connection,
+                                         pending_reply->request_id, key);
+        free (pending_reply);
 }
 
 static void
-print_connection_process_identity (ply_boot_connection_t *connection)
-{
-        char *command_line, *parent_command_line;
-        pid_t parent_pid;
-
-        command_line = ply_get_process_command_line (connection->pid);
-
-        if (connection->pid == 1) {
-                ply_trace ("connection is from toplevel init process (%s)", command_line);
-        } else {
-                parent_pid = ply_get_process_parent_pid (connection->pid); parent_command_line = ply_get_process_command_line (parent_pid);
-
-                ply_trace ("connection is from pid %ld (%s) with parent pid %ld (%s)",
-                           (long) connection->pid, command_line,
-                           (long) parent_pid, parent_command_line);
-
-                free (parent_command_line);
-        }
-
-        free (command_line);
-}
-
-static void
-ply_boot_connection_on_request (ply_boot_connection_t *connection)
+ply_boot_connection_handle_request (ply_boot_connection_t *connection,
+                                    uint32_t               request_id,
+                                    char                  *command,
+                                    char                  *argument)
 {
         ply_boot_server_t *server;
-        char *command, *argument;
-
-        assert (connection != NULL);
-        assert (connection->fd >= 0);
 
         server = connection->server;
-        assert (server != NULL);
-
-        if (!ply_boot_connection_read_request (connection,
-                                               &command, &argument)) {
-                ply_trace ("could not read connection request");
-                return;
-        }
-
-        if (ply_is_tracing ())
-                print_connection_process_identity (connection);
 
         if (!ply_boot_connection_is_from_root (connection)) {
                 ply_error ("request came from non-root user");
 
-                if (!ply_write (connection->fd,
-                                PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NAK,
-                                strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NAK)))
+                if (!ply_boot_connection_send_reply (connection, request_id,
+                                                     PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NAK,
+                                                     NULL, 0))
                         ply_trace ("could not finish writing is-not-root nak: %m");
 
                 free (argument);
@@ -392,9 +540,9 @@ ply_boot_connection_on_request (ply_boot_connection_t *connection)
         }
 
         if (strcmp (command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_UPDATE) == 0) {
-                if (!ply_write (connection->fd,
-                                PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK,
-                                strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK)) &&
+                if (!ply_boot_connection_send_reply (connection, request_id,
+                                                     PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK,
+                                                     NULL, 0) &&
                     errno != EPIPE)
                         ply_trace ("could not finish writing update reply: %m");
 
@@ -405,9 +553,9 @@ ply_boot_connection_on_request (ply_boot_connection_t *connection)
                 free (command);
                 return;
         } else if (strcmp (command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_CHANGE_MODE) == 0) {
-                if (!ply_write (connection->fd,
-                                PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK,
-                                strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK)))
+                if (!ply_boot_connection_send_reply (connection, request_id,
+                                                     PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK,
+                                                     NULL, 0))
                         ply_trace ("could not finish writing update reply: %m");
 
                 ply_trace ("got change mode notification");
@@ -427,9 +575,9 @@ ply_boot_connection_on_request (ply_boot_connection_t *connection)
                 }
 
                 ply_trace ("got system-update notification %li%%", value);
-                if (!ply_write (connection->fd,
-                                PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK,
-                                strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK)))
+                if (!ply_boot_connection_send_reply (connection, request_id,
+                                                     PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK,
+                                                     NULL, 0))
                         ply_trace ("could not finish writing update reply: %m");
 
                 if (server->system_update_handler != NULL)
@@ -437,6 +585,35 @@ ply_boot_connection_on_request (ply_boot_connection_t *connection)
                 free (argument);
                 free (command);
                 return;
+        } else if (strcmp (command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_NEGOTIATE_VERSION) == 0) {
+                long int version;
+
+                version = argument != NULL ? strtol (argument, NULL, 10) : 0;
+
+                ply_trace ("client asked for protocol version %ld", version);
+
+                if (connection->protocol_version != 1 ||
+                    version != PLY_BOOT_PROTOCOL_VERSION) {
+                        if (!ply_boot_connection_send_reply (connection, request_id,
+                                                             PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NAK,
+                                                             NULL, 0))
+                                ply_trace ("could not finish writing version nak: %m");
+                        free (argument);
+                        free (command);
+                        return;
+                }
+
+                /* The acknowledgement is the last reply using version 1 framing
+                 */
+                if (!ply_boot_connection_send_reply (connection, request_id,
+                                                     PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK,
+                                                     NULL, 0))
+                        ply_trace ("could not finish writing version ack: %m");
+
+                connection->protocol_version = PLY_BOOT_PROTOCOL_VERSION;
+                free (argument);
+                free (command);
+                return;
         } else if (strcmp (command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_SYSTEM_INITIALIZED) == 0) {
                 ply_trace ("got system initialized notification");
                 if (server->system_initialized_handler != NULL)
@@ -463,7 +640,7 @@ ply_boot_connection_on_request (ply_boot_connection_t *connection)
                 ply_trigger_add_handler (deactivate_trigger,
                                          (ply_trigger_handler_t)
                                          ply_boot_connection_on_deactivated,
-                                         connection);
+                                         ply_boot_pending_reply_new (connection, request_id));
 
                 if (server->deactivate_handler != NULL)
                         server->deactivate_handler (server->user_data, deactivate_trigger, server);
@@ -481,7 +658,7 @@ ply_boot_connection_on_request (ply_boot_connection_t *connection)
                 bool retain_splash;
                 ply_trigger_t *quit_trigger;
 
-                retain_splash = (bool) argument[0];
+                retain_splash = argument != NULL && (bool) argument[0];
 
                 ply_trace ("got quit %srequest", retain_splash ? "--retain-splash " : "");
 
@@ -490,7 +667,7 @@ ply_boot_connection_on_request (ply_boot_connection_t *connection)
                 ply_trigger_add_handler (quit_trigger,
                                          (ply_trigger_handler_t)
                                          ply_boot_connection_on_quit_complete,
-                                         connection);
+                                         ply_boot_pending_reply_new (connection, request_id));
 
                 if (server->quit_handler != NULL)
                         server->quit_handler (server->user_data, retain_splash, quit_trigger, server);
@@ -509,7 +686,7 @@ ply_boot_connection_on_request (ply_boot_connection_t *connection)
                 ply_trigger_add_handler (answer,
                                          (ply_trigger_handler_t)
                                          ply_boot_connection_on_password_answer,
-                                         connection);
+                                         ply_boot_pending_reply_new (connection, request_id));
 
                 if (server->ask_for_password_handler != NULL) {
                         server->ask_for_password_handler (server->user_data,
@@ -528,7 +705,6 @@ ply_boot_connection_on_request (ply_boot_connection_t *connection)
                 ply_list_node_t *node;
                 ply_buffer_t *buffer;
                 size_t buffer_size;
-                uint32_t size;
 
                 ply_trace ("got cached password request");
 
@@ -562,22 +738,17 @@ ply_boot_connection_on_request (ply_boot_connection_t *connection)
                 if (buffer_size == 0) {
                         ply_trace ("Responding with 'no answer' reply since there are currently "
                                    "no cached answers");
-                        if (!ply_write (connection->fd,
-                                        PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NO_ANSWER,
-                                        strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NO_ANSWER)))
+                        if (!ply_boot_connection_send_reply (connection, request_id,
+                                                             PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NO_ANSWER,
+                                                             NULL, 0))
                                 ply_trace ("could not finish writing no answer reply: %m");
                 } else {
-                        size = buffer_size;
-
                         ply_trace ("writing %d cached answers",
                                    ply_list_get_length (server->cached_passwords));
-                        if (!ply_write (connection->fd,
-                                        PLY_BOOT_PROTOCOL_RESPONSE_TYPE_MULTIPLE_ANSWERS,
-                                        strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_MULTIPLE_ANSWERS)) ||
-                            !ply_write_uint32 (connection->fd,
-                                               size) ||
-                            !ply_write (connection->fd,
-                                        ply_buffer_get_bytes (buffer), size))
+                        if (!ply_boot_connection_send_reply (connection, request_id,
+                                                             PLY_BOOT_PROTOCOL_RESPONSE_TYPE_MULTIPLE_ANSWERS,
+                                                             ply_buffer_get_bytes (buffer),
+                                                             buffer_size))
                                 ply_trace ("could not finish writing cached answer reply: %m");
                 }
 
@@ -593,7 +764,7 @@ ply_boot_connection_on_request (ply_boot_connection_t *connection)
                 ply_trigger_add_handler (answer,
                                          (ply_trigger_handler_t)
                                          ply_boot_connection_on_question_answer,
-                                         connection);
+                                         ply_boot_pending_reply_new (connection, request_id));
 
                 if (server->ask_question_handler != NULL) {
                         server->ask_question_handler (server->user_data,
@@ -625,7 +796,7 @@ ply_boot_connection_on_request (ply_boot_connection_t *connection)
                 ply_trigger_add_handler (answer,
                                          (ply_trigger_handler_t)
                                          ply_boot_connection_on_keystroke_answer,
-                                         connection);
+                                         ply_boot_pending_reply_new (connection, request_id));
 
                 if (server->watch_for_keystroke_handler != NULL) {
                         server->watch_for_keystroke_handler (server->user_data,
@@ -668,9 +839,9 @@ ply_boot_connection_on_request (ply_boot_connection_t *connection)
                         answer = server->has_active_vt_handler (server->user_data, server);
 
                 if (!answer) {
-                        if (!ply_write (connection->fd,
-                                        PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NAK,
-                                        strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NAK)))
+                        if (!ply_boot_connection_send_reply (connection, request_id,
+                                                             PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NAK,
+                                                             NULL, 0))
                                 ply_trace ("could not finish writing nak: %m");
 
                         free (argument);
@@ -680,9 +851,9 @@ ply_boot_connection_on_request (ply_boot_connection_t *connection)
         } else if (strcmp (command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_PING) != 0) {
                 ply_error ("received unknown command '%s' from client", command);
 
-                if (!ply_write (connection->fd,
-                                PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NAK,
-                                strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NAK)))
+                if (!ply_boot_connection_send_reply (connection, request_id,
+                                                     PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NAK,
+                                                     NULL, 0))
                         ply_trace ("could not finish writing ping reply: %m");
 
                 free (argument);
@@ -690,14 +861,153 @@ ply_boot_connection_on_request (ply_boot_connection_t *connection)
                 return;
         }
 
-        if (!ply_write (connection->fd,
-                        PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK,
-                        strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK)))
+        if (!ply_boot_connection_send_reply (connection, request_id,
+                                             PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK,
+                                             NULL, 0))
                 ply_trace ("could not finish writing ack: %m");
         free (argument);
         free (command);
 }
 
+static bool
+ply_boot_connection_fill_buffer (ply_boot_connection_t *connection)
+{
+        char bytes[4096];
+        ssize_t bytes_read;
+
+        /* Read one chunk without blocking.  Complete messages get dispatched
+         * between chunks, so the buffer only ever holds one partial message
+         * plus whatever arrived with it.
+         */
+        do {
+                bytes_read = recv (connection->fd, bytes, sizeof(bytes), MSG_DONTWAIT);
+        } while (bytes_read < 0 && errno == EINTR);
+
+        if (bytes_read <= 0)
+                return false;
+
+        ply_buffer_append_bytes (connection->buffer, bytes, bytes_read);
+        return true;
+}
+
+static bool
+ply_boot_connection_process_message (ply_boot_connection_t *connection,
+                                     const char            *message,
+                                     uint32_t               message_size)
+{
+        const char *end = message + message_size;
+
+        /* A message holds one or more batched commands, each laid out as
+         * request id, command byte, argument size and argument
+         */
+        while (message < end) {
+                uint32_t request_id;
+                uint32_t argument_size;
+                char *command, *argument;
+
+                if (end - message < PLY_BOOT_PROTOCOL_COMMAND_HEADER_SIZE)
+                        return false;
+
+                request_id = get_uint32 (message);
+                command = calloc (2, sizeof(char));
+                command[0] = message[4];
+                argument_size = get_uint32 (message + 5);
+                message += PLY_BOOT_PROTOCOL_COMMAND_HEADER_SIZE;
+
+                if (argument_size > (uint32_t) (end - message)) {
+                        free (command);
+                        return false;
+                }
+
+                argument = NULL;
+                if (argument_size > 0) {
+                        argument = malloc (argument_size);
+                        memcpy (argument, message, argument_size);
+                        argument[argument_size - 1] = '\0';
+                        message += argument_size;
+                }
+
+                ply_boot_connection_handle_request (connection, request_id,
+                                                    command, argument);
+        }
+
+        return true;
+}
+
+static bool
+ply_boot_connection_process_messages (ply_boot_connection_t *connection)
+{
+        while (ply_buffer_get_size (connection->buffer) >= PLY_BOOT_PROTOCOL_MESSAGE_HEADER_SIZE) {
+                const char *bytes;
+                uint32_t message_size;
+                char *message;
+
+                bytes = ply_buffer_get_bytes (connection->buffer);
+                message_size = get_uint32 (bytes);
+
+                if (message_size > PLY_BOOT_PROTOCOL_MAX_MESSAGE_SIZE) {
+                        ply_trace ("client announced message of %u bytes, which is too big",
+                                   message_size);
+                        return false;
+                }
+
+                if (ply_buffer_get_size (connection->buffer) < PLY_BOOT_PROTOCOL_MESSAGE_HEADER_SIZE + message_size)
+                        break;
+
+                /* Handlers may reenter the event loop, so don't parse
+                 * straight out of the connection buffer
+                 */
+                message = malloc (message_size + 1);
+                memcpy (message, bytes + PLY_BOOT_PROTOCOL_MESSAGE_HEADER_SIZE, message_size);
+                ply_buffer_remove_bytes (connection->buffer,
+                                         PLY_BOOT_PROTOCOL_MESSAGE_HEADER_SIZE + message_size);
+
+                if (!ply_boot_connection_process_message (connection, message, message_size)) {
+                        ply_trace ("client sent malformed message");
+                        free (message);
+                        return false;
+                }
+                free (message);
+        }
+
+        return true;
+}
+
+static void
+ply_boot_connection_on_request (ply_boot_connection_t *connection)
+{
+        ply_boot_server_t *server;
+        char *command, *argument;
+
+        assert (connection != NULL);
+        assert (connection->fd >= 0);
+
+        server = connection->server;
+        assert (server != NULL);
+
+        if (!ply_boot_connection_read_credentials (connection))
+                return;
+
+        if (connection->protocol_version >= 2) {
+                while (ply_boot_connection_fill_buffer (connection)) {
+                        if (!ply_boot_connection_process_messages (connection)) {
+                                ply_buffer_clear (connection->buffer);
+                                shutdown (connection->fd, SHUT_RDWR);
+                                return;
+                        }
+                }
+                return;
+        }
+
+        if (!ply_boot_connection_read_request (connection,
+                                               &command, &argument)) {
+                ply_trace ("could not read connection request");
+                return;
+        }
+
+        ply_boot_connection_handle_request (connection, 0, command, argument);
+}
+
 static void
 ply_boot_connection_on_hangup (ply_boot_connection_t *connection)
 {